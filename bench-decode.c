@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2016 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Decode the specified files with every input plug-in that supports them and
+ * report the throughput of each plug-in. Each plug-in is run in a child
+ * process, so that its peak memory use is not mixed up with that of the
+ * others.
+ *
+ * This program is linked with the objects of siren itself, except for the
+ * ones containing main() and the message functions, which would draw on the
+ * screen.
+ */
+
+#include "config.h"
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "siren.h"
+
+#define BENCH_DECODE_BUFSIZE	1024	/* Buffer size, in frames */
+#define BENCH_DECODE_NSEEKS	10
+
+struct bench_decode_args {
+	char		**files;
+	int		  nfiles;
+	unsigned int	  nseeks;
+};
+
+struct bench_decode_result {
+	int		 nfiles;
+	unsigned long long nframes;
+	double		 audio;		/* Seconds of audio decoded */
+	double		 wall;		/* Seconds spent decoding */
+	double		 cpu;		/* CPU seconds spent decoding */
+	double		 metadata;	/* Seconds spent getting metadata */
+	double		 seek;		/* Seconds spent seeking */
+	unsigned int	 nseeks;
+};
+
+static double		 bench_decode_cpu(void);
+static int		 bench_decode_file(const struct ip *, const char *,
+			    unsigned int, struct bench_decode_result *);
+static void		 bench_decode_free_metadata(struct track *);
+static void		 bench_decode_ip(const struct ip *, void *);
+static int		 bench_decode_match(const struct ip *, const char *);
+static double		 bench_decode_now(void);
+static void		 bench_decode_run(const struct ip *,
+			    struct bench_decode_args *);
+NORETURN static void	 bench_decode_usage(void);
+
+static enum byte_order	 bench_decode_byte_order;
+
+static double
+bench_decode_cpu(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+	    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * Decode the specified file and then seek to nseeks evenly spaced positions.
+ * A seek is timed together with the first read after it, because some
+ * plug-ins defer the work to the next read.
+ */
+static int
+bench_decode_file(const struct ip *ip, const char *file, unsigned int nseeks,
+    struct bench_decode_result *res)
+{
+	struct track		t;
+	struct sample_buffer	sb;
+	unsigned long long	nsamples;
+	unsigned int		duration, i;
+	double			cpu, start;
+	int			ret;
+
+	memset(&t, 0, sizeof t);
+	t.path = xstrdup(file);
+	t.ip = ip;
+	t.format.byte_order = bench_decode_byte_order;
+
+	start = bench_decode_now();
+	ip->get_metadata(&t);
+	res->metadata += bench_decode_now() - start;
+	bench_decode_free_metadata(&t);
+
+	if (ip->open(&t) == -1) {
+		free(t.path);
+		return -1;
+	}
+
+	if (t.format.nbits <= 8)
+		sb.nbytes = 1;
+	else if (t.format.nbits <= 16)
+		sb.nbytes = 2;
+	else
+		sb.nbytes = 4;
+	sb.size_s = BENCH_DECODE_BUFSIZE * t.format.nchannels;
+	sb.size_b = sb.size_s * sb.nbytes;
+	sb.data = xmalloc(sb.size_b);
+	sb.data1 = sb.data;
+	sb.data2 = sb.data;
+	sb.data4 = sb.data;
+	sb.swap = 0;
+
+	nsamples = 0;
+	cpu = bench_decode_cpu();
+	start = bench_decode_now();
+	while ((ret = ip->read(&t, &sb)) > 0)
+		nsamples += sb.len_s;
+	res->wall += bench_decode_now() - start;
+	res->cpu += bench_decode_cpu() - cpu;
+
+	if (ret == -1)
+		fprintf(stderr, "%s: %s: decoding error\n", ip->name, file);
+
+	res->nfiles++;
+	res->nframes += nsamples / t.format.nchannels;
+	res->audio += (double)nsamples / t.format.nchannels / t.format.rate;
+
+	duration = nsamples / t.format.nchannels / t.format.rate;
+	for (i = 0; i < nseeks && duration > 0; i++) {
+		start = bench_decode_now();
+		ip->seek(&t, i * duration / nseeks);
+		ip->read(&t, &sb);
+		res->seek += bench_decode_now() - start;
+		res->nseeks++;
+	}
+
+	ip->close(&t);
+	free(sb.data);
+	free(t.path);
+	return 0;
+}
+
+static void
+bench_decode_free_metadata(struct track *t)
+{
+	free(t->album);
+	free(t->albumartist);
+	free(t->albumgain);
+	free(t->albumpeak);
+	free(t->artist);
+	free(t->comment);
+	free(t->date);
+	free(t->discnumber);
+	free(t->disctotal);
+	free(t->genre);
+	free(t->title);
+	free(t->trackgain);
+	free(t->tracknumber);
+	free(t->trackpeak);
+	free(t->tracktotal);
+}
+
+static void
+bench_decode_ip(const struct ip *ip, void *p)
+{
+	struct bench_decode_args	*args;
+	pid_t				 pid;
+	int				 i, status;
+
+	args = p;
+	for (i = 0; i < args->nfiles; i++)
+		if (bench_decode_match(ip, args->files[i]))
+			break;
+	if (i == args->nfiles)
+		return;
+
+	fflush(stdout);
+	switch (pid = fork()) {
+	case -1:
+		err(1, "fork");
+	case 0:
+		bench_decode_run(ip, args);
+		fflush(stdout);
+		_exit(0);
+	default:
+		while (waitpid(pid, &status, 0) == -1)
+			if (errno != EINTR)
+				err(1, "waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			printf("%-10s failed\n", ip->name);
+		break;
+	}
+}
+
+static int
+bench_decode_match(const struct ip *ip, const char *file)
+{
+	int	 i;
+	char	*ext;
+
+	if ((ext = strrchr(file, '.')) == NULL || *++ext == '\0')
+		return 0;
+
+	for (i = 0; ip->extensions[i] != NULL; i++)
+		if (!strcasecmp(ext, ip->extensions[i]))
+			return 1;
+	return 0;
+}
+
+static double
+bench_decode_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bench_decode_run(const struct ip *ip, struct bench_decode_args *args)
+{
+	struct bench_decode_result	res;
+	struct rusage			ru;
+	long				maxrss;
+	int				i;
+
+	memset(&res, 0, sizeof res);
+	for (i = 0; i < args->nfiles; i++)
+		if (bench_decode_match(ip, args->files[i]))
+			bench_decode_file(ip, args->files[i], args->nseeks,
+			    &res);
+
+	getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+	/* macOS reports bytes rather than kilobytes. */
+	maxrss = ru.ru_maxrss / 1024;
+#else
+	maxrss = ru.ru_maxrss;
+#endif
+
+	printf("%-10s %5d %12llu %9.1f %8.3f %8.3f %11.0f %8.1f %8.3f %8.3f "
+	    "%9ld\n",
+	    ip->name,
+	    res.nfiles,
+	    res.nframes,
+	    res.audio,
+	    res.wall,
+	    res.cpu,
+	    res.wall > 0.0 ? res.nframes / res.wall : 0.0,
+	    res.wall > 0.0 ? res.audio / res.wall : 0.0,
+	    res.nfiles > 0 ? res.metadata * 1000.0 / res.nfiles : 0.0,
+	    res.nseeks > 0 ? res.seek * 1000.0 / res.nseeks : 0.0,
+	    maxrss);
+}
+
+NORETURN static void
+bench_decode_usage(void)
+{
+	fprintf(stderr, "usage: bench-decode [-s nseeks] file ...\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench_decode_args	 args;
+	int				 c, i;
+	const char			*errstr;
+
+	args.nseeks = BENCH_DECODE_NSEEKS;
+	while ((c = getopt(argc, argv, "s:")) != -1)
+		switch (c) {
+		case 's':
+			args.nseeks = strtonum(optarg, 0, INT_MAX, &errstr);
+			if (errstr != NULL)
+				errx(1, "number of seeks is %s: %s", errstr,
+				    optarg);
+			break;
+		default:
+			bench_decode_usage();
+			break;
+		}
+
+	argc -= optind;
+	argv += optind;
+	if (argc == 0)
+		bench_decode_usage();
+
+	args.files = argv;
+	args.nfiles = argc;
+
+	i = 1;
+	if (*(char *)&i == 1)
+		bench_decode_byte_order = BYTE_ORDER_LITTLE;
+	else
+		bench_decode_byte_order = BYTE_ORDER_BIG;
+
+	log_init(0);
+	option_init();
+	sample_init();
+	plugin_init();
+
+	printf("%-10s %5s %12s %9s %8s %8s %11s %8s %8s %8s %9s\n",
+	    "plug-in", "files", "frames", "audio s", "wall s", "cpu s",
+	    "frames/s", "realtime", "meta ms", "seek ms", "maxrss KB");
+	plugin_foreach_ip(bench_decode_ip, &args);
+
+	plugin_end();
+	option_end();
+	log_end();
+	return 0;
+}
+
+/*
+ * The message functions normally print to the status line. There is no
+ * screen here, so print to stderr instead.
+ */
+
+void
+msg_clear(void)
+{
+}
+
+void
+msg_err(const char *fmt, ...)
+{
+	va_list	ap;
+	int	oerrno;
+
+	oerrno = errno;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, ": %s\n", strerror(oerrno));
+	errno = oerrno;
+}
+
+void
+msg_errx(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+void
+msg_info(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
@@ -29,6 +29,7 @@ struct browser_entry {
 	const struct ip	*ip;
 };
 
+static struct track	*browser_find_next_track(int);
 static void		 browser_free_entry(void *);
 static void		 browser_read_dir(void);
 static int		 browser_search_entry(const void *, const char *);
@@ -37,6 +38,7 @@ static void		 browser_select_entry(const char *);
 static pthread_mutex_t	 browser_menu_mtx = PTHREAD_MUTEX_INITIALIZER;
 static struct menu	*browser_menu;
 static char		*browser_dir;
+static struct option_entry *browser_repeat_all;
 
 void
 browser_activate_entry(void)
@@ -170,19 +172,12 @@ browser_free_entry(void *e)
 	free(be);
 }
 
-static void
-browser_get_entry_text(const void *e, char *buf, size_t bufsize)
-{
-	const struct browser_entry *be;
-
-	be = e;
-	strlcpy(buf, be->name, bufsize);
-	if (be->type == FILE_TYPE_DIRECTORY)
-		strlcat(buf, "/", bufsize);
-}
-
-struct track *
-browser_get_next_track(void)
+/*
+ * Return the track after the active entry. If activate is set, its entry is
+ * also made the active one.
+ */
+static struct track *
+browser_find_next_track(int activate)
 {
 	struct menu_entry	*me;
 	struct browser_entry	*be;
@@ -195,7 +190,8 @@ browser_get_next_track(void)
 	else
 		for (;;) {
 			if ((me = menu_get_next_entry(me)) == NULL) {
-				if (!option_get_boolean("repeat-all")) {
+				if (!option_handle_get_boolean(
+				    browser_repeat_all)) {
 					t = NULL;
 					break;
 				}
@@ -208,17 +204,35 @@ browser_get_next_track(void)
 				    be->name);
 				t = track_get(path, be->ip);
 				free(path);
-				if (t != NULL)
+				if (t != NULL && activate)
 					menu_activate_entry(browser_menu, me);
 				break;
 			}
 		}
 	XPTHREAD_MUTEX_UNLOCK(&browser_menu_mtx);
 
-	browser_print();
+	if (activate)
+		view_set_dirty(VIEW_ID_BROWSER);
 	return t;
 }
 
+static void
+browser_get_entry_text(const void *e, char *buf, size_t bufsize)
+{
+	const struct browser_entry *be;
+
+	be = e;
+	strlcpy(buf, be->name, bufsize);
+	if (be->type == FILE_TYPE_DIRECTORY)
+		strlcat(buf, "/", bufsize);
+}
+
+struct track *
+browser_get_next_track(void)
+{
+	return browser_find_next_track(1);
+}
+
 struct track *
 browser_get_prev_track(void)
 {
@@ -233,7 +247,8 @@ browser_get_prev_track(void)
 	else
 		for (;;) {
 			if ((me = menu_get_prev_entry(me)) == NULL) {
-				if (!option_get_boolean("repeat-all")) {
+				if (!option_handle_get_boolean(
+				    browser_repeat_all)) {
 					t = NULL;
 					break;
 				}
@@ -253,7 +268,7 @@ browser_get_prev_track(void)
 		}
 	XPTHREAD_MUTEX_UNLOCK(&browser_menu_mtx);
 
-	browser_print();
+	view_set_dirty(VIEW_ID_BROWSER);
 	return t;
 }
 
@@ -262,10 +277,18 @@ browser_init(void)
 {
 	browser_menu = menu_init(browser_free_entry, browser_get_entry_text,
 	    browser_search_entry);
+	browser_repeat_all = option_get_handle("repeat-all",
+	    OPTION_TYPE_BOOLEAN);
 	browser_dir = path_get_cwd();
 	browser_read_dir();
 }
 
+struct track *
+browser_peek_next_track(void)
+{
+	return browser_find_next_track(0);
+}
+
 void
 browser_print(void)
 {
@@ -283,17 +306,22 @@ browser_reactivate_entry(void)
 	struct track		*t;
 	char			*path;
 
+	t = NULL;
+
 	XPTHREAD_MUTEX_LOCK(&browser_menu_mtx);
 	if ((me = menu_get_active_entry(browser_menu)) != NULL) {
 		be = menu_get_entry_data(me);
 		xasprintf(&path, "%s/%s", browser_dir, be->name);
-		if ((t = track_get(path, be->ip)) != NULL) {
-			player_set_source(PLAYER_SOURCE_BROWSER);
-			player_play_track(t);
-		}
+		t = track_get(path, be->ip);
 		free(path);
 	}
 	XPTHREAD_MUTEX_UNLOCK(&browser_menu_mtx);
+
+	/* The player may need the menu to stop playback. */
+	if (t != NULL) {
+		player_set_source(PLAYER_SOURCE_BROWSER);
+		player_play_track(t);
+	}
 }
 
 /*
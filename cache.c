@@ -14,39 +14,343 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+/*
+ * Since version 4, the metadata cache is a binary file in the native byte
+ * order. It consists of a header, a table of fixed-width records (one for
+ * each track) and a pool of NUL-terminated strings. A record refers to a
+ * string by its offset in the pool. Offset 0 refers to the empty string at the
+ * start of the pool and denotes a missing field. Identical strings (such as
+ * artist and album names) are stored only once. Version 5 adds the inode
+ * number, modification time and size of the file to each record.
+ *
+ * The file is memory-mapped when it is read and the strings of the tracks
+ * point into the mapping, so that no memory needs to be allocated for them.
+ * The mapping is kept until cache_end() is called. Because of this, a new
+ * cache file is always written to a temporary file that is then renamed.
+ *
+ * Versions 0 to 3 are in a text format in which each field is terminated by
+ * a NUL character. They are still read, so that older caches are migrated
+ * automatically.
+ */
+
 #include "config.h"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <errno.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "siren.h"
 
-#define CACHE_BUFSIZE	4096
-#define CACHE_VERSION	2
-
+#define CACHE_BUFSIZE		4096
+#define CACHE_VERSION		5
+#define CACHE_TEXT_VERSION	3	/* Last version in text format */
+#define CACHE_V4_RECORDSIZE	offsetof(struct cache_record, pad)
+
+#define CACHE_MAGIC		"SIRENMDC"
+#define CACHE_MAGIC_LEN		8
+#define CACHE_BYTE_ORDER	0x01020304U
+#define CACHE_NRECORDS		1024
+#define CACHE_NSTRINGS		1024	/* Must be a power of 2 */
+
+struct cache_header {
+	char		 magic[CACHE_MAGIC_LEN];
+	uint32_t	 version;
+	uint32_t	 byte_order;
+	uint32_t	 nrecords;
+	uint32_t	 recordsize;
+	uint64_t	 poolsize;
+};
+
+/* Each string field is an offset in the string pool. */
+struct cache_record {
+	uint32_t	 path;
+	uint32_t	 album;
+	uint32_t	 albumartist;
+	uint32_t	 albumgain;
+	uint32_t	 albumpeak;
+	uint32_t	 artist;
+	uint32_t	 comment;
+	uint32_t	 date;
+	uint32_t	 discnumber;
+	uint32_t	 disctotal;
+	uint32_t	 genre;
+	uint32_t	 title;
+	uint32_t	 trackgain;
+	uint32_t	 tracknumber;
+	uint32_t	 trackpeak;
+	uint32_t	 tracktotal;
+	uint32_t	 duration;
+	uint32_t	 pad;
+	uint64_t	 file_ino;
+	int64_t		 file_mtime;
+	uint64_t	 file_size;
+};
+
+struct cache_string {
+	const char	*str;
+	uint32_t	 offset;
+};
+
+static uint32_t		 cache_hash_string(const char *);
+static uint32_t		 cache_intern_string(const char *);
+static int		 cache_map_file(const char *);
 static int		 cache_open_read(const char *);
-static int		 cache_open_write(const char *);
+static int		 cache_open_write(char *);
+static int		 cache_read_binary_entry(struct track *);
 static int		 cache_read_number(unsigned int *);
+static int		 cache_read_pool_string(uint32_t, char **);
 static int		 cache_read_string(char **);
-static void		 cache_write_number(unsigned int);
-static void		 cache_write_string(const char *);
+static int		 cache_read_text_entry(struct track *);
+static int		 cache_write_file(void);
 
-static unsigned int	 cache_version;
+static unsigned int	 cache_version = CACHE_VERSION;
+static enum cache_mode	 cache_mode;
 static FILE		*cache_fp;
+static char		*cache_path;
+static char		*cache_tmppath;
+static int		 cache_binary;
+static int		 cache_write_error;
+
+/* Buffer used to read the text format. */
 static size_t		 cache_bufidx;
 static size_t		 cache_buflen;
 static size_t		 cache_bufsize;
 static char		*cache_buf;
 
-void
+/* Record table being written. */
+static struct cache_record *cache_records;
+static size_t		 cache_nrecords;
+static size_t		 cache_recordssize;
+
+/* Mapped record table. Records are copied out since their size may vary. */
+static const char	*cache_table;
+static size_t		 cache_table_nrecords;
+static size_t		 cache_table_recordsize;
+static size_t		 cache_table_idx;
+
+/* String pool, either mapped or being written. */
+static char		*cache_pool;
+static size_t		 cache_poollen;
+static size_t		 cache_poolsize;
+
+/* Hash table of the strings in the pool being written. */
+static struct cache_string *cache_strings;
+static size_t		 cache_nstrings;
+static size_t		 cache_stringssize;
+
+static void		*cache_map = MAP_FAILED;
+static size_t		 cache_mapsize;
+
+int
 cache_close(void)
 {
-	fclose(cache_fp);
-	free(cache_buf);
+	int ret;
+
+	ret = 0;
+	if (cache_mode == CACHE_MODE_WRITE) {
+		ret = cache_write_file();
+		free(cache_records);
+		free(cache_pool);
+		free(cache_strings);
+		free(cache_path);
+		free(cache_tmppath);
+	} else if (!cache_binary) {
+		fclose(cache_fp);
+		free(cache_buf);
+	}
+	return ret;
+}
+
+/*
+ * Unmap the metadata cache. The strings of the tracks read from the cache are
+ * no longer valid after this.
+ */
+void
+cache_end(void)
+{
+	if (cache_map != MAP_FAILED) {
+		munmap(cache_map, cache_mapsize);
+		cache_map = MAP_FAILED;
+	}
+}
+
+/* FNV-1a */
+static uint32_t
+cache_hash_string(const char *s)
+{
+	uint32_t hash;
+
+	hash = 2166136261U;
+	for (; *s != '\0'; s++) {
+		hash ^= (unsigned char)*s;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * Return the offset of the specified string in the string pool, adding the
+ * string if it is not in the pool yet.
+ */
+static uint32_t
+cache_intern_string(const char *str)
+{
+	struct cache_string	*oldstrings;
+	size_t			 i, j, len, oldsize, mask;
+	uint32_t		 offset;
+
+	if (str == NULL || str[0] == '\0')
+		return 0;
+
+	/* Keep the load factor of the hash table at most 1/2. */
+	if (cache_nstrings >= cache_stringssize / 2) {
+		oldstrings = cache_strings;
+		oldsize = cache_stringssize;
+		cache_stringssize = oldsize == 0 ? CACHE_NSTRINGS : oldsize * 2;
+		cache_strings = xreallocarray(NULL, cache_stringssize,
+		    sizeof *cache_strings);
+		memset(cache_strings, 0, cache_stringssize *
+		    sizeof *cache_strings);
+		mask = cache_stringssize - 1;
+		for (i = 0; i < oldsize; i++) {
+			if (oldstrings[i].str == NULL)
+				continue;
+			j = cache_hash_string(oldstrings[i].str) & mask;
+			while (cache_strings[j].str != NULL)
+				j = (j + 1) & mask;
+			cache_strings[j] = oldstrings[i];
+		}
+		free(oldstrings);
+	}
+
+	mask = cache_stringssize - 1;
+	i = cache_hash_string(str) & mask;
+	while (cache_strings[i].str != NULL) {
+		if (!strcmp(cache_strings[i].str, str))
+			return cache_strings[i].offset;
+		i = (i + 1) & mask;
+	}
+
+	len = strlen(str) + 1;
+	if (len > UINT32_MAX - cache_poollen) {
+		LOG_ERRX("string pool too large");
+		cache_write_error = 1;
+		return 0;
+	}
+
+	if (cache_poollen + len > cache_poolsize) {
+		while (cache_poollen + len > cache_poolsize)
+			cache_poolsize *= 2;
+		cache_pool = xrealloc(cache_pool, cache_poolsize);
+	}
+
+	offset = cache_poollen;
+	memcpy(cache_pool + offset, str, len);
+	cache_poollen += len;
+
+	cache_strings[i].str = str;
+	cache_strings[i].offset = offset;
+	cache_nstrings++;
+	return offset;
+}
+
+/*
+ * Return whether the specified pointer points into the mapped metadata cache.
+ * Such memory must not be freed.
+ */
+int
+cache_is_mapped(const void *p)
+{
+	const char *cp;
+
+	if (cache_map == MAP_FAILED || p == NULL)
+		return 0;
+
+	cp = p;
+	return cp >= (const char *)cache_map &&
+	    cp < (const char *)cache_map + cache_mapsize;
+}
+
+static int
+cache_map_file(const char *path)
+{
+	struct stat		 st;
+	struct cache_header	*hdr;
+	uint64_t		 recordsize, size;
+
+	if (fstat(fileno(cache_fp), &st) == -1) {
+		LOG_ERR("fstat: %s", path);
+		return -1;
+	}
+
+	if ((uintmax_t)st.st_size < sizeof *hdr ||
+	    (uintmax_t)st.st_size > SIZE_MAX) {
+		LOG_ERRX("%s: invalid file size", path);
+		return -1;
+	}
+
+	cache_mapsize = st.st_size;
+	cache_map = mmap(NULL, cache_mapsize, PROT_READ, MAP_PRIVATE,
+	    fileno(cache_fp), 0);
+	if (cache_map == MAP_FAILED) {
+		LOG_ERR("mmap: %s", path);
+		return -1;
+	}
+
+	hdr = cache_map;
+	LOG_INFO("reading version %u", hdr->version);
+
+	if (hdr->version < 4 || hdr->version > CACHE_VERSION) {
+		LOG_ERRX("unsupported metadata cache version");
+		goto error;
+	}
+
+	if (hdr->byte_order != CACHE_BYTE_ORDER) {
+		LOG_ERRX("metadata cache has different byte order");
+		goto error;
+	}
+
+	recordsize = hdr->version == 4 ? CACHE_V4_RECORDSIZE :
+	    sizeof *cache_records;
+	if (hdr->recordsize != recordsize) {
+		LOG_ERRX("metadata cache has invalid record size");
+		goto error;
+	}
+
+	size = sizeof *hdr + (uint64_t)hdr->nrecords * hdr->recordsize;
+	if (hdr->poolsize == 0 || size + hdr->poolsize != cache_mapsize) {
+		LOG_ERRX("metadata cache has invalid size");
+		goto error;
+	}
+
+	cache_table = (const char *)(hdr + 1);
+	cache_table_nrecords = hdr->nrecords;
+	cache_table_recordsize = recordsize;
+	cache_table_idx = 0;
+	cache_pool = (char *)cache_map + size;
+	cache_poolsize = hdr->poolsize;
+
+	/* Ensure that every offset in the pool yields a terminated string. */
+	if (cache_pool[0] != '\0' || cache_pool[cache_poolsize - 1] != '\0') {
+		LOG_ERRX("metadata cache has invalid string pool");
+		goto error;
+	}
+
+	cache_version = hdr->version;
+	return 0;
+
+error:
+	munmap(cache_map, cache_mapsize);
+	cache_map = MAP_FAILED;
+	return -1;
 }
 
 int
@@ -56,19 +360,22 @@ cache_open(enum cache_mode mode)
 	char	*path;
 
 	path = conf_get_path(CACHE_FILE);
+	cache_mode = mode;
 
-	if (mode == CACHE_MODE_READ)
+	if (mode == CACHE_MODE_READ) {
 		ret = cache_open_read(path);
-	else
+		free(path);
+	} else
 		ret = cache_open_write(path);
 
-	free(path);
 	return ret;
 }
 
 static int
 cache_open_read(const char *path)
 {
+	char magic[CACHE_MAGIC_LEN];
+
 	cache_fp = fopen(path, "r");
 	if (cache_fp == NULL) {
 		if (errno != ENOENT) {
@@ -78,6 +385,22 @@ cache_open_read(const char *path)
 		return -1;
 	}
 
+	if (fread(magic, 1, sizeof magic, cache_fp) == sizeof magic &&
+	    !memcmp(magic, CACHE_MAGIC, sizeof magic)) {
+		cache_binary = 1;
+		if (cache_map_file(path) == -1) {
+			msg_errx("Cannot read metadata cache file");
+			fclose(cache_fp);
+			return -1;
+		}
+		/* The mapping remains valid after the file has been closed. */
+		fclose(cache_fp);
+		return 0;
+	}
+
+	cache_binary = 0;
+	rewind(cache_fp);
+
 	cache_bufidx = 0;
 	cache_buflen = 0;
 	cache_bufsize = CACHE_BUFSIZE;
@@ -90,7 +413,7 @@ cache_open_read(const char *path)
 
 	LOG_INFO("reading version %u", cache_version);
 
-	if (cache_version > CACHE_VERSION) {
+	if (cache_version > CACHE_TEXT_VERSION) {
 		LOG_ERRX("unsupported metadata cache version");
 		msg_errx("Unsupported metadata cache version");
 		goto error;
@@ -104,61 +427,108 @@ error:
 	return -1;
 }
 
+/*
+ * The path argument is freed when the cache is closed.
+ */
 static int
-cache_open_write(const char *path)
+cache_open_write(char *path)
 {
-	cache_fp = fopen(path, "w");
+	LOG_INFO("writing version %u", CACHE_VERSION);
+
+	cache_path = path;
+	xasprintf(&cache_tmppath, "%s.tmp", path);
+
+	cache_fp = fopen(cache_tmppath, "w");
 	if (cache_fp == NULL) {
-		LOG_ERR("fopen: %s", path);
+		LOG_ERR("fopen: %s", cache_tmppath);
 		msg_err("Cannot open metadata cache file");
+		free(cache_path);
+		free(cache_tmppath);
 		return -1;
 	}
 
-	LOG_INFO("writing version %u", CACHE_VERSION);
+	cache_records = NULL;
+	cache_nrecords = 0;
+	cache_recordssize = 0;
+
+	/* Offset 0 is reserved for missing fields. */
+	cache_poolsize = CACHE_BUFSIZE;
+	cache_pool = xmalloc(cache_poolsize);
+	cache_pool[0] = '\0';
+	cache_poollen = 1;
 
-	cache_buf = NULL;
-	cache_write_number(CACHE_VERSION);
+	cache_strings = NULL;
+	cache_nstrings = 0;
+	cache_stringssize = 0;
+
+	cache_write_error = 0;
 	return 0;
 }
 
+static int
+cache_read_binary_entry(struct track *t)
+{
+	struct cache_record	 rec, *r;
+	int			 ret;
+
+	/*
+	 * Fields missing from older versions are zero. At the end of the
+	 * record table, still initialise the track, so that the caller can
+	 * free it.
+	 */
+	memset(&rec, 0, sizeof rec);
+	if (cache_table_idx == cache_table_nrecords)
+		ret = -1;
+	else {
+		memcpy(&rec, cache_table + cache_table_idx *
+		    cache_table_recordsize, cache_table_recordsize);
+		cache_table_idx++;
+		ret = 0;
+	}
+	r = &rec;
+
+	ret |= cache_read_pool_string(r->path, &t->path);
+	ret |= cache_read_pool_string(r->album, &t->album);
+	ret |= cache_read_pool_string(r->albumartist, &t->albumartist);
+	ret |= cache_read_pool_string(r->albumgain, &t->albumgain);
+	ret |= cache_read_pool_string(r->albumpeak, &t->albumpeak);
+	ret |= cache_read_pool_string(r->artist, &t->artist);
+	ret |= cache_read_pool_string(r->comment, &t->comment);
+	ret |= cache_read_pool_string(r->date, &t->date);
+	ret |= cache_read_pool_string(r->discnumber, &t->discnumber);
+	ret |= cache_read_pool_string(r->disctotal, &t->disctotal);
+	ret |= cache_read_pool_string(r->genre, &t->genre);
+	ret |= cache_read_pool_string(r->title, &t->title);
+	ret |= cache_read_pool_string(r->trackgain, &t->trackgain);
+	ret |= cache_read_pool_string(r->tracknumber, &t->tracknumber);
+	ret |= cache_read_pool_string(r->trackpeak, &t->trackpeak);
+	ret |= cache_read_pool_string(r->tracktotal, &t->tracktotal);
+	t->duration = r->duration;
+	t->file_ino = r->file_ino;
+	t->file_mtime = r->file_mtime;
+	t->file_size = r->file_size;
+
+	if (ret == 0 && t->path == NULL) {
+		LOG_ERRX("record without path");
+		ret = -1;
+	}
+
+	return ret;
+}
+
 int
 cache_read_entry(struct track *t)
 {
-	int ret;
-
 	t->ip = NULL;
 	t->ipdata = NULL;
+	t->file_ino = 0;
+	t->file_mtime = 0;
+	t->file_size = 0;
 
-	ret = 0;
-	ret |= cache_read_string(&t->path);
-	if (cache_version < 2)
-		t->albumartist = NULL;
-	else
-		ret |= cache_read_string(&t->albumartist);
-	ret |= cache_read_string(&t->artist);
-	ret |= cache_read_string(&t->album);
-	ret |= cache_read_string(&t->date);
-	if (cache_version == 0)
-		t->discnumber = NULL;
-	else
-		ret |= cache_read_string(&t->discnumber);
-	if (cache_version < 2)
-		t->disctotal = NULL;
+	if (cache_binary)
+		return cache_read_binary_entry(t);
 	else
-		ret |= cache_read_string(&t->disctotal);
-	ret |= cache_read_string(&t->tracknumber);
-	if (cache_version < 2)
-		t->tracktotal = NULL;
-	else
-		ret |= cache_read_string(&t->tracktotal);
-	ret |= cache_read_string(&t->title);
-	ret |= cache_read_number(&t->duration);
-	ret |= cache_read_string(&t->genre);
-	if (cache_version < 2)
-		t->comment = NULL;
-	else
-		ret |= cache_read_string(&t->comment);
-	return ret;
+		return cache_read_text_entry(t);
 }
 
 static int
@@ -237,6 +607,19 @@ cache_read_number(unsigned int *num)
 	return 0;
 }
 
+static int
+cache_read_pool_string(uint32_t offset, char **str)
+{
+	if (offset >= cache_poolsize) {
+		LOG_ERRX("%u: invalid string offset", offset);
+		*str = NULL;
+		return -1;
+	}
+
+	*str = (offset == 0) ? NULL : cache_pool + offset;
+	return 0;
+}
+
 static int
 cache_read_string(char **str)
 {
@@ -251,41 +634,148 @@ cache_read_string(char **str)
 	return 0;
 }
 
+static int
+cache_read_text_entry(struct track *t)
+{
+	int ret;
+
+	ret = 0;
+	ret |= cache_read_string(&t->path);
+	if (cache_version < 2)
+		t->albumartist = NULL;
+	else
+		ret |= cache_read_string(&t->albumartist);
+	ret |= cache_read_string(&t->artist);
+	ret |= cache_read_string(&t->album);
+	ret |= cache_read_string(&t->date);
+	if (cache_version == 0)
+		t->discnumber = NULL;
+	else
+		ret |= cache_read_string(&t->discnumber);
+	if (cache_version < 2)
+		t->disctotal = NULL;
+	else
+		ret |= cache_read_string(&t->disctotal);
+	ret |= cache_read_string(&t->tracknumber);
+	if (cache_version < 2)
+		t->tracktotal = NULL;
+	else
+		ret |= cache_read_string(&t->tracktotal);
+	ret |= cache_read_string(&t->title);
+	ret |= cache_read_number(&t->duration);
+	ret |= cache_read_string(&t->genre);
+	if (cache_version < 2)
+		t->comment = NULL;
+	else
+		ret |= cache_read_string(&t->comment);
+	if (cache_version < 3) {
+		t->albumgain = NULL;
+		t->albumpeak = NULL;
+		t->trackgain = NULL;
+		t->trackpeak = NULL;
+	} else {
+		ret |= cache_read_string(&t->albumgain);
+		ret |= cache_read_string(&t->albumpeak);
+		ret |= cache_read_string(&t->trackgain);
+		ret |= cache_read_string(&t->trackpeak);
+	}
+	return ret;
+}
+
 void
 cache_update(void)
 {
-	if (cache_fp != NULL && cache_version < CACHE_VERSION)
-		track_update_metadata(1);
+	if (cache_version < CACHE_TEXT_VERSION)
+		track_update_metadata(1, 1);
+	else if (cache_version < CACHE_VERSION)
+		/*
+		 * No new metadata; only the format has changed. File status
+		 * missing from older versions is filled in by the next update.
+		 */
+		track_write_cache();
 }
 
 void
 cache_write_entry(const struct track *t)
 {
-	cache_write_string(t->path);
-	cache_write_string(t->albumartist);
-	cache_write_string(t->artist);
-	cache_write_string(t->album);
-	cache_write_string(t->date);
-	cache_write_string(t->discnumber);
-	cache_write_string(t->disctotal);
-	cache_write_string(t->tracknumber);
-	cache_write_string(t->tracktotal);
-	cache_write_string(t->title);
-	cache_write_number(t->duration);
-	cache_write_string(t->genre);
-	cache_write_string(t->comment);
-}
+	struct cache_record *r;
 
-static void
-cache_write_number(unsigned int num)
-{
-	fprintf(cache_fp, "%u%c", num, '\0');
+	if (cache_nrecords == UINT32_MAX) {
+		LOG_ERRX("too many records");
+		cache_write_error = 1;
+		return;
+	}
+
+	if (cache_nrecords == cache_recordssize) {
+		cache_recordssize = cache_recordssize == 0 ? CACHE_NRECORDS :
+		    cache_recordssize * 2;
+		cache_records = xreallocarray(cache_records,
+		    cache_recordssize, sizeof *cache_records);
+	}
+
+	r = &cache_records[cache_nrecords++];
+	r->path = cache_intern_string(t->path);
+	r->album = cache_intern_string(t->album);
+	r->albumartist = cache_intern_string(t->albumartist);
+	r->albumgain = cache_intern_string(t->albumgain);
+	r->albumpeak = cache_intern_string(t->albumpeak);
+	r->artist = cache_intern_string(t->artist);
+	r->comment = cache_intern_string(t->comment);
+	r->date = cache_intern_string(t->date);
+	r->discnumber = cache_intern_string(t->discnumber);
+	r->disctotal = cache_intern_string(t->disctotal);
+	r->genre = cache_intern_string(t->genre);
+	r->title = cache_intern_string(t->title);
+	r->trackgain = cache_intern_string(t->trackgain);
+	r->tracknumber = cache_intern_string(t->tracknumber);
+	r->trackpeak = cache_intern_string(t->trackpeak);
+	r->tracktotal = cache_intern_string(t->tracktotal);
+	r->duration = t->duration;
+	r->pad = 0;
+	r->file_ino = t->file_ino;
+	r->file_mtime = t->file_mtime;
+	r->file_size = t->file_size;
 }
 
-static void
-cache_write_string(const char *str)
+/*
+ * Write the header, the record table and the string pool to the temporary
+ * file and then rename it to the cache file.
+ */
+static int
+cache_write_file(void)
 {
-	if (str != NULL)
-		fputs(str, cache_fp);
-	putc('\0', cache_fp);
+	struct cache_header hdr;
+
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof hdr.magic);
+	hdr.version = CACHE_VERSION;
+	hdr.byte_order = CACHE_BYTE_ORDER;
+	hdr.nrecords = cache_nrecords;
+	hdr.recordsize = sizeof *cache_records;
+	hdr.poolsize = cache_poollen;
+
+	if (!cache_write_error && (fwrite(&hdr, sizeof hdr, 1, cache_fp) != 1 ||
+	    fwrite(cache_records, sizeof *cache_records, cache_nrecords,
+	    cache_fp) != cache_nrecords ||
+	    fwrite(cache_pool, 1, cache_poollen, cache_fp) != cache_poollen)) {
+		LOG_ERR("fwrite: %s", cache_tmppath);
+		cache_write_error = 1;
+	}
+
+	if (fclose(cache_fp) == EOF) {
+		LOG_ERR("fclose: %s", cache_tmppath);
+		cache_write_error = 1;
+	}
+
+	if (!cache_write_error && rename(cache_tmppath, cache_path) == -1) {
+		LOG_ERR("rename: %s", cache_tmppath);
+		cache_write_error = 1;
+	}
+
+	if (cache_write_error) {
+		unlink(cache_tmppath);
+		return -1;
+	}
+
+	return 0;
 }
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2016 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Check that every version of the sample kernels the CPU supports produces
+ * exactly the same output as the scalar version. Exit with status 1 if any
+ * of them differs.
+ *
+ * Like bench-decode, this program is linked with the objects of siren itself,
+ * except for the ones containing main() and the message functions.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "siren.h"
+
+int
+main(void)
+{
+	int ret;
+
+	log_init(0);
+	ret = sample_check();
+	log_end();
+	return ret == -1;
+}
+
+/*
+ * The message functions normally print to the status line. There is no
+ * screen here, so print to stderr instead.
+ */
+
+void
+msg_clear(void)
+{
+}
+
+void
+msg_err(const char *fmt, ...)
+{
+	va_list	ap;
+	int	oerrno;
+
+	oerrno = errno;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, ": %s\n", strerror(oerrno));
+	errno = oerrno;
+}
+
+void
+msg_errx(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+void
+msg_info(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
@@ -80,10 +80,17 @@ struct command_unbind_key_data {
 	int		  key;
 };
 
+struct command_update_metadata_data {
+	int		 delete;
+	int		 force;
+};
+
 #define COMMAND_EXEC_PROTOTYPE(cmd) \
     static void command_ ## cmd ## _exec(void *)
 #define COMMAND_FREE_PROTOTYPE(cmd) \
     static void command_ ## cmd ## _free(void *)
+#define COMMAND_JOB_PROTOTYPE(cmd) \
+    static void command_ ## cmd ## _job(void *)
 #define COMMAND_PARSE_PROTOTYPE(cmd) \
     static int command_ ## cmd ## _parse(int, char **, void **, char **)
 
@@ -92,10 +99,13 @@ COMMAND_EXEC_PROTOTYPE(add_entry);
 COMMAND_PARSE_PROTOTYPE(add_entry);
 COMMAND_EXEC_PROTOTYPE(add_path);
 COMMAND_FREE_PROTOTYPE(add_path);
+COMMAND_JOB_PROTOTYPE(add_path);
 COMMAND_PARSE_PROTOTYPE(add_path);
 COMMAND_EXEC_PROTOTYPE(bind_key);
 COMMAND_FREE_PROTOTYPE(bind_key);
 COMMAND_PARSE_PROTOTYPE(bind_key);
+COMMAND_EXEC_PROTOTYPE(cancel_job);
+COMMAND_PARSE_PROTOTYPE(cancel_job);
 COMMAND_EXEC_PROTOTYPE(cd);
 COMMAND_PARSE_PROTOTYPE(cd);
 COMMAND_EXEC_PROTOTYPE(close_output_plugin);
@@ -103,7 +113,9 @@ COMMAND_EXEC_PROTOTYPE(command_prompt);
 COMMAND_EXEC_PROTOTYPE(delete_entry);
 COMMAND_PARSE_PROTOTYPE(delete_entry);
 COMMAND_PARSE_PROTOTYPE(generic);
+COMMAND_EXEC_PROTOTYPE(jobs);
 COMMAND_EXEC_PROTOTYPE(load_playlist);
+COMMAND_JOB_PROTOTYPE(load_playlist);
 COMMAND_PARSE_PROTOTYPE(load_playlist);
 COMMAND_EXEC_PROTOTYPE(move_entry_down);
 COMMAND_EXEC_PROTOTYPE(move_entry_up);
@@ -152,6 +164,7 @@ COMMAND_EXEC_PROTOTYPE(stop);
 COMMAND_EXEC_PROTOTYPE(unbind_key);
 COMMAND_PARSE_PROTOTYPE(unbind_key);
 COMMAND_EXEC_PROTOTYPE(update_metadata);
+COMMAND_JOB_PROTOTYPE(update_metadata);
 COMMAND_PARSE_PROTOTYPE(update_metadata);
 
 static struct command command_list[] = {
@@ -179,6 +192,12 @@ static struct command command_list[] = {
 		command_bind_key_exec,
 		command_bind_key_free
 	},
+	{
+		"cancel-job",
+		command_cancel_job_parse,
+		command_cancel_job_exec,
+		free
+	},
 	{
 		"cd",
 		command_cd_parse,
@@ -203,6 +222,12 @@ static struct command command_list[] = {
 		command_delete_entry_exec,
 		free
 	},
+	{
+		"jobs",
+		command_generic_parse,
+		command_jobs_exec,
+		NULL
+	},
 	{
 		"load-playlist",
 		command_load_playlist_parse,
@@ -466,20 +491,56 @@ usage:
 	return -1;
 }
 
+/*
+ * Adding paths can take a while, so run it as a job. The command data may be
+ * used again, as in the case of a key binding, so give the job a copy.
+ */
 static void
 command_add_path_exec(void *datap)
+{
+	struct command_add_path_data	*data, *jdata;
+	int				 i;
+
+	data = datap;
+
+	jdata = xmalloc(sizeof *jdata);
+	jdata->use_current_view = 0;
+	jdata->view = data->use_current_view ? view_get_id() : data->view;
+
+	for (i = 0; data->paths[i] != NULL; i++)
+		continue;
+	jdata->paths = xreallocarray(NULL, i + 1, sizeof *jdata->paths);
+	for (i = 0; data->paths[i] != NULL; i++)
+		jdata->paths[i] = xstrdup(data->paths[i]);
+	jdata->paths[i] = NULL;
+
+	job_add("add-path", command_add_path_job, command_add_path_free,
+	    jdata);
+}
+
+static void
+command_add_path_free(void *datap)
 {
 	struct command_add_path_data	*data;
-	struct track			*t;
-	struct stat			 sb;
 	int				 i;
 
 	data = datap;
+	for (i = 0; data->paths[i] != NULL; i++)
+		free(data->paths[i]);
+	free(data->paths);
+	free(data);
+}
 
-	if (data->use_current_view)
-		data->view = view_get_id();
+static void
+command_add_path_job(void *datap)
+{
+	struct command_add_path_data	*data;
+	struct track			*t;
+	struct stat			 sb;
+	int				 i;
 
-	for (i = 0; data->paths[i] != NULL; i++) {
+	data = datap;
+	for (i = 0; data->paths[i] != NULL && !job_is_cancelled(); i++) {
 		if (stat(data->paths[i], &sb) == -1) {
 			LOG_ERR("stat: %s", data->paths[i]);
 			msg_err("%s", data->paths[i]);
@@ -501,19 +562,6 @@ command_add_path_exec(void *datap)
 	}
 }
 
-static void
-command_add_path_free(void *datap)
-{
-	struct command_add_path_data	*data;
-	int				 i;
-
-	data = datap;
-	for (i = 0; data->paths[i] != NULL; i++)
-		free(data->paths[i]);
-	free(data->paths);
-	free(data);
-}
-
 static int
 command_add_path_parse(int argc, char **argv, void **datap, char **error)
 {
@@ -617,6 +665,42 @@ command_bind_key_parse(int argc, char **argv, void **datap, char **error)
 	return 0;
 }
 
+static void
+command_cancel_job_exec(void *datap)
+{
+	unsigned int *id;
+
+	id = datap;
+	job_cancel(*id);
+}
+
+static int
+command_cancel_job_parse(int argc, char **argv, void **datap, char **error)
+{
+	unsigned int	*id;
+	const char	*errstr;
+
+	if (argc > 2) {
+		*error = xstrdup("Usage: cancel-job [id]");
+		return -1;
+	}
+
+	id = xmalloc(sizeof *id);
+	if (argc == 1)
+		*id = 0;
+	else {
+		*id = strtonum(argv[1], 1, UINT_MAX, &errstr);
+		if (errstr != NULL) {
+			xasprintf(error, "Job ID is %s: %s", errstr, argv[1]);
+			free(id);
+			return -1;
+		}
+	}
+
+	*datap = id;
+	return 0;
+}
+
 static void
 command_cd_exec(void *datap)
 {
@@ -751,8 +835,21 @@ command_generic_parse(int argc, char **argv, void **datap, char **error)
 	return 0;
 }
 
+static void
+command_jobs_exec(UNUSED void *datap)
+{
+	job_print();
+}
+
 static void
 command_load_playlist_exec(void *datap)
+{
+	job_add("load-playlist", command_load_playlist_job, free,
+	    xstrdup(datap));
+}
+
+static void
+command_load_playlist_job(void *datap)
 {
 	char *file;
 
@@ -1603,29 +1700,44 @@ command_unbind_key_parse(int argc, char **argv, void **datap, char **error)
 static void
 command_update_metadata_exec(void *datap)
 {
-	int delete;
+	struct command_update_metadata_data *data;
 
-	delete = *(int *)datap;
-	track_update_metadata(delete);
+	data = xmalloc(sizeof *data);
+	*data = *(struct command_update_metadata_data *)datap;
+	job_add("update-metadata", command_update_metadata_job, free, data);
+}
+
+static void
+command_update_metadata_job(void *datap)
+{
+	struct command_update_metadata_data *data;
+
+	data = datap;
+	track_update_metadata(data->delete, data->force);
 	library_update();
 	playlist_update();
 	queue_update();
-	screen_print();
+	player_update_track();
 }
 
 static int
 command_update_metadata_parse(int argc, char **argv, void **datap,
     char **error)
 {
-	int c, *delete;
+	struct command_update_metadata_data	*data;
+	int					 c;
 
-	delete = xmalloc(sizeof *delete);
-	*delete = 0;
+	data = xmalloc(sizeof *data);
+	data->delete = 0;
+	data->force = 0;
 
-	while ((c = getopt(argc, argv, "d")) != -1)
+	while ((c = getopt(argc, argv, "df")) != -1)
 		switch (c) {
 		case 'd':
-			*delete = 1;
+			data->delete = 1;
+			break;
+		case 'f':
+			data->force = 1;
 			break;
 		default:
 			goto usage;
@@ -1634,11 +1746,11 @@ command_update_metadata_parse(int argc, char **argv, void **datap,
 	if (argc != optind)
 		goto usage;
 
-	*datap = delete;
+	*datap = data;
 	return 0;
 
 usage:
-	*error = xstrdup("Usage: update-metadata [-d]");
-	free(delete);
+	*error = xstrdup("Usage: update-metadata [-df]");
+	free(data);
 	return -1;
 }
@@ -0,0 +1,14 @@
+#define VERSION "0.9"
+#define PLUGIN_DIR "/usr/local/lib/siren"
+#define _GNU_SOURCE
+#define HAVE_ASPRINTF
+#define HAVE_ERR
+#define HAVE_REALLOCARRAY
+#define HAVE_RESIZETERM
+#define HAVE_STRCASESTR
+#define HAVE_STRSEP
+#define HAVE___BUILTIN_BSWAP16
+#define HAVE_X86_SIMD
+#define HAVE_USE_DEFAULT_COLORS
+#define HAVE_GNU_STRERROR_R
+#define HAVE_SYS_SOUNDCARD_H
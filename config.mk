@@ -0,0 +1,21 @@
+CFLAGS=
+CPPFLAGS=
+LDFLAGS=
+LDFLAGS_PROG=-Wl,--export-dynamic -pthread -lcurses -lm
+CFLAGS_LIB=-fPIC
+LDFLAGS_LIB=-fPIC -shared
+BINDIR=/usr/local/bin
+MANDIR=/usr/local/man
+PLUGINDIR=/usr/local/lib/siren
+SRCS+=compat/pledge.c
+SRCS+=compat/strlcat.c
+SRCS+=compat/strlcpy.c
+SRCS+=compat/strtonum.c
+CFLAGS+=-ffp-contract=off
+SRCS+=compat/strerror_r.c
+SRCS+=compat/getopt.c
+IP+=synth
+LDFLAGS_synth=-lm
+OP+=file
+OP+=null
+OP+=oss
@@ -22,6 +22,8 @@
 #include <dirent.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,6 +38,73 @@ struct dir {
 	struct dirent		*dp;
 };
 
+/*
+ * dir_walk() reads directories with a pool of walkers. Each walker has its own
+ * queue of directories. A walker takes the directory it added last from its
+ * own queue, so that it mostly descends depth first. If its queue is empty, it
+ * steals the directory that was added first to the queue of another walker.
+ * Such a directory is near the top of the tree and so is likely to lead to
+ * much more work.
+ */
+
+struct dir_walk_dir {
+	char			*path;
+	unsigned int		 depth;
+};
+
+struct dir_walk_queue {
+	pthread_mutex_t		 mtx;
+	struct dir_walk_dir	*dirs;
+	size_t			 head;
+	size_t			 tail;
+	size_t			 size;
+};
+
+struct dir_walk_inode {
+	uint64_t		 dev;
+	uint64_t		 ino;
+	RB_ENTRY(dir_walk_inode) entries;
+};
+
+RB_HEAD(dir_walk_inode_tree, dir_walk_inode);
+
+struct dir_walk {
+	struct dir_walk_queue	*queues;
+	unsigned int		 nqueues;
+	unsigned int		 maxdepth;
+	void			 (*func)(const char *, void *);
+	void			*arg;
+	atomic_size_t		 npending;	/* Directories not yet read */
+	atomic_int		 stop;
+
+	/* The mutex protects the members below and calls to func(). */
+	pthread_mutex_t		 mtx;
+	pthread_cond_t		 cond;
+	size_t			 gen;		/* Incremented on each push */
+	struct dir_walk_inode_tree inodes;	/* Directories visited */
+};
+
+struct dir_walker {
+	struct dir_walk		*walk;
+	unsigned int		 id;
+};
+
+static int		 dir_walk_cmp_inode(struct dir_walk_inode *,
+			    struct dir_walk_inode *);
+static void		*dir_walk_handler(void *);
+static int		 dir_walk_pop(struct dir_walk_queue *,
+			    struct dir_walk_dir *);
+static void		 dir_walk_push(struct dir_walk *, unsigned int, char *,
+			    unsigned int);
+static void		 dir_walk_read_dir(struct dir_walk *, unsigned int,
+			    struct dir_walk_dir *);
+static int		 dir_walk_steal(struct dir_walk *, unsigned int,
+			    struct dir_walk_dir *);
+static int		 dir_walk_visit(struct dir_walk *, uint64_t, uint64_t);
+
+RB_GENERATE_STATIC(dir_walk_inode_tree, dir_walk_inode, entries,
+    dir_walk_cmp_inode)
+
 void
 dir_close(struct dir *d)
 {
@@ -68,7 +137,11 @@ dir_get_entry(struct dir *d)
 	if (stat(d->entry.path, &sb) == -1) {
 		LOG_ERR("stat: %s", d->entry.path);
 		d->entry.type = FILE_TYPE_OTHER;
+		d->entry.dev = 0;
+		d->entry.ino = 0;
 	} else {
+		d->entry.dev = sb.st_dev;
+		d->entry.ino = sb.st_ino;
 		switch (sb.st_mode & S_IFMT) {
 		case S_IFDIR:
 			d->entry.type = FILE_TYPE_DIRECTORY;
@@ -159,3 +232,307 @@ error:
 	return NULL;
 #endif
 }
+
+/*
+ * Walk the specified directory and its subdirectories with the specified
+ * number of threads and call func() for each regular file found. func() is
+ * called from several threads, but never concurrently. The calling thread is
+ * one of the walkers.
+ *
+ * Directories deeper than maxdepth levels are skipped; the specified
+ * directory itself is at level 1. If maxdepth is 0, there is no limit. Each
+ * directory is read only once, even if it can be reached by more than one
+ * path, so that symbolic links cannot cause a loop.
+ *
+ * The walk stops early if the running job is cancelled, in which case -1 is
+ * returned.
+ */
+int
+dir_walk(const char *dir, unsigned int maxdepth, unsigned int nthreads,
+    void (*func)(const char *, void *), void *arg)
+{
+	struct dir_walk		 walk;
+	struct dir_walk_dir	 wd;
+	struct dir_walk_inode	*in;
+	struct dir_walker	*walkers;
+	struct stat		 sb;
+	pthread_t		*thd;
+	unsigned int		 i;
+
+	if (stat(dir, &sb) == -1) {
+		LOG_ERR("stat: %s", dir);
+		msg_err("%s", dir);
+		return -1;
+	}
+
+	if (nthreads == 0)
+		nthreads = 1;
+
+	walk.queues = xreallocarray(NULL, nthreads, sizeof *walk.queues);
+	walk.nqueues = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		XPTHREAD_MUTEX_INIT(&walk.queues[i].mtx, NULL);
+		walk.queues[i].dirs = NULL;
+		walk.queues[i].head = 0;
+		walk.queues[i].tail = 0;
+		walk.queues[i].size = 0;
+	}
+
+	walk.maxdepth = maxdepth;
+	walk.func = func;
+	walk.arg = arg;
+	atomic_store(&walk.npending, 1);
+	atomic_store(&walk.stop, 0);
+	XPTHREAD_MUTEX_INIT(&walk.mtx, NULL);
+	XPTHREAD_COND_INIT(&walk.cond, NULL);
+	walk.gen = 0;
+	RB_INIT(&walk.inodes);
+
+	dir_walk_visit(&walk, sb.st_dev, sb.st_ino);
+	dir_walk_push(&walk, 0, xstrdup(dir), 1);
+
+	walkers = xreallocarray(NULL, nthreads, sizeof *walkers);
+	thd = xreallocarray(NULL, nthreads, sizeof *thd);
+	for (i = 0; i < nthreads; i++) {
+		walkers[i].walk = &walk;
+		walkers[i].id = i;
+		if (i > 0)
+			XPTHREAD_CREATE(&thd[i], NULL, dir_walk_handler,
+			    &walkers[i]);
+	}
+
+	dir_walk_handler(&walkers[0]);
+
+	for (i = 1; i < nthreads; i++)
+		XPTHREAD_JOIN(thd[i], NULL);
+	free(thd);
+	free(walkers);
+
+	/* Free the directories left behind if the walk was stopped. */
+	for (i = 0; i < nthreads; i++) {
+		while (dir_walk_pop(&walk.queues[i], &wd) == 0)
+			free(wd.path);
+		free(walk.queues[i].dirs);
+		XPTHREAD_MUTEX_DESTROY(&walk.queues[i].mtx);
+	}
+	free(walk.queues);
+
+	while ((in = RB_ROOT(&walk.inodes)) != NULL) {
+		RB_REMOVE(dir_walk_inode_tree, &walk.inodes, in);
+		free(in);
+	}
+
+	XPTHREAD_COND_DESTROY(&walk.cond);
+	XPTHREAD_MUTEX_DESTROY(&walk.mtx);
+
+	return atomic_load(&walk.stop) ? -1 : 0;
+}
+
+static int
+dir_walk_cmp_inode(struct dir_walk_inode *in1, struct dir_walk_inode *in2)
+{
+	if (in1->dev != in2->dev)
+		return in1->dev < in2->dev ? -1 : 1;
+	if (in1->ino != in2->ino)
+		return in1->ino < in2->ino ? -1 : 1;
+	return 0;
+}
+
+static void *
+dir_walk_handler(void *p)
+{
+	struct dir_walk		*walk;
+	struct dir_walk_dir	 wd;
+	struct dir_walker	*walker;
+	size_t			 gen;
+
+	walker = p;
+	walk = walker->walk;
+
+	for (;;) {
+		/* Only the calling thread can tell if its job is cancelled. */
+		if (walker->id == 0 && job_is_cancelled()) {
+			XPTHREAD_MUTEX_LOCK(&walk->mtx);
+			atomic_store(&walk->stop, 1);
+			XPTHREAD_COND_BROADCAST(&walk->cond);
+			XPTHREAD_MUTEX_UNLOCK(&walk->mtx);
+		}
+		if (atomic_load(&walk->stop))
+			break;
+
+		XPTHREAD_MUTEX_LOCK(&walk->mtx);
+		gen = walk->gen;
+		XPTHREAD_MUTEX_UNLOCK(&walk->mtx);
+
+		if (dir_walk_pop(&walk->queues[walker->id], &wd) == 0 ||
+		    dir_walk_steal(walk, walker->id, &wd) == 0) {
+			dir_walk_read_dir(walk, walker->id, &wd);
+			free(wd.path);
+			if (atomic_fetch_sub(&walk->npending, 1) == 1) {
+				XPTHREAD_MUTEX_LOCK(&walk->mtx);
+				XPTHREAD_COND_BROADCAST(&walk->cond);
+				XPTHREAD_MUTEX_UNLOCK(&walk->mtx);
+			}
+			continue;
+		}
+
+		/*
+		 * There is nothing to take. Wait until another walker adds a
+		 * directory or until all directories have been read.
+		 */
+		XPTHREAD_MUTEX_LOCK(&walk->mtx);
+		while (walk->gen == gen && atomic_load(&walk->npending) > 0 &&
+		    !atomic_load(&walk->stop))
+			XPTHREAD_COND_WAIT(&walk->cond, &walk->mtx);
+		XPTHREAD_MUTEX_UNLOCK(&walk->mtx);
+
+		if (atomic_load(&walk->npending) == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Take the directory that was added last to the specified queue.
+ */
+static int
+dir_walk_pop(struct dir_walk_queue *q, struct dir_walk_dir *wd)
+{
+	int ret;
+
+	XPTHREAD_MUTEX_LOCK(&q->mtx);
+	if (q->head == q->tail)
+		ret = -1;
+	else {
+		*wd = q->dirs[--q->tail];
+		if (q->head == q->tail)
+			q->head = q->tail = 0;
+		ret = 0;
+	}
+	XPTHREAD_MUTEX_UNLOCK(&q->mtx);
+
+	return ret;
+}
+
+static void
+dir_walk_push(struct dir_walk *walk, unsigned int id, char *path,
+    unsigned int depth)
+{
+	struct dir_walk_queue *q;
+
+	q = &walk->queues[id];
+	XPTHREAD_MUTEX_LOCK(&q->mtx);
+	if (q->tail == q->size) {
+		if (q->head > 0) {
+			memmove(q->dirs, q->dirs + q->head,
+			    (q->tail - q->head) * sizeof *q->dirs);
+			q->tail -= q->head;
+			q->head = 0;
+		} else {
+			q->size = (q->size == 0) ? 16 : q->size * 2;
+			q->dirs = xreallocarray(q->dirs, q->size,
+			    sizeof *q->dirs);
+		}
+	}
+	q->dirs[q->tail].path = path;
+	q->dirs[q->tail].depth = depth;
+	q->tail++;
+	XPTHREAD_MUTEX_UNLOCK(&q->mtx);
+
+	XPTHREAD_MUTEX_LOCK(&walk->mtx);
+	walk->gen++;
+	XPTHREAD_COND_BROADCAST(&walk->cond);
+	XPTHREAD_MUTEX_UNLOCK(&walk->mtx);
+}
+
+static void
+dir_walk_read_dir(struct dir_walk *walk, unsigned int id,
+    struct dir_walk_dir *wd)
+{
+	struct dir		*d;
+	struct dir_entry	*de;
+
+	if ((d = dir_open(wd->path)) == NULL) {
+		msg_err("%s", wd->path);
+		return;
+	}
+
+	while (!atomic_load(&walk->stop) && (de = dir_get_entry(d)) != NULL)
+		switch (de->type) {
+		case FILE_TYPE_DIRECTORY:
+			if (!strcmp(de->name, ".") || !strcmp(de->name, ".."))
+				break;
+			if (walk->maxdepth != 0 && wd->depth >= walk->maxdepth)
+				break;
+			if (!dir_walk_visit(walk, de->dev, de->ino)) {
+				LOG_INFO("%s: directory already visited",
+				    de->path);
+				break;
+			}
+			atomic_fetch_add(&walk->npending, 1);
+			dir_walk_push(walk, id, xstrdup(de->path),
+			    wd->depth + 1);
+			break;
+		case FILE_TYPE_REGULAR:
+			XPTHREAD_MUTEX_LOCK(&walk->mtx);
+			walk->func(de->path, walk->arg);
+			XPTHREAD_MUTEX_UNLOCK(&walk->mtx);
+			break;
+		default:
+			msg_errx("%s: Unsupported file type", de->path);
+			break;
+		}
+
+	dir_close(d);
+}
+
+/*
+ * Take the directory that was added first to the queue of another walker.
+ */
+static int
+dir_walk_steal(struct dir_walk *walk, unsigned int id, struct dir_walk_dir *wd)
+{
+	struct dir_walk_queue	*q;
+	unsigned int		 i;
+
+	for (i = 1; i < walk->nqueues; i++) {
+		q = &walk->queues[(id + i) % walk->nqueues];
+		XPTHREAD_MUTEX_LOCK(&q->mtx);
+		if (q->head < q->tail) {
+			*wd = q->dirs[q->head++];
+			if (q->head == q->tail)
+				q->head = q->tail = 0;
+			XPTHREAD_MUTEX_UNLOCK(&q->mtx);
+			return 0;
+		}
+		XPTHREAD_MUTEX_UNLOCK(&q->mtx);
+	}
+
+	return -1;
+}
+
+/*
+ * Record that the directory with the specified device and inode number is
+ * being visited. Return 0 if it has been visited already and 1 otherwise.
+ */
+static int
+dir_walk_visit(struct dir_walk *walk, uint64_t dev, uint64_t ino)
+{
+	struct dir_walk_inode	*in;
+	int			 ret;
+
+	in = xmalloc(sizeof *in);
+	in->dev = dev;
+	in->ino = ino;
+
+	XPTHREAD_MUTEX_LOCK(&walk->mtx);
+	if (RB_INSERT(dir_walk_inode_tree, &walk->inodes, in) != NULL) {
+		free(in);
+		ret = 0;
+	} else
+		ret = 1;
+	XPTHREAD_MUTEX_UNLOCK(&walk->mtx);
+
+	return ret;
+}
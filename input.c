@@ -17,19 +17,29 @@
 #include "config.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "siren.h"
 
+/* Interval at which batch mode checks if playback has finished, in ms. */
+#define INPUT_BATCH_POLL_INTERVAL 100
+
 static void			input_handle_signal(int);
+static void			input_handle_wakeup(void);
 
 static enum input_mode		input_mode = INPUT_MODE_VIEW;
 static pthread_mutex_t		input_mode_mtx = PTHREAD_MUTEX_INITIALIZER;
 static volatile sig_atomic_t	input_quit;
+/* Used by other threads to wake up the main thread. */
+static int			input_wakeup_fd[2] = { -1, -1 };
 #ifdef SIGWINCH
 static volatile sig_atomic_t	input_sigwinch;
 #endif
@@ -44,10 +54,18 @@ void
 input_init(void)
 {
 	struct sigaction	sa;
+	int			i;
 #ifdef VDSUSP
 	struct termios		tio;
 #endif
 
+	if (pipe(input_wakeup_fd) == -1)
+		LOG_FATAL("pipe");
+	for (i = 0; i < 2; i++)
+		if (fcntl(input_wakeup_fd[i], F_SETFL, O_NONBLOCK) == -1 ||
+		    fcntl(input_wakeup_fd[i], F_SETFD, FD_CLOEXEC) == -1)
+			LOG_FATAL("fcntl");
+
 	sa.sa_handler = input_handle_signal;
 	sa.sa_flags = 0;
 	sigemptyset(&sa.sa_mask);
@@ -67,16 +85,17 @@ input_init(void)
 	/*
 	 * Check if the DSUSP special character is set to ^Y. If it is, disable
 	 * it so that ^Y becomes an ordinary character that can be bound to a
-	 * command.
+	 * command. In batch mode, stdin need not be a terminal.
 	 */
-	if (tcgetattr(STDIN_FILENO, &tio) == -1)
-		LOG_ERR("tcgetattr");
-	else
-		if (tio.c_cc[VDSUSP] == K_CTRL('Y')) {
+	if (isatty(STDIN_FILENO)) {
+		if (tcgetattr(STDIN_FILENO, &tio) == -1)
+			LOG_ERR("tcgetattr");
+		else if (tio.c_cc[VDSUSP] == K_CTRL('Y')) {
 			tio.c_cc[VDSUSP] = _POSIX_VDISABLE;
 			if (tcsetattr(STDIN_FILENO, TCSANOW, &tio) == -1)
 				LOG_ERR("tcsetattr");
 		}
+	}
 #endif
 }
 
@@ -91,14 +110,87 @@ input_get_mode(void)
 	return mode;
 }
 
+/*
+ * Process the commands in the specified file, or in stdin if the file is
+ * NULL, and print how long each command took. If a command prompts for an
+ * answer, the next line is used as the answer. Afterwards, wait until
+ * playback has stopped.
+ */
+void
+input_handle_batch(const char *file)
+{
+	FILE		*fp;
+	struct timespec	 end, start, ts;
+	size_t		 lineno, size;
+	ssize_t		 len;
+	double		 msecs;
+	const char	*name;
+	char		*error, *line;
+
+	if (file == NULL) {
+		fp = stdin;
+		name = "stdin";
+	} else if ((fp = fopen(file, "r")) == NULL) {
+		LOG_ERR("fopen: %s", file);
+		msg_err("Cannot open %s", file);
+		return;
+	} else
+		name = file;
+
+	line = NULL;
+	size = 0;
+	for (lineno = 1; !input_quit && (len = getline(&line, &size, fp)) != -1;
+	    lineno++) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+
+		if (input_get_mode() == INPUT_MODE_PROMPT) {
+			prompt_answer(line);
+			continue;
+		}
+
+		if (line[0] == '\0')
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (command_process(line, &error) == -1) {
+			msg_errx("%s:%zu: %s", name, lineno, error);
+			free(error);
+		}
+		/* Let background jobs finish so that scripts are repeatable. */
+		job_wait();
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		msecs = (end.tv_sec - start.tv_sec) * 1000.0 +
+		    (end.tv_nsec - start.tv_nsec) / 1000000.0;
+		printf("%10.3f ms  %s\n", msecs, line);
+		fflush(stdout);
+	}
+	if (ferror(fp) && !input_quit) {
+		LOG_ERR("getline: %s", name);
+		msg_err("Cannot read %s", name);
+	}
+	free(line);
+
+	if (fp != stdin)
+		fclose(fp);
+
+	ts.tv_sec = 0;
+	ts.tv_nsec = INPUT_BATCH_POLL_INTERVAL * 1000000L;
+	while (!input_quit && player_is_playing())
+		nanosleep(&ts, NULL);
+}
+
 void
 input_handle_key(void)
 {
-	struct pollfd	pfd[1];
+	struct pollfd	pfd[2];
 	int		key;
 
 	pfd[0].fd = STDIN_FILENO;
 	pfd[0].events = POLLIN;
+	pfd[1].fd = input_wakeup_fd[0];
+	pfd[1].events = POLLIN;
 
 	while (!input_quit) {
 #ifdef SIGWINCH
@@ -112,14 +204,20 @@ input_handle_key(void)
 			if (errno != EINTR)
 				LOG_FATAL("poll");
 		} else {
-			if (pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+			if (pfd[0].revents & (POLLERR | POLLHUP | POLLNVAL) ||
+			    pfd[1].revents & (POLLERR | POLLHUP | POLLNVAL))
 				LOG_FATALX("poll() failed");
 
-			key = screen_get_key();
-			if (input_mode == INPUT_MODE_VIEW)
-				view_handle_key(key);
-			else
-				prompt_handle_key(key);
+			if (pfd[1].revents & POLLIN)
+				input_handle_wakeup();
+
+			if (pfd[0].revents & POLLIN) {
+				key = screen_get_key();
+				if (input_mode == INPUT_MODE_VIEW)
+					view_handle_key(key);
+				else
+					prompt_handle_key(key);
+			}
 		}
 	}
 }
@@ -141,6 +239,15 @@ input_handle_signal(int sig)
 	}
 }
 
+static void
+input_handle_wakeup(void)
+{
+	char buf[64];
+
+	while (read(input_wakeup_fd[0], buf, sizeof buf) > 0);
+	view_print_dirty();
+}
+
 void
 input_set_mode(enum input_mode mode)
 {
@@ -148,3 +255,20 @@ input_set_mode(enum input_mode mode)
 	input_mode = mode;
 	XPTHREAD_MUTEX_UNLOCK(&input_mode_mtx);
 }
+
+/*
+ * Wake up the main thread so that it redraws the views that have been marked
+ * as dirty. This function can be called from any thread. It does nothing
+ * before input_init() has created the pipe.
+ */
+void
+input_wakeup(void)
+{
+	char c = 0;
+
+	if (input_wakeup_fd[1] == -1)
+		return;
+
+	if (write(input_wakeup_fd[1], &c, 1) == -1 && errno != EAGAIN)
+		LOG_ERR("write");
+}
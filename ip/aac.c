@@ -65,6 +65,7 @@ const struct ip		 ip = {
 	"aac",
 	IP_PRIORITY_AAC,
 	ip_aac_extensions,
+	0,
 	ip_aac_close,
 	ip_aac_get_metadata,
 	ip_aac_get_position,
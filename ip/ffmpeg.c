@@ -37,6 +37,16 @@
 #define IP_FFMPEG_AV_REGISTER_ALL_DEPRECATED
 #endif
 
+/*
+ * Older versions of FFmpeg need a lock manager to open files from more than
+ * one thread at a time.
+ */
+#ifdef IP_FFMPEG_AV_REGISTER_ALL_DEPRECATED
+#define IP_FFMPEG_FLAGS	IP_FLAG_THREAD_SAFE
+#else
+#define IP_FFMPEG_FLAGS	0
+#endif
+
 #define IP_FFMPEG_ERROR	-1
 #define IP_FFMPEG_EOF	0
 #define IP_FFMPEG_OK	1
@@ -115,6 +125,7 @@ const struct ip		 ip = {
 	"ffmpeg",
 	IP_PRIORITY_FFMPEG,
 	ip_ffmpeg_extensions,
+	IP_FFMPEG_FLAGS,
 	ip_ffmpeg_close,
 	ip_ffmpeg_get_metadata,
 	ip_ffmpeg_get_position,
@@ -304,13 +315,8 @@ static int
 ip_ffmpeg_read_planar(struct track *t, struct ip_ffmpeg_ipdata *ipd,
     struct sample_buffer *sb)
 {
-	double		  d, **data_dbl;
-	float		  f, **data_flt;
-	int32_t		**data_s32;
-	int16_t		**data_s16;
-	size_t		  i;
-	unsigned int	  j;
-	int		  ret;
+	size_t		 i, n;
+	int		 ret;
 
 	ipd = t->ipdata;
 
@@ -325,48 +331,40 @@ ip_ffmpeg_read_planar(struct track *t, struct ip_ffmpeg_ipdata *ipd,
 				return -1;
 		}
 
+		/* Convert as many frames as fit in the sample buffer. */
+		n = (sb->size_s - i) / t->format.nchannels;
+		if (n > (size_t)(ipd->frame->nb_samples - ipd->sample))
+			n = ipd->frame->nb_samples - ipd->sample;
+
 		switch (ipd->codecctx->sample_fmt) {
 		case AV_SAMPLE_FMT_S16P:
-			data_s16 = (int16_t **)ipd->frame->extended_data;
-			for (j = 0; j < t->format.nchannels; j++)
-				sb->data2[i++] = data_s16[j][ipd->sample];
+			sample_s16p_to_s16(sb->data2 + i,
+			    (const int16_t * const *)ipd->frame->extended_data,
+			    t->format.nchannels, ipd->sample, n);
 			break;
 		case AV_SAMPLE_FMT_S32P:
-			data_s32 = (int32_t **)ipd->frame->extended_data;
-			for (j = 0; j < t->format.nchannels; j++)
-				sb->data4[i++] = data_s32[j][ipd->sample];
+			sample_s32p_to_s32(sb->data4 + i,
+			    (const int32_t * const *)ipd->frame->extended_data,
+			    t->format.nchannels, ipd->sample, n);
 			break;
 		case AV_SAMPLE_FMT_FLTP:
 			/* XXX Assuming float is 32-bit */
-			data_flt = (float **)ipd->frame->extended_data;
-			for (j = 0; j < t->format.nchannels; j++) {
-				f = data_flt[j][ipd->sample];
-				if (f < -1.0f)
-					sb->data2[i++] = INT16_MIN;
-				else if (f > 1.0f)
-					sb->data2[i++] = INT16_MAX;
-				else
-					sb->data2[i++] = f * INT16_MAX;
-			}
+			sample_fltp_to_s16(sb->data2 + i,
+			    (const float * const *)ipd->frame->extended_data,
+			    t->format.nchannels, ipd->sample, n);
 			break;
 		case AV_SAMPLE_FMT_DBLP:
 			/* XXX Assuming double is 64-bit */
-			data_dbl = (double **)ipd->frame->extended_data;
-			for (j = 0; j < t->format.nchannels; j++) {
-				d = data_dbl[j][ipd->sample];
-				if (d < -1.0)
-					sb->data2[i++] = INT16_MIN;
-				else if (d > 1.0)
-					sb->data2[i++] = INT16_MAX;
-				else
-					sb->data2[i++] = d * INT16_MAX;
-			}
+			sample_dblp_to_s16(sb->data2 + i,
+			    (const double * const *)ipd->frame->extended_data,
+			    t->format.nchannels, ipd->sample, n);
 			break;
 		default:
 			break;
 		}
 
-		ipd->sample++;
+		ipd->sample += n;
+		i += n * t->format.nchannels;
 	}
 
 	sb->len_s = i;
@@ -413,6 +411,18 @@ ip_ffmpeg_parse_metadata(struct track *t, AVDictionary *metadata)
 		} else if (!strcasecmp(tag->key, "genre")) {
 			free(t->genre);
 			t->genre = xstrdup(tag->value);
+		} else if (!strcasecmp(tag->key, "replaygain_album_gain")) {
+			free(t->albumgain);
+			t->albumgain = xstrdup(tag->value);
+		} else if (!strcasecmp(tag->key, "replaygain_album_peak")) {
+			free(t->albumpeak);
+			t->albumpeak = xstrdup(tag->value);
+		} else if (!strcasecmp(tag->key, "replaygain_track_gain")) {
+			free(t->trackgain);
+			t->trackgain = xstrdup(tag->value);
+		} else if (!strcasecmp(tag->key, "replaygain_track_peak")) {
+			free(t->trackpeak);
+			t->trackpeak = xstrdup(tag->value);
 		} else if (!strcasecmp(tag->key, "title")) {
 			free(t->title);
 			t->title = xstrdup(tag->value);
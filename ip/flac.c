@@ -65,6 +65,7 @@ const struct ip		 ip = {
 	"flac",
 	IP_PRIORITY_FLAC,
 	ip_flac_extensions,
+	IP_FLAG_THREAD_SAFE,
 	ip_flac_close,
 	ip_flac_get_metadata,
 	ip_flac_get_position,
@@ -233,8 +234,7 @@ static int
 ip_flac_read(struct track *t, struct sample_buffer *sb)
 {
 	struct ip_flac_ipdata	*ipd;
-	size_t			 i;
-	unsigned int		 j;
+	size_t			 i, n;
 	int			 ret;
 
 	ipd = t->ipdata;
@@ -249,22 +249,28 @@ ip_flac_read(struct track *t, struct sample_buffer *sb)
 				return -1;
 		}
 
+		/* Copy as many frames as fit in the sample buffer. */
+		n = (sb->size_s - i) / t->format.nchannels;
+		if (n > ipd->buflen - ipd->bufidx)
+			n = ipd->buflen - ipd->bufidx;
+
 		switch (sb->nbytes) {
 		case 1:
-			for (j = 0; j < t->format.nchannels; j++)
-				sb->data1[i++] = ipd->buf[j][ipd->bufidx];
+			sample_s32p_to_s8(sb->data1 + i, ipd->buf,
+			    t->format.nchannels, ipd->bufidx, n);
 			break;
 		case 2:
-			for (j = 0; j < t->format.nchannels; j++)
-				sb->data2[i++] = ipd->buf[j][ipd->bufidx];
+			sample_s32p_to_s16(sb->data2 + i, ipd->buf,
+			    t->format.nchannels, ipd->bufidx, n);
 			break;
 		case 4:
-			for (j = 0; j < t->format.nchannels; j++)
-				sb->data4[i++] = ipd->buf[j][ipd->bufidx];
+			sample_s32p_to_s32(sb->data4 + i, ipd->buf,
+			    t->format.nchannels, ipd->bufidx, n);
 			break;
 		}
 
-		ipd->bufidx++;
+		ipd->bufidx += n;
+		i += n * t->format.nchannels;
 	}
 
 	sb->len_s = i;
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include <id3tag.h>
 #include <mad.h>
@@ -61,6 +62,8 @@ static int		 ip_mad_fill_stream(FILE *, struct mad_stream *,
 			    unsigned char *);
 static int		 ip_mad_get_position(struct track *, unsigned int *);
 static void		 ip_mad_get_metadata(struct track *);
+static void		 ip_mad_get_replaygain(struct track *,
+			    struct id3_tag *);
 static int		 ip_mad_open(struct track *);
 static int		 ip_mad_read(struct track *, struct sample_buffer *);
 static void		 ip_mad_seek(struct track *, unsigned int);
@@ -71,6 +74,7 @@ const struct ip		 ip = {
 	"mad",
 	IP_PRIORITY_MAD,
 	ip_mad_extensions,
+	IP_FLAG_THREAD_SAFE,
 	ip_mad_close,
 	ip_mad_get_metadata,
 	ip_mad_get_position,
@@ -221,25 +225,6 @@ ip_mad_fill_stream(FILE *fp, struct mad_stream *stream, unsigned char *buf)
 	return IP_MAD_OK;
 }
 
-/*
- * Convert a fixed-point number to a 16-bit integer sample.
- */
-static int16_t
-ip_mad_fixed_to_int(mad_fixed_t fixed)
-{
-	/* Round to the 15th most significant fraction bit. */
-	fixed += (mad_fixed_t)1 << (MAD_F_FRACBITS - 16);
-
-	/* Clip samples equal to or higher than 1.0 or less than -1.0. */
-	if (fixed >= MAD_F_ONE)
-		fixed = MAD_F_ONE - 1;
-	else if (fixed < -MAD_F_ONE)
-		fixed = -MAD_F_ONE;
-
-	/* Save the sign bit and the 15 most significant fraction bits. */
-	return fixed >> (MAD_F_FRACBITS - 15);
-}
-
 static char *
 ip_mad_get_id3_frame(const struct id3_tag *tag, const char *id)
 {
@@ -324,6 +309,8 @@ ip_mad_get_metadata(struct track *t)
 		free(val);
 	}
 
+	ip_mad_get_replaygain(t, tag);
+
 	if ((tlen = ip_mad_get_id3_frame(tag, "TLEN")) == NULL)
 		t->duration = ip_mad_calculate_duration(t->path);
 	else {
@@ -350,6 +337,47 @@ ip_mad_get_position(struct track *t, unsigned int *pos)
 	return 0;
 }
 
+/*
+ * Copy the ReplayGain values from the TXXX (user-defined text) frames. The
+ * first field of a TXXX frame specifies the text encoding, the second the
+ * description and the third the value.
+ */
+static void
+ip_mad_get_replaygain(struct track *t, struct id3_tag *tag)
+{
+	struct id3_frame	 *frame;
+	union id3_field		 *field;
+	const id3_ucs4_t	 *value;
+	unsigned int		  i;
+	char			**dst, *desc;
+
+	for (i = 0; (frame = id3_tag_findframe(tag, "TXXX", i)) != 0; i++) {
+		if ((field = id3_frame_field(frame, 1)) == 0 ||
+		    (value = id3_field_getstring(field)) == 0 ||
+		    (desc = (char *)id3_ucs4_utf8duplicate(value)) == NULL)
+			continue;
+
+		if (!strcasecmp(desc, "replaygain_album_gain"))
+			dst = &t->albumgain;
+		else if (!strcasecmp(desc, "replaygain_album_peak"))
+			dst = &t->albumpeak;
+		else if (!strcasecmp(desc, "replaygain_track_gain"))
+			dst = &t->trackgain;
+		else if (!strcasecmp(desc, "replaygain_track_peak"))
+			dst = &t->trackpeak;
+		else
+			dst = NULL;
+		free(desc);
+
+		if (dst == NULL || (field = id3_frame_field(frame, 2)) == 0 ||
+		    (value = id3_field_getstring(field)) == 0)
+			continue;
+
+		free(*dst);
+		*dst = (char *)id3_ucs4_utf8duplicate(value);
+	}
+}
+
 static int
 ip_mad_open(struct track *t)
 {
@@ -388,10 +416,13 @@ static int
 ip_mad_read(struct track *t, struct sample_buffer *sb)
 {
 	struct ip_mad_ipdata	*ipd;
+	const int32_t		*samples[2];
+	size_t			 n;
 	int			 ret;
-	unsigned short		 i;
 
 	ipd = t->ipdata;
+	samples[0] = ipd->synth.pcm.samples[0];
+	samples[1] = ipd->synth.pcm.samples[1];
 
 	sb->len_s = 0;
 	while (sb->len_s + t->format.nchannels <= sb->size_s) {
@@ -404,11 +435,17 @@ ip_mad_read(struct track *t, struct sample_buffer *sb)
 				return ret;
 		}
 
-		for (i = 0; i < ipd->synth.pcm.channels; i++)
-			sb->data2[sb->len_s++] = ip_mad_fixed_to_int(
-			    ipd->synth.pcm.samples[i][ipd->sampleidx]);
+		/* Convert as many frames as fit in the sample buffer. */
+		n = (sb->size_s - sb->len_s) / ipd->synth.pcm.channels;
+		if (n > ipd->synth.pcm.length - ipd->sampleidx)
+			n = ipd->synth.pcm.length - ipd->sampleidx;
+
+		sample_fixp_to_s16(sb->data2 + sb->len_s, samples,
+		    ipd->synth.pcm.channels, ipd->sampleidx, n,
+		    MAD_F_FRACBITS);
 
-		ipd->sampleidx++;
+		sb->len_s += n * ipd->synth.pcm.channels;
+		ipd->sampleidx += n;
 	}
 
 	sb->len_b = sb->len_s * sb->nbytes;
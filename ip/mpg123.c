@@ -19,6 +19,7 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 #include <mpg123.h>
@@ -34,6 +35,8 @@ static void	 ip_mpg123_close(struct track *);
 static void	 ip_mpg123_close_fd_handle(int fd, mpg123_handle *);
 static int	 ip_mpg123_get_position(struct track *, unsigned int *);
 static void	 ip_mpg123_get_metadata(struct track *);
+static void	 ip_mpg123_get_replaygain(struct track *,
+		    const mpg123_text *);
 static int	 ip_mpg123_init(void);
 static int	 ip_mpg123_open(struct track *);
 static int	 ip_mpg123_open_fd_handle(const char *, int *fd,
@@ -251,6 +254,7 @@ const struct ip	 ip = {
 	"mpg123",
 	IP_PRIORITY_MPG123,
 	ip_mpg123_extensions,
+	IP_FLAG_THREAD_SAFE,
 	ip_mpg123_close,
 	ip_mpg123_get_metadata,
 	ip_mpg123_get_position,
@@ -369,6 +373,10 @@ ip_mpg123_get_metadata(struct track *t)
 			else if (!strncmp(v2->text[i].id, "TRCK", 4))
 				track_split_tag(v2->text[i].text.p,
 				    &t->tracknumber, &t->tracktotal);
+
+		/* ReplayGain values are stored in TXXX frames. */
+		for (i = 0; i < v2->extras; i++)
+			ip_mpg123_get_replaygain(t, &v2->extra[i]);
 	} else if (v1 != NULL) {
 		t->album = xstrndup(v1->album, sizeof v1->album);
 		t->artist = xstrndup(v1->artist, sizeof v1->artist);
@@ -403,6 +411,34 @@ ip_mpg123_get_position(struct track *t, unsigned int *pos)
 	return 0;
 }
 
+/*
+ * Copy the ReplayGain value from a TXXX (user-defined text) frame.
+ */
+static void
+ip_mpg123_get_replaygain(struct track *t, const mpg123_text *txxx)
+{
+	char		**field;
+	const char	 *desc;
+
+	if (txxx->description.p == NULL || txxx->text.p == NULL)
+		return;
+
+	desc = txxx->description.p;
+	if (!strcasecmp(desc, "replaygain_album_gain"))
+		field = &t->albumgain;
+	else if (!strcasecmp(desc, "replaygain_album_peak"))
+		field = &t->albumpeak;
+	else if (!strcasecmp(desc, "replaygain_track_gain"))
+		field = &t->trackgain;
+	else if (!strcasecmp(desc, "replaygain_track_peak"))
+		field = &t->trackpeak;
+	else
+		return;
+
+	free(*field);
+	*field = xstrdup(txxx->text.p);
+}
+
 static int
 ip_mpg123_init(void)
 {
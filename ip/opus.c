@@ -39,6 +39,7 @@ const struct ip		 ip = {
 	"opus",
 	IP_PRIORITY_OPUS,
 	ip_opus_extensions,
+	IP_FLAG_THREAD_SAFE,
 	ip_opus_close,
 	ip_opus_get_metadata,
 	ip_opus_get_position,
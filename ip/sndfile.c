@@ -73,6 +73,7 @@ const struct ip		 ip = {
 	"sndfile",
 	IP_PRIORITY_SNDFILE,
 	ip_sndfile_extensions,
+	IP_FLAG_THREAD_SAFE,
 	ip_sndfile_close,
 	ip_sndfile_get_metadata,
 	ip_sndfile_get_position,
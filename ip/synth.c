@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2016 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The synth input plug-in generates a test signal described by a ".synth"
+ * file. Each line of the file has the form "key=value". Empty lines and lines
+ * starting with "#" are ignored. The following keys are supported.
+ *
+ * waveform		sine, sweep, noise or silence (default: sine)
+ * frequency		frequency in Hz, or start frequency of a sweep (440)
+ * frequency-end	end frequency of a sweep in Hz (20000)
+ * amplitude		amplitude in percent of full scale (50)
+ * rate			sampling rate in Hz (44100)
+ * bits			bits per sample: 8, 16, 24 or 32 (16)
+ * channels		number of channels (2)
+ * duration		duration in seconds (60)
+ * frames		duration in frames; overrides duration if set
+ * seed			seed of the noise generator (1)
+ * title		title of the track
+ *
+ * Every sample is computed from its frame number alone, so the signal is
+ * reproducible bit for bit and seeking is exact.
+ */
+
+#include "../config.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../siren.h"
+
+#define IP_SYNTH_MAX_CHANNELS	32
+#define IP_SYNTH_MAX_FREQUENCY	1000000
+#define IP_SYNTH_MAX_RATE	768000
+
+enum ip_synth_waveform {
+	IP_SYNTH_WAVEFORM_NOISE,
+	IP_SYNTH_WAVEFORM_SILENCE,
+	IP_SYNTH_WAVEFORM_SINE,
+	IP_SYNTH_WAVEFORM_SWEEP
+};
+
+struct ip_synth_spec {
+	enum ip_synth_waveform waveform;
+	unsigned int	 frequency;
+	unsigned int	 frequency_end;
+	unsigned int	 amplitude;
+	unsigned int	 rate;
+	unsigned int	 nbits;
+	unsigned int	 nchannels;
+	unsigned int	 duration;
+	unsigned long long nframes;
+	unsigned int	 seed;
+	char		*title;
+};
+
+struct ip_synth_ipdata {
+	struct ip_synth_spec spec;
+	unsigned long long frame;	/* Current frame */
+	double		 scale;		/* Value of a full-scale sample */
+};
+
+static void		 ip_synth_close(struct track *);
+static void		 ip_synth_get_metadata(struct track *);
+static int		 ip_synth_get_position(struct track *,
+			    unsigned int *);
+static double		 ip_synth_get_value(struct ip_synth_ipdata *,
+			    unsigned long long, unsigned int);
+static int		 ip_synth_open(struct track *);
+static int		 ip_synth_parse_line(struct ip_synth_spec *, char *,
+			    const char **);
+static int		 ip_synth_parse_spec(const char *,
+			    struct ip_synth_spec *);
+static int		 ip_synth_read(struct track *, struct sample_buffer *);
+static void		 ip_synth_seek(struct track *, unsigned int);
+
+static const char	*ip_synth_extensions[] = { "synth", NULL };
+
+const struct ip		 ip = {
+	"synth",
+	IP_PRIORITY_SYNTH,
+	ip_synth_extensions,
+	IP_FLAG_THREAD_SAFE,
+	ip_synth_close,
+	ip_synth_get_metadata,
+	ip_synth_get_position,
+	NULL,
+	ip_synth_open,
+	ip_synth_read,
+	ip_synth_seek
+};
+
+static void
+ip_synth_close(struct track *t)
+{
+	struct ip_synth_ipdata *ipd;
+
+	ipd = t->ipdata;
+	free(ipd->spec.title);
+	free(ipd);
+}
+
+static void
+ip_synth_get_metadata(struct track *t)
+{
+	struct ip_synth_spec spec;
+
+	if (ip_synth_parse_spec(t->path, &spec) == -1)
+		return;
+
+	t->title = spec.title;
+	t->duration = spec.nframes / spec.rate;
+}
+
+static int
+ip_synth_get_position(struct track *t, unsigned int *pos)
+{
+	struct ip_synth_ipdata *ipd;
+
+	ipd = t->ipdata;
+	*pos = ipd->frame / ipd->spec.rate;
+	return 0;
+}
+
+/*
+ * Return the value, between -1 and 1, of the sample of the specified channel
+ * at the specified frame.
+ */
+static double
+ip_synth_get_value(struct ip_synth_ipdata *ipd, unsigned long long frame,
+    unsigned int chan)
+{
+	struct ip_synth_spec	*spec;
+	uint64_t		 x;
+	double			 cycles, n;
+
+	spec = &ipd->spec;
+
+	switch (spec->waveform) {
+	case IP_SYNTH_WAVEFORM_NOISE:
+		/* SplitMix64 of the sample number. */
+		x = spec->seed + (uint64_t)frame * spec->nchannels + chan;
+		x += 0x9e3779b97f4a7c15ULL;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		x ^= x >> 31;
+		return (x >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+	case IP_SYNTH_WAVEFORM_SILENCE:
+		return 0.0;
+	case IP_SYNTH_WAVEFORM_SINE:
+		/* Compute the phase exactly to avoid drift. */
+		cycles = (double)((uint64_t)spec->frequency * frame %
+		    spec->rate) / spec->rate;
+		break;
+	case IP_SYNTH_WAVEFORM_SWEEP:
+	default:
+		/* Linear sweep over the whole track. */
+		n = frame;
+		cycles = spec->frequency * n / spec->rate +
+		    ((double)spec->frequency_end - spec->frequency) * n * n /
+		    (2.0 * spec->rate * spec->nframes);
+		cycles -= floor(cycles);
+		break;
+	}
+
+	return sin(2.0 * M_PI * cycles);
+}
+
+static int
+ip_synth_open(struct track *t)
+{
+	struct ip_synth_ipdata *ipd;
+
+	ipd = xmalloc(sizeof *ipd);
+	if (ip_synth_parse_spec(t->path, &ipd->spec) == -1) {
+		free(ipd);
+		return -1;
+	}
+
+	ipd->frame = 0;
+	ipd->scale = ipd->spec.amplitude / 100.0 *
+	    ((1ULL << (ipd->spec.nbits - 1)) - 1);
+
+	t->format.nbits = ipd->spec.nbits;
+	t->format.nchannels = ipd->spec.nchannels;
+	t->format.rate = ipd->spec.rate;
+
+	LOG_DEBUG("waveform=%d, frequency=%u, rate=%u, nbits=%u, nchannels=%u, "
+	    "nframes=%llu", ipd->spec.waveform, ipd->spec.frequency,
+	    ipd->spec.rate, ipd->spec.nbits, ipd->spec.nchannels,
+	    ipd->spec.nframes);
+
+	t->ipdata = ipd;
+	return 0;
+}
+
+/*
+ * Parse a "key=value" line. If an error occurs, -1 is returned and *errstr
+ * is set to an error message.
+ */
+static int
+ip_synth_parse_line(struct ip_synth_spec *spec, char *line,
+    const char **errstr)
+{
+	long long	 max, min, num;
+	unsigned int	*field;
+	char		*key, *val;
+
+	key = line;
+	if ((val = strchr(line, '=')) == NULL) {
+		*errstr = "missing \"=\"";
+		return -1;
+	}
+	*val++ = '\0';
+
+	if (!strcmp(key, "title")) {
+		free(spec->title);
+		spec->title = xstrdup(val);
+		return 0;
+	}
+
+	if (!strcmp(key, "waveform")) {
+		if (!strcmp(val, "noise"))
+			spec->waveform = IP_SYNTH_WAVEFORM_NOISE;
+		else if (!strcmp(val, "silence"))
+			spec->waveform = IP_SYNTH_WAVEFORM_SILENCE;
+		else if (!strcmp(val, "sine"))
+			spec->waveform = IP_SYNTH_WAVEFORM_SINE;
+		else if (!strcmp(val, "sweep"))
+			spec->waveform = IP_SYNTH_WAVEFORM_SWEEP;
+		else {
+			*errstr = "invalid waveform";
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!strcmp(key, "frames")) {
+		spec->nframes = strtonum(val, 1, LLONG_MAX, errstr);
+		return *errstr != NULL ? -1 : 0;
+	}
+
+	if (!strcmp(key, "amplitude")) {
+		field = &spec->amplitude;
+		min = 0;
+		max = 100;
+	} else if (!strcmp(key, "bits")) {
+		field = &spec->nbits;
+		min = 1;
+		max = 32;
+	} else if (!strcmp(key, "channels")) {
+		field = &spec->nchannels;
+		min = 1;
+		max = IP_SYNTH_MAX_CHANNELS;
+	} else if (!strcmp(key, "duration")) {
+		field = &spec->duration;
+		min = 1;
+		max = INT_MAX;
+	} else if (!strcmp(key, "frequency")) {
+		field = &spec->frequency;
+		min = 1;
+		max = IP_SYNTH_MAX_FREQUENCY;
+	} else if (!strcmp(key, "frequency-end")) {
+		field = &spec->frequency_end;
+		min = 1;
+		max = IP_SYNTH_MAX_FREQUENCY;
+	} else if (!strcmp(key, "rate")) {
+		field = &spec->rate;
+		min = 1;
+		max = IP_SYNTH_MAX_RATE;
+	} else if (!strcmp(key, "seed")) {
+		field = &spec->seed;
+		min = 0;
+		max = UINT_MAX;
+	} else {
+		*errstr = "unknown key";
+		return -1;
+	}
+
+	num = strtonum(val, min, max, errstr);
+	if (*errstr != NULL)
+		return -1;
+
+	if (field == &spec->nbits && num != 8 && num != 16 && num != 24 &&
+	    num != 32) {
+		*errstr = "unsupported number of bits";
+		return -1;
+	}
+
+	*field = num;
+	return 0;
+}
+
+/*
+ * Parse the specified file. The caller must free spec->title.
+ */
+static int
+ip_synth_parse_spec(const char *path, struct ip_synth_spec *spec)
+{
+	FILE		*fp;
+	size_t		 lineno, size;
+	ssize_t		 len;
+	int		 ret;
+	const char	*errstr;
+	char		*line;
+
+	spec->waveform = IP_SYNTH_WAVEFORM_SINE;
+	spec->frequency = 440;
+	spec->frequency_end = 20000;
+	spec->amplitude = 50;
+	spec->rate = 44100;
+	spec->nbits = 16;
+	spec->nchannels = 2;
+	spec->duration = 60;
+	spec->nframes = 0;
+	spec->seed = 1;
+	spec->title = NULL;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		LOG_ERR("fopen: %s", path);
+		msg_err("%s: Cannot open track", path);
+		return -1;
+	}
+
+	ret = 0;
+	line = NULL;
+	size = 0;
+	for (lineno = 1; (len = getline(&line, &size, fp)) != -1; lineno++) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[len - 1] = '\0';
+
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+
+		if (ip_synth_parse_line(spec, line, &errstr) == -1) {
+			LOG_ERRX("%s:%zu: %s", path, lineno, errstr);
+			msg_errx("%s:%zu: %s", path, lineno, errstr);
+			ret = -1;
+			break;
+		}
+	}
+	if (ferror(fp)) {
+		LOG_ERR("getline: %s", path);
+		msg_err("%s: Cannot read track", path);
+		ret = -1;
+	}
+	free(line);
+	fclose(fp);
+
+	if (ret == -1) {
+		free(spec->title);
+		return -1;
+	}
+
+	if (spec->nframes == 0)
+		spec->nframes = (unsigned long long)spec->duration * spec->rate;
+
+	return 0;
+}
+
+static int
+ip_synth_read(struct track *t, struct sample_buffer *sb)
+{
+	struct ip_synth_ipdata	*ipd;
+	double			 val;
+	int32_t			 sample;
+	unsigned int		 chan, nchannels;
+
+	ipd = t->ipdata;
+	nchannels = ipd->spec.nchannels;
+
+	sb->len_s = 0;
+	while (sb->len_s + nchannels <= sb->size_s &&
+	    ipd->frame < ipd->spec.nframes) {
+		val = 0.0;
+		for (chan = 0; chan < nchannels; chan++) {
+			/* Only noise differs between channels. */
+			if (chan == 0 ||
+			    ipd->spec.waveform == IP_SYNTH_WAVEFORM_NOISE)
+				val = ip_synth_get_value(ipd, ipd->frame, chan);
+			sample = lrint(val * ipd->scale);
+
+			switch (sb->nbytes) {
+			case 1:
+				sb->data1[sb->len_s] = sample;
+				break;
+			case 2:
+				sb->data2[sb->len_s] = sample;
+				break;
+			case 4:
+				sb->data4[sb->len_s] = sample;
+				break;
+			}
+			sb->len_s++;
+		}
+		ipd->frame++;
+	}
+
+	sb->len_b = sb->len_s * sb->nbytes;
+	return sb->len_s != 0;
+}
+
+static void
+ip_synth_seek(struct track *t, unsigned int sec)
+{
+	struct ip_synth_ipdata *ipd;
+
+	ipd = t->ipdata;
+	ipd->frame = (unsigned long long)sec * ipd->spec.rate;
+	if (ipd->frame > ipd->spec.nframes)
+		ipd->frame = ipd->spec.nframes;
+}
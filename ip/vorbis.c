@@ -45,6 +45,7 @@ const struct ip		 ip = {
 	"vorbis",
 	IP_PRIORITY_VORBIS,
 	ip_vorbis_extensions,
+	IP_FLAG_THREAD_SAFE,
 	ip_vorbis_close,
 	ip_vorbis_get_metadata,
 	ip_vorbis_get_position,
@@ -58,6 +58,7 @@ const struct ip		 ip = {
 	"wavpack",
 	IP_PRIORITY_WAVPACK,
 	ip_wavpack_extensions,
+	IP_FLAG_THREAD_SAFE,
 	ip_wavpack_close,
 	ip_wavpack_get_metadata,
 	ip_wavpack_get_position,
@@ -99,6 +100,11 @@ ip_wavpack_get_metadata(struct track *t)
 	t->genre = ip_wavpack_get_tag_item(wpc, "genre");
 	t->title = ip_wavpack_get_tag_item(wpc, "title");
 
+	t->albumgain = ip_wavpack_get_tag_item(wpc, "replaygain_album_gain");
+	t->albumpeak = ip_wavpack_get_tag_item(wpc, "replaygain_album_peak");
+	t->trackgain = ip_wavpack_get_tag_item(wpc, "replaygain_track_gain");
+	t->trackpeak = ip_wavpack_get_tag_item(wpc, "replaygain_track_peak");
+
 	val = ip_wavpack_get_tag_item(wpc, "track");
 	if (val != NULL) {
 		track_split_tag(val, &t->tracknumber, &t->tracktotal);
@@ -214,12 +220,14 @@ static int
 ip_wavpack_read(struct track *t, struct sample_buffer *sb)
 {
 	struct ip_wavpack_ipdata	*ipd;
+	const int32_t			*buf;
+	size_t				 n;
 	uint32_t			 ret;
-	float				 f;
 
 	ipd = t->ipdata;
 
-	for (sb->len_s = 0; sb->len_s < sb->size_s; sb->len_s++) {
+	sb->len_s = 0;
+	while (sb->len_s < sb->size_s) {
 		if (ipd->bufidx == ipd->buflen) {
 			ret = WavpackUnpackSamples(ipd->wpc, ipd->buf,
 			    IP_WAVPACK_BUFSIZE);
@@ -230,30 +238,33 @@ ip_wavpack_read(struct track *t, struct sample_buffer *sb)
 			ipd->bufidx = 0;
 		}
 
+		/* Convert as many samples as fit in the sample buffer. */
+		n = sb->size_s - sb->len_s;
+		if (n > ipd->buflen - ipd->bufidx)
+			n = ipd->buflen - ipd->bufidx;
+		buf = ipd->buf + ipd->bufidx;
+
 		if (!ipd->float_samples)
 			switch (sb->nbytes) {
 			case 1:
-				sb->data1[sb->len_s] = ipd->buf[ipd->bufidx];
+				sample_s32_to_s8(sb->data1 + sb->len_s, buf, n);
 				break;
 			case 2:
-				sb->data2[sb->len_s] = ipd->buf[ipd->bufidx];
+				sample_s32_to_s16(sb->data2 + sb->len_s, buf,
+				    n);
 				break;
 			case 4:
-				sb->data4[sb->len_s] = ipd->buf[ipd->bufidx];
+				memcpy(sb->data4 + sb->len_s, buf,
+				    n * sizeof *buf);
 				break;
 			}
-		else {
+		else
 			/* We assume floats use IEEE 754 representation. */
-			f = *(float *)&ipd->buf[ipd->bufidx] * -INT16_MIN;
-			if (f < INT16_MIN)
-				sb->data2[sb->len_s] = INT16_MIN;
-			else if (f > INT16_MAX)
-				sb->data2[sb->len_s] = INT16_MAX;
-			else
-				sb->data2[sb->len_s] = f;
-		}
+			sample_flt_to_s16(sb->data2 + sb->len_s,
+			    (const float *)buf, n);
 
-		ipd->bufidx++;
+		sb->len_s += n;
+		ipd->bufidx += n;
 	}
 
 	sb->len_b = sb->len_s * sb->nbytes;
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2016 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Jobs are run in the background by the job thread, one at a time and in the
+ * order in which they were added. A job that is waiting is cancelled by
+ * removing it from the list. A job that is running is cancelled by setting a
+ * flag, which the job checks with job_is_cancelled() as it goes.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "siren.h"
+
+struct job {
+	unsigned int	 id;
+	char		*name;
+	void		 (*func)(void *);
+	void		 (*free)(void *);
+	void		*data;
+	TAILQ_ENTRY(job) entries;
+};
+
+TAILQ_HEAD(job_list, job);
+
+static void		 job_free(struct job *);
+static void		*job_handler(void *);
+
+static pthread_t	 job_thd;
+static pthread_mutex_t	 job_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	 job_cond = PTHREAD_COND_INITIALIZER;
+static struct job_list	 job_list = TAILQ_HEAD_INITIALIZER(job_list);
+static struct job	*job_running;
+static atomic_int	 job_cancelled;
+static unsigned int	 job_next_id = 1;
+static int		 job_quit;
+
+void
+job_add(const char *name, void (*func)(void *), void (*freefunc)(void *),
+    void *data)
+{
+	struct job	*job;
+	unsigned int	 id;
+
+	job = xmalloc(sizeof *job);
+	job->name = xstrdup(name);
+	job->func = func;
+	job->free = freefunc;
+	job->data = data;
+
+	XPTHREAD_MUTEX_LOCK(&job_mtx);
+	id = job->id = job_next_id++;
+	TAILQ_INSERT_TAIL(&job_list, job, entries);
+	XPTHREAD_COND_BROADCAST(&job_cond);
+	XPTHREAD_MUTEX_UNLOCK(&job_mtx);
+
+	LOG_INFO("added job %u: %s", id, name);
+}
+
+/*
+ * Cancel the job with the specified ID or, if the ID is 0, all jobs.
+ */
+int
+job_cancel(unsigned int id)
+{
+	struct job	*job, *tjob;
+	int		 found;
+
+	found = 0;
+	XPTHREAD_MUTEX_LOCK(&job_mtx);
+	if (job_running != NULL && (id == 0 || job_running->id == id)) {
+		atomic_store(&job_cancelled, 1);
+		found = 1;
+	}
+	TAILQ_FOREACH_SAFE(job, &job_list, entries, tjob)
+		if (id == 0 || job->id == id) {
+			TAILQ_REMOVE(&job_list, job, entries);
+			job_free(job);
+			found = 1;
+		}
+	XPTHREAD_COND_BROADCAST(&job_cond);
+	XPTHREAD_MUTEX_UNLOCK(&job_mtx);
+
+	if (!found && id != 0) {
+		msg_errx("No such job: %u", id);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+job_end(void)
+{
+	XPTHREAD_MUTEX_LOCK(&job_mtx);
+	job_quit = 1;
+	XPTHREAD_MUTEX_UNLOCK(&job_mtx);
+
+	job_cancel(0);
+	XPTHREAD_JOIN(job_thd, NULL);
+}
+
+static void
+job_free(struct job *job)
+{
+	if (job->free != NULL)
+		job->free(job->data);
+	free(job->name);
+	free(job);
+}
+
+static void *
+job_handler(UNUSED void *p)
+{
+	struct job *job;
+
+	XPTHREAD_MUTEX_LOCK(&job_mtx);
+	for (;;) {
+		while (!job_quit && TAILQ_EMPTY(&job_list))
+			XPTHREAD_COND_WAIT(&job_cond, &job_mtx);
+		if (job_quit)
+			break;
+
+		job = TAILQ_FIRST(&job_list);
+		TAILQ_REMOVE(&job_list, job, entries);
+		job_running = job;
+		atomic_store(&job_cancelled, 0);
+		XPTHREAD_MUTEX_UNLOCK(&job_mtx);
+
+		LOG_INFO("running job %u: %s", job->id, job->name);
+		job->func(job->data);
+		if (atomic_load(&job_cancelled))
+			msg_info("Job %u cancelled", job->id);
+
+		XPTHREAD_MUTEX_LOCK(&job_mtx);
+		job_running = NULL;
+		job_free(job);
+		XPTHREAD_COND_BROADCAST(&job_cond);
+	}
+	XPTHREAD_MUTEX_UNLOCK(&job_mtx);
+
+	return NULL;
+}
+
+void
+job_init(void)
+{
+	XPTHREAD_CREATE(&job_thd, NULL, job_handler, NULL);
+}
+
+/*
+ * Return whether the running job has been cancelled. Jobs run only in the job
+ * thread, so 0 is returned in other threads.
+ */
+int
+job_is_cancelled(void)
+{
+	if (!pthread_equal(pthread_self(), job_thd))
+		return 0;
+	return atomic_load(&job_cancelled);
+}
+
+void
+job_print(void)
+{
+	struct job	*job;
+	size_t		 len;
+	char		 buf[256];
+
+	len = 0;
+	buf[0] = '\0';
+
+	XPTHREAD_MUTEX_LOCK(&job_mtx);
+	if (job_running != NULL)
+		len = snprintf(buf, sizeof buf, "%u: %s (running)",
+		    job_running->id, job_running->name);
+	TAILQ_FOREACH(job, &job_list, entries) {
+		if (len >= sizeof buf)
+			break;
+		len += snprintf(buf + len, sizeof buf - len, "%s%u: %s",
+		    len > 0 ? ", " : "", job->id, job->name);
+	}
+	XPTHREAD_MUTEX_UNLOCK(&job_mtx);
+
+	if (len == 0)
+		msg_info("No jobs");
+	else
+		msg_info("%s", buf);
+}
+
+/*
+ * Wait until all jobs have finished.
+ */
+void
+job_wait(void)
+{
+	XPTHREAD_MUTEX_LOCK(&job_mtx);
+	while (job_running != NULL || !TAILQ_EMPTY(&job_list))
+		XPTHREAD_COND_WAIT(&job_cond, &job_mtx);
+	XPTHREAD_MUTEX_UNLOCK(&job_mtx);
+}
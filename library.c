@@ -21,11 +21,12 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 #include <time.h>
 
 #include "siren.h"
 
+static int		 library_cmp_track(const void *, const void *);
+static struct track	*library_find_next_track(int);
 static int		 library_search_entry(const void *, const char *);
 
 static pthread_mutex_t	 library_menu_mtx = PTHREAD_MUTEX_INITIALIZER;
@@ -34,6 +35,7 @@ static struct format	*library_format;
 static struct menu	*library_menu;
 static unsigned int	 library_duration;
 static int		 library_modified;
+static struct option_entry *library_repeat_all;
 
 void
 library_activate_entry(void)
@@ -60,32 +62,7 @@ library_activate_entry(void)
 void
 library_add_dir(const char *path)
 {
-	struct dir		*d;
-	struct dir_entry	*de;
-	struct track		*t;
-
-	if ((d = dir_open(path)) == NULL) {
-		msg_err("%s", path);
-		return;
-	}
-
-	while ((de = dir_get_entry(d)) != NULL) {
-		switch (de->type) {
-		case FILE_TYPE_DIRECTORY:
-			if (strcmp(de->name, ".") && strcmp(de->name, ".."))
-				library_add_dir(de->path);
-			break;
-		case FILE_TYPE_REGULAR:
-			if ((t = track_get(de->path, NULL)) != NULL)
-				library_add_track(t);
-			break;
-		default:
-			msg_errx("%s: Unsupported file type", de->path);
-			break;
-		}
-	}
-
-	dir_close(d);
+	track_add_dir(path, library_add_tracks);
 }
 
 void
@@ -95,6 +72,7 @@ library_add_track(struct track *t)
 	struct menu_entry	*entry;
 
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	track_lock_metadata();
 	MENU_FOR_EACH_ENTRY(library_menu, entry) {
 		et = menu_get_entry_data(entry);
 		if (track_cmp(t, et) < 0) {
@@ -107,9 +85,59 @@ library_add_track(struct track *t)
 		menu_insert_tail(library_menu, t);
 
 	library_duration += t->duration;
+	track_unlock_metadata();
 	library_modified = 1;
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
-	library_print();
+	view_set_dirty(VIEW_ID_LIBRARY);
+}
+
+/*
+ * Add the specified tracks. The tracks are sorted first, so that they can be
+ * merged into the library in a single pass.
+ */
+void
+library_add_tracks(struct track **tracks, size_t ntracks)
+{
+	struct track		*et;
+	struct menu_entry	*entry;
+	size_t			 i;
+
+	track_lock_metadata();
+	qsort(tracks, ntracks, sizeof *tracks, library_cmp_track);
+	track_unlock_metadata();
+
+	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	track_lock_metadata();
+	entry = menu_get_first_entry(library_menu);
+	for (i = 0; i < ntracks; i++) {
+		while (entry != NULL) {
+			et = menu_get_entry_data(entry);
+			if (track_cmp(tracks[i], et) < 0)
+				break;
+			entry = menu_get_next_entry(entry);
+		}
+
+		if (entry != NULL)
+			menu_insert_before(library_menu, entry, tracks[i]);
+		else
+			menu_insert_tail(library_menu, tracks[i]);
+
+		library_duration += tracks[i]->duration;
+	}
+	track_unlock_metadata();
+	library_modified = 1;
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+	view_set_dirty(VIEW_ID_LIBRARY);
+}
+
+static int
+library_cmp_track(const void *p1, const void *p2)
+{
+	struct track * const *t1, * const *t2;
+
+	t1 = p1;
+	t2 = p2;
+	return track_cmp(*t1, *t2);
 }
 
 void
@@ -163,18 +191,12 @@ library_end(void)
 	menu_free(library_menu);
 }
 
-static void
-library_get_entry_text(const void *e, char *buf, size_t bufsize)
-{
-	const struct track *t;
-
-	t = e;
-	format_track_snprintf(buf, bufsize, library_format, library_altformat,
-	    t);
-}
-
-struct track *
-library_get_next_track(void)
+/*
+ * Return the track after the active one. If activate is set, the track is also
+ * made the active one.
+ */
+static struct track *
+library_find_next_track(int activate)
 {
 	struct menu_entry	*me;
 	struct track		*t;
@@ -184,21 +206,40 @@ library_get_next_track(void)
 		t = NULL;
 	else {
 		if ((me = menu_get_next_entry(me)) == NULL &&
-		    option_get_boolean("repeat-all"))
+		    option_handle_get_boolean(library_repeat_all))
 			me = menu_get_first_entry(library_menu);
 
 		if (me == NULL)
 			t = NULL;
 		else {
-			menu_activate_entry(library_menu, me);
+			if (activate)
+				menu_activate_entry(library_menu, me);
 			t = menu_get_entry_data(me);
 		}
 	}
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
-	library_print();
+
+	if (activate)
+		view_set_dirty(VIEW_ID_LIBRARY);
 	return t;
 }
 
+static void
+library_get_entry_text(const void *e, char *buf, size_t bufsize)
+{
+	const struct track *t;
+
+	t = e;
+	format_track_snprintf(buf, bufsize, library_format, library_altformat,
+	    t);
+}
+
+struct track *
+library_get_next_track(void)
+{
+	return library_find_next_track(1);
+}
+
 struct track *
 library_get_prev_track(void)
 {
@@ -210,7 +251,7 @@ library_get_prev_track(void)
 		t = NULL;
 	else {
 		if ((me = menu_get_prev_entry(me)) == NULL &&
-		    option_get_boolean("repeat-all"))
+		    option_handle_get_boolean(library_repeat_all))
 			me = menu_get_last_entry(library_menu);
 
 		if (me == NULL)
@@ -221,7 +262,7 @@ library_get_prev_track(void)
 		}
 	}
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
-	library_print();
+	view_set_dirty(VIEW_ID_LIBRARY);
 	return t;
 }
 
@@ -230,6 +271,14 @@ library_init(void)
 {
 	library_menu = menu_init(NULL, library_get_entry_text,
 	    library_search_entry);
+	library_repeat_all = option_get_handle("repeat-all",
+	    OPTION_TYPE_BOOLEAN);
+}
+
+struct track *
+library_peek_next_track(void)
+{
+	return library_find_next_track(0);
 }
 
 void
@@ -248,7 +297,9 @@ library_print(void)
 	option_lock();
 	library_format = option_get_format("library-format");
 	library_altformat = option_get_format("library-format-alt");
+	track_lock_metadata();
 	menu_print(library_menu);
+	track_unlock_metadata();
 	option_unlock();
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 }
@@ -260,12 +311,17 @@ library_reactivate_entry(void)
 	struct track		*t;
 
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
-	if ((e = menu_get_active_entry(library_menu)) != NULL) {
+	if ((e = menu_get_active_entry(library_menu)) != NULL)
 		t = menu_get_entry_data(e);
+	else
+		t = NULL;
+	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+
+	/* The player may need the menu to stop playback. */
+	if (t != NULL) {
 		player_set_source(PLAYER_SOURCE_LIBRARY);
 		player_play_track(t);
 	}
-	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
 }
 
 void
@@ -304,6 +360,7 @@ library_read_file(void)
 		if ((t = track_require(line)) == NULL)
 			continue;
 
+		track_lock_metadata();
 		MENU_FOR_EACH_ENTRY_REVERSE(library_menu, e) {
 			et = menu_get_entry_data(e);
 			if (track_cmp(t, et) > 0) {
@@ -314,6 +371,7 @@ library_read_file(void)
 		if (e == NULL)
 			menu_insert_head(library_menu, t);
 		library_duration += t->duration;
+		track_unlock_metadata();
 
 		if (time(NULL) > lasttime) {
 			library_print();
@@ -430,6 +488,7 @@ library_update(void)
 	struct track		*pt, *t;
 
 	XPTHREAD_MUTEX_LOCK(&library_menu_mtx);
+	track_lock_metadata();
 
 	library_duration = 0;
 
@@ -455,7 +514,9 @@ library_update(void)
 		e = ne;
 	}
 
+	track_unlock_metadata();
 	XPTHREAD_MUTEX_UNLOCK(&library_menu_mtx);
+	view_set_dirty(VIEW_ID_LIBRARY);
 }
 
 int
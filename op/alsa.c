@@ -17,39 +17,78 @@
 #include "../config.h"
 
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <alsa/asoundlib.h>
 
 #include "../siren.h"
 
+#define OP_ALSA_ACCESS		"rw"
+#define OP_ALSA_BUFFER_TIME	0
+#define OP_ALSA_PERIOD_TIME	0
 #define OP_ALSA_PCM_DEVICE	"default"
 #define OP_ALSA_MIXER_DEVICE	"default"
 #define OP_ALSA_MIXER_ELEM	"PCM"
 
+/*
+ * In adaptive mode, the buffer is made OP_ALSA_MAX_GROWTH times as large as
+ * the requested buffer time so that the fill target can be raised without
+ * reconfiguring the device. The target is lowered again after
+ * OP_ALSA_STABLE_TIME seconds without underruns.
+ */
+#define OP_ALSA_MAX_GROWTH	4
+#define OP_ALSA_STABLE_TIME	30
+
+static int		 op_alsa_begin_write(void **, size_t *);
 static void		 op_alsa_close(void);
+static int		 op_alsa_commit_write(size_t);
+static int		 op_alsa_drop(void);
 static size_t		 op_alsa_get_buffer_size(void);
+static int		 op_alsa_get_caps(struct sample_caps *);
+static int		 op_alsa_get_delay(unsigned int *);
+static snd_pcm_format_t	 op_alsa_get_format(enum sample_encoding);
 static int		 op_alsa_get_volume(void);
 static int		 op_alsa_get_volume_support(void);
 static int		 op_alsa_init(void);
+static int		 op_alsa_mixer_elem_cb(snd_mixer_elem_t *,
+			    unsigned int);
+static void		*op_alsa_mixer_handler(void *);
 static int		 op_alsa_open(void);
+static int		 op_alsa_pause(int);
+static int		 op_alsa_recover(const char *, int);
+static void		 op_alsa_set_target(snd_pcm_uframes_t, const char *);
 static void		 op_alsa_set_volume(unsigned int);
+static void		 op_alsa_set_volume_handler(void (*)(int));
 static int		 op_alsa_start(struct sample_format *);
 static int		 op_alsa_stop(void);
+static int		 op_alsa_wait(snd_pcm_uframes_t);
 static int		 op_alsa_write(struct sample_buffer *);
 
 const struct op		 op = {
 	"alsa",
 	OP_PRIORITY_ALSA,
 	NULL,
+	op_alsa_begin_write,
 	op_alsa_close,
+	op_alsa_commit_write,
+	op_alsa_drop,
 	op_alsa_get_buffer_size,
+	op_alsa_get_caps,
+	op_alsa_get_delay,
 	op_alsa_get_volume,
 	op_alsa_get_volume_support,
 	op_alsa_init,
 	op_alsa_open,
+	op_alsa_pause,
+	NULL,
 	op_alsa_set_volume,
+	op_alsa_set_volume_handler,
 	op_alsa_start,
 	op_alsa_stop,
 	op_alsa_write
@@ -61,6 +100,91 @@ static snd_mixer_elem_t	*op_alsa_mixer_elem;
 static char		*op_alsa_mixer_dev;
 static size_t		 op_alsa_bufsize;
 static size_t		 op_alsa_framesize;
+static snd_pcm_uframes_t op_alsa_period_size;
+static snd_pcm_uframes_t op_alsa_buffer_size;
+static unsigned int	 op_alsa_rate;
+static unsigned int	 op_alsa_xruns;
+
+/*
+ * In adaptive mode, the buffer is filled only up to the target. The target is
+ * raised after an underrun or when the buffer has almost run empty, and
+ * lowered again, but not below the initial target, once playback has been
+ * stable for a while.
+ */
+static int		 op_alsa_adaptive;
+static int		 op_alsa_primed;
+static snd_pcm_uframes_t op_alsa_target;
+static snd_pcm_uframes_t op_alsa_min_target;
+static snd_pcm_uframes_t op_alsa_stable_frames;
+
+/*
+ * In mmap mode, the player writes its samples directly into the ALSA buffer
+ * area returned by op_alsa_begin_write().
+ */
+static int		 op_alsa_mmap;
+static snd_pcm_uframes_t op_alsa_mmap_offset;
+
+/*
+ * The mixer thread waits for mixer events and passes volume changes to the
+ * volume handler. The mixer mutex serialises access to the mixer handle.
+ */
+static pthread_t	 op_alsa_mixer_thd;
+static pthread_mutex_t	 op_alsa_mixer_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int		 op_alsa_mixer_pipe[2];
+static void		 (*op_alsa_volume_handler)(int);
+
+/*
+ * Return the next contiguous part of the ALSA buffer, at most one period
+ * long, in mmap mode. Wait until at least one period is available.
+ */
+static int
+op_alsa_begin_write(void **area, size_t *size)
+{
+	const snd_pcm_channel_area_t	*areas;
+	snd_pcm_sframes_t		 avail;
+	snd_pcm_uframes_t		 nframes;
+	int				 ret;
+
+	if (!op_alsa_mmap) {
+		*area = NULL;
+		return 0;
+	}
+
+	for (;;) {
+		avail = snd_pcm_avail_update(op_alsa_pcm_handle);
+		if (avail < 0) {
+			if (op_alsa_recover("snd_pcm_avail_update", avail) ==
+			    -1)
+				return -1;
+			continue;
+		}
+
+		if ((snd_pcm_uframes_t)avail >= op_alsa_period_size)
+			break;
+
+		ret = snd_pcm_wait(op_alsa_pcm_handle, -1);
+		if (ret < 0 && op_alsa_recover("snd_pcm_wait", ret) == -1)
+			return -1;
+	}
+
+	if (op_alsa_wait(op_alsa_period_size) == -1)
+		return -1;
+
+	nframes = op_alsa_period_size;
+	ret = snd_pcm_mmap_begin(op_alsa_pcm_handle, &areas,
+	    &op_alsa_mmap_offset, &nframes);
+	if (ret < 0) {
+		/* Let the player fall back to op_alsa_write(). */
+		*area = NULL;
+		return op_alsa_recover("snd_pcm_mmap_begin", ret);
+	}
+
+	/* The samples are interleaved, so all channels share one area. */
+	*area = (char *)areas[0].addr +
+	    (areas[0].first + op_alsa_mmap_offset * areas[0].step) / 8;
+	*size = nframes * op_alsa_framesize;
+	return 0;
+}
 
 static void
 op_alsa_close(void)
@@ -68,6 +192,11 @@ op_alsa_close(void)
 	snd_pcm_close(op_alsa_pcm_handle);
 
 	if (op_alsa_mixer_handle != NULL) {
+		/* Closing the pipe makes the mixer thread return. */
+		close(op_alsa_mixer_pipe[1]);
+		XPTHREAD_JOIN(op_alsa_mixer_thd, NULL);
+		close(op_alsa_mixer_pipe[0]);
+
 		snd_mixer_free(op_alsa_mixer_handle);
 		snd_mixer_detach(op_alsa_mixer_handle, op_alsa_mixer_dev);
 		snd_mixer_close(op_alsa_mixer_handle);
@@ -75,12 +204,148 @@ op_alsa_close(void)
 	}
 }
 
+static int
+op_alsa_commit_write(size_t len)
+{
+	snd_pcm_sframes_t	ret;
+	int			err;
+
+	ret = snd_pcm_mmap_commit(op_alsa_pcm_handle, op_alsa_mmap_offset,
+	    len / op_alsa_framesize);
+	if (ret < 0)
+		return op_alsa_recover("snd_pcm_mmap_commit", ret);
+
+	/* Unlike snd_pcm_writei(), committing does not start the stream. */
+	if (snd_pcm_state(op_alsa_pcm_handle) == SND_PCM_STATE_PREPARED) {
+		err = snd_pcm_start(op_alsa_pcm_handle);
+		if (err)
+			return op_alsa_recover("snd_pcm_start", err);
+	}
+
+	return 0;
+}
+
+/*
+ * Discard the samples in the buffer and prepare the stream for new ones.
+ * This also resumes a paused stream.
+ */
+static int
+op_alsa_drop(void)
+{
+	int ret;
+
+	ret = snd_pcm_drop(op_alsa_pcm_handle);
+	if (ret) {
+		LOG_ERRX("snd_pcm_drop: %s", snd_strerror(ret));
+		msg_errx("Cannot stop playback: %s", snd_strerror(ret));
+		return -1;
+	}
+
+	ret = snd_pcm_prepare(op_alsa_pcm_handle);
+	if (ret) {
+		LOG_ERRX("snd_pcm_prepare: %s", snd_strerror(ret));
+		msg_errx("Cannot stop playback: %s", snd_strerror(ret));
+		return -1;
+	}
+
+	op_alsa_primed = 0;
+	return 0;
+}
+
 static size_t
 op_alsa_get_buffer_size(void)
 {
 	return op_alsa_bufsize;
 }
 
+static int
+op_alsa_get_caps(struct sample_caps *caps)
+{
+	static const enum sample_encoding encodings[] = {
+		SAMPLE_ENCODING_S8,
+		SAMPLE_ENCODING_S16,
+		SAMPLE_ENCODING_S24,
+		SAMPLE_ENCODING_S24_3,
+		SAMPLE_ENCODING_S32,
+		SAMPLE_ENCODING_FLOAT
+	};
+	snd_pcm_hw_params_t	*params;
+	size_t			 i;
+	int			 dir, ret;
+
+	ret = snd_pcm_hw_params_malloc(&params);
+	if (ret) {
+		LOG_ERRX("snd_pcm_hw_malloc: %s", snd_strerror(ret));
+		return -1;
+	}
+
+	snd_pcm_hw_params_any(op_alsa_pcm_handle, params);
+
+	/* Report the rates the device supports without ALSA resampling. */
+	if (resample_enabled())
+		snd_pcm_hw_params_set_rate_resample(op_alsa_pcm_handle, params,
+		    0);
+
+	for (i = 0; i < nitems(encodings); i++)
+		if (snd_pcm_hw_params_test_format(op_alsa_pcm_handle, params,
+		    op_alsa_get_format(encodings[i])) == 0)
+			caps->encodings |= encodings[i];
+
+	snd_pcm_hw_params_get_channels_min(params, &caps->minchannels);
+	snd_pcm_hw_params_get_channels_max(params, &caps->maxchannels);
+	snd_pcm_hw_params_get_rate_min(params, &caps->minrate, &dir);
+	snd_pcm_hw_params_get_rate_max(params, &caps->maxrate, &dir);
+
+	snd_pcm_hw_params_free(params);
+	return 0;
+}
+
+/*
+ * Get the number of frames that have been written but not yet played. An
+ * error is not fatal: the delay is merely not compensated for.
+ */
+static int
+op_alsa_get_delay(unsigned int *delay)
+{
+	snd_pcm_sframes_t	frames;
+	int			ret;
+
+	ret = snd_pcm_delay(op_alsa_pcm_handle, &frames);
+	if (ret < 0) {
+		LOG_DEBUG("snd_pcm_delay: %s", snd_strerror(ret));
+		return -1;
+	}
+
+	*delay = frames > 0 ? frames : 0;
+	return 0;
+}
+
+/*
+ * Return the ALSA format of the specified encoding. Packed 24-bit samples are
+ * in native byte order.
+ */
+static snd_pcm_format_t
+op_alsa_get_format(enum sample_encoding encoding)
+{
+	switch (encoding) {
+	case SAMPLE_ENCODING_S8:
+		return SND_PCM_FORMAT_S8;
+	case SAMPLE_ENCODING_S16:
+		return SND_PCM_FORMAT_S16;
+	case SAMPLE_ENCODING_S24:
+		return SND_PCM_FORMAT_S24;
+	case SAMPLE_ENCODING_S24_3:
+		if (player_get_byte_order() == BYTE_ORDER_BIG)
+			return SND_PCM_FORMAT_S24_3BE;
+		else
+			return SND_PCM_FORMAT_S24_3LE;
+	case SAMPLE_ENCODING_S32:
+		return SND_PCM_FORMAT_S32;
+	default:
+		return SND_PCM_FORMAT_FLOAT;
+	}
+}
+
 static int
 op_alsa_get_volume(void)
 {
@@ -90,16 +355,17 @@ op_alsa_get_volume(void)
 	if (op_alsa_mixer_handle == NULL)
 		return -1;
 
-	ret = snd_mixer_handle_events(op_alsa_mixer_handle);
-	if (ret < 0)
-		LOG_ERRX("snd_mixer_handle_events: %s", snd_strerror(ret));
-
 	/*
+	 * The mixer thread handles mixer events, so the mixer element is
+	 * up to date.
+	 *
 	 * SND_MIXER_SCHN_MONO is an alias for SND_MIXER_SCHN_FRONT_LEFT. We
 	 * assume all channels have the same value.
 	 */
+	XPTHREAD_MUTEX_LOCK(&op_alsa_mixer_mtx);
 	ret = snd_mixer_selem_get_playback_volume(op_alsa_mixer_elem,
 	    SND_MIXER_SCHN_MONO, &volume);
+	XPTHREAD_MUTEX_UNLOCK(&op_alsa_mixer_mtx);
 	if (ret) {
 		LOG_ERRX("snd_mixer_get_playback_volume: %s",
 		    snd_strerror(ret));
@@ -140,16 +406,98 @@ op_alsa_handle_error(const char *file, int line, const char *func, int errnum,
 static int
 op_alsa_init(void)
 {
+	option_add_string("alsa-access", OP_ALSA_ACCESS, player_reopen_op);
+	option_add_boolean("alsa-adaptive-buffer", 0, player_reopen_op);
+	option_add_number("alsa-buffer-time", OP_ALSA_BUFFER_TIME, 0, 10000,
+	    player_reopen_op);
 	option_add_string("alsa-mixer-device", OP_ALSA_MIXER_DEVICE,
 	    player_reopen_op);
 	option_add_string("alsa-mixer-element", OP_ALSA_MIXER_ELEM,
 	    player_reopen_op);
 	option_add_string("alsa-pcm-device", OP_ALSA_PCM_DEVICE,
 	    player_reopen_op);
+	option_add_number("alsa-period-time", OP_ALSA_PERIOD_TIME, 0, 1000,
+	    player_reopen_op);
 	snd_lib_error_set_handler(op_alsa_handle_error);
 	return 0;
 }
 
+/*
+ * The op_alsa_mixer_mtx mutex is locked when this function is called.
+ */
+static int
+op_alsa_mixer_elem_cb(snd_mixer_elem_t *elem, unsigned int mask)
+{
+	long int volume;
+
+	if (mask == SND_CTL_EVENT_MASK_REMOVE ||
+	    !(mask & SND_CTL_EVENT_MASK_VALUE) ||
+	    op_alsa_volume_handler == NULL)
+		return 0;
+
+	if (snd_mixer_selem_get_playback_volume(elem, SND_MIXER_SCHN_MONO,
+	    &volume) == 0)
+		op_alsa_volume_handler(volume);
+
+	return 0;
+}
+
+static void *
+op_alsa_mixer_handler(UNUSED void *p)
+{
+	struct pollfd	*pfd;
+	sigset_t	 ss;
+	int		 n, ret;
+
+	/* Leave signal handling to the main thread. */
+	sigfillset(&ss);
+	pthread_sigmask(SIG_BLOCK, &ss, NULL);
+
+	XPTHREAD_MUTEX_LOCK(&op_alsa_mixer_mtx);
+	n = snd_mixer_poll_descriptors_count(op_alsa_mixer_handle);
+	if (n < 0) {
+		LOG_ERRX("snd_mixer_poll_descriptors_count: %s",
+		    snd_strerror(n));
+		n = 0;
+	}
+
+	pfd = xreallocarray(NULL, n + 1, sizeof *pfd);
+	pfd[0].fd = op_alsa_mixer_pipe[0];
+	pfd[0].events = POLLIN;
+
+	if (n > 0 && (n = snd_mixer_poll_descriptors(op_alsa_mixer_handle,
+	    pfd + 1, n)) < 0) {
+		LOG_ERRX("snd_mixer_poll_descriptors: %s", snd_strerror(n));
+		n = 0;
+	}
+	XPTHREAD_MUTEX_UNLOCK(&op_alsa_mixer_mtx);
+
+	for (;;) {
+		if (poll(pfd, n + 1, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			LOG_ERR("poll");
+			break;
+		}
+
+		/* The pipe has been closed. */
+		if (pfd[0].revents)
+			break;
+
+		XPTHREAD_MUTEX_LOCK(&op_alsa_mixer_mtx);
+		ret = snd_mixer_handle_events(op_alsa_mixer_handle);
+		XPTHREAD_MUTEX_UNLOCK(&op_alsa_mixer_mtx);
+		if (ret < 0) {
+			LOG_ERRX("snd_mixer_handle_events: %s",
+			    snd_strerror(ret));
+			break;
+		}
+	}
+
+	free(pfd);
+	return NULL;
+}
+
 static int
 op_alsa_open(void)
 {
@@ -252,6 +600,14 @@ op_alsa_open(void)
 		goto error3;
 	}
 
+	/* Start the mixer thread. */
+	if (pipe(op_alsa_mixer_pipe) == -1) {
+		LOG_ERR("pipe");
+		goto error3;
+	}
+	snd_mixer_elem_set_callback(op_alsa_mixer_elem, op_alsa_mixer_elem_cb);
+	XPTHREAD_CREATE(&op_alsa_mixer_thd, NULL, op_alsa_mixer_handler, NULL);
+
 	return 0;
 
 error3:
@@ -268,6 +624,80 @@ error1:
 	return 0;
 }
 
+/*
+ * Not all devices can pause. A stream that has not started yet need not be
+ * paused.
+ */
+static int
+op_alsa_pause(int pause)
+{
+	snd_pcm_state_t	state;
+	int		ret;
+
+	state = snd_pcm_state(op_alsa_pcm_handle);
+	if ((pause && state != SND_PCM_STATE_RUNNING) ||
+	    (!pause && state != SND_PCM_STATE_PAUSED))
+		return 0;
+
+	ret = snd_pcm_pause(op_alsa_pcm_handle, pause);
+	if (ret) {
+		LOG_ERRX("snd_pcm_pause: %s", snd_strerror(ret));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Try to recover from an error returned by the named ALSA function. Only
+ * underruns can be recovered from.
+ */
+static int
+op_alsa_recover(const char *func, int err)
+{
+	int ret;
+
+	LOG_ERRX("%s: %s", func, snd_strerror(err));
+	if (err == -EPIPE) {
+		op_alsa_xruns++;
+		if (op_alsa_adaptive) {
+			op_alsa_primed = 0;
+			op_alsa_set_target(2 * op_alsa_target, "underrun");
+		}
+
+		ret = snd_pcm_prepare(op_alsa_pcm_handle);
+		if (ret == 0)
+			return 0;
+		LOG_ERRX("snd_pcm_prepare: %s", snd_strerror(ret));
+		err = ret;
+	}
+
+	msg_errx("Playback error: %s", snd_strerror(err));
+	return -1;
+}
+
+/*
+ * Change the fill target in adaptive mode and report the new state.
+ */
+static void
+op_alsa_set_target(snd_pcm_uframes_t target, const char *reason)
+{
+	if (target > op_alsa_buffer_size)
+		target = op_alsa_buffer_size;
+	if (target < op_alsa_min_target)
+		target = op_alsa_min_target;
+
+	op_alsa_stable_frames = 0;
+	if (target == op_alsa_target)
+		return;
+
+	op_alsa_target = target;
+	LOG_INFO("%s: target=%lu ms, buffer=%lu ms, period=%lu ms, xruns=%u",
+	    reason, op_alsa_target * 1000 / op_alsa_rate,
+	    op_alsa_buffer_size * 1000 / op_alsa_rate,
+	    op_alsa_period_size * 1000 / op_alsa_rate, op_alsa_xruns);
+}
+
 static void
 op_alsa_set_volume(unsigned int volume)
 {
@@ -276,8 +706,10 @@ op_alsa_set_volume(unsigned int volume)
 	if (op_alsa_mixer_handle == NULL)
 		return;
 
+	XPTHREAD_MUTEX_LOCK(&op_alsa_mixer_mtx);
 	ret = snd_mixer_selem_set_playback_volume_all(op_alsa_mixer_elem,
 	    volume);
+	XPTHREAD_MUTEX_UNLOCK(&op_alsa_mixer_mtx);
 	if (ret) {
 		LOG_ERRX("snd_mixer_selem_set_playback_volume_all: %s",
 		    snd_strerror(ret));
@@ -285,6 +717,14 @@ op_alsa_set_volume(unsigned int volume)
 	}
 }
 
+static void
+op_alsa_set_volume_handler(void (*handler)(int))
+{
+	XPTHREAD_MUTEX_LOCK(&op_alsa_mixer_mtx);
+	op_alsa_volume_handler = handler;
+	XPTHREAD_MUTEX_UNLOCK(&op_alsa_mixer_mtx);
+}
+
 static int
 op_alsa_start(struct sample_format *sf)
 {
@@ -292,7 +732,8 @@ op_alsa_start(struct sample_format *sf)
 	snd_pcm_format_t	 format;
 	snd_pcm_uframes_t	 nframes;
 	int			 dir, ret;
-	unsigned int		 rate;
+	unsigned int		 buffer_time, period_time, rate;
+	char			*access;
 
 	/* Allocate memory. */
 	ret = snd_pcm_hw_params_malloc(&params);
@@ -304,26 +745,36 @@ op_alsa_start(struct sample_format *sf)
 	/* Set defaults. */
 	snd_pcm_hw_params_any(op_alsa_pcm_handle, params);
 
-	/* Set access type. */
-	ret = snd_pcm_hw_params_set_access(op_alsa_pcm_handle, params,
-	    SND_PCM_ACCESS_RW_INTERLEAVED);
+	/* Set access type. Fall back to read/write access if necessary. */
+	access = option_get_string("alsa-access");
+	op_alsa_mmap = !strcmp(access, "mmap");
+	if (!op_alsa_mmap && strcmp(access, "rw")) {
+		LOG_ERRX("%s: invalid access type", access);
+		msg_errx("Invalid access type: %s", access);
+	}
+	free(access);
+
+	if (op_alsa_mmap) {
+		ret = snd_pcm_hw_params_set_access(op_alsa_pcm_handle, params,
+		    SND_PCM_ACCESS_MMAP_INTERLEAVED);
+		if (ret) {
+			LOG_ERRX("snd_pcm_hw_params_set_access: %s",
+			    snd_strerror(ret));
+			op_alsa_mmap = 0;
+		}
+	}
+
+	if (!op_alsa_mmap)
+		ret = snd_pcm_hw_params_set_access(op_alsa_pcm_handle, params,
+		    SND_PCM_ACCESS_RW_INTERLEAVED);
 	if (ret) {
 		LOG_ERRX("snd_pcm_hw_params_set_access: %s",
 		    snd_strerror(ret));
 		goto error;
 	}
 
-	/* Determine format. */
-	if (sf->nbits <= 8)
-		format = SND_PCM_FORMAT_S8;
-	else if (sf->nbits <= 16)
-		format = SND_PCM_FORMAT_S16;
-	else if (sf->nbits <= 24)
-		format = SND_PCM_FORMAT_S24;
-	else
-		format = SND_PCM_FORMAT_S32;
-
 	/* Set format. */
+	format = op_alsa_get_format(sf->encoding);
 	ret = snd_pcm_hw_params_set_format(op_alsa_pcm_handle, params, format);
 	if (ret) {
 		LOG_ERRX("snd_pcm_hw_params_set: %s", snd_strerror(ret));
@@ -339,6 +790,18 @@ op_alsa_start(struct sample_format *sf)
 		goto error;
 	}
 
+	/*
+	 * If siren may resample itself, then do not let ALSA resample. The
+	 * player learns the actual rate through sf->rate.
+	 */
+	if (resample_enabled()) {
+		ret = snd_pcm_hw_params_set_rate_resample(op_alsa_pcm_handle,
+		    params, 0);
+		if (ret)
+			LOG_ERRX("snd_pcm_hw_params_set_rate_resample: %s",
+			    snd_strerror(ret));
+	}
+
 	/* Set sampling rate. */
 	dir = 0;
 	rate = sf->rate;
@@ -350,6 +813,29 @@ op_alsa_start(struct sample_format *sf)
 		goto error;
 	}
 
+	/* Set period time, if requested. */
+	period_time = option_get_number("alsa-period-time") * 1000;
+	if (period_time > 0) {
+		ret = snd_pcm_hw_params_set_period_time_near(
+		    op_alsa_pcm_handle, params, &period_time, &dir);
+		if (ret)
+			LOG_ERRX("snd_pcm_hw_params_set_period_time_near: %s",
+			    snd_strerror(ret));
+	}
+
+	/* Set buffer time, if requested. */
+	op_alsa_adaptive = option_get_boolean("alsa-adaptive-buffer");
+	buffer_time = option_get_number("alsa-buffer-time") * 1000;
+	if (buffer_time > 0) {
+		if (op_alsa_adaptive)
+			buffer_time *= OP_ALSA_MAX_GROWTH;
+		ret = snd_pcm_hw_params_set_buffer_time_near(
+		    op_alsa_pcm_handle, params, &buffer_time, &dir);
+		if (ret)
+			LOG_ERRX("snd_pcm_hw_params_set_buffer_time_near: %s",
+			    snd_strerror(ret));
+	}
+
 	/* Configure the device. */
 	ret = snd_pcm_hw_params(op_alsa_pcm_handle, params);
 	if (ret) {
@@ -362,15 +848,39 @@ op_alsa_start(struct sample_format *sf)
 	 * size of 1 period and use that as the size of our buffer.
 	 */
 	snd_pcm_hw_params_get_period_size(params, &nframes, &dir);
-	op_alsa_framesize = ((sf->nbits + 7) / 8) * sf->nchannels;
+	snd_pcm_hw_params_get_buffer_size(params, &op_alsa_buffer_size);
+	op_alsa_framesize = sample_encoding_size(sf->encoding) * sf->nchannels;
 	op_alsa_bufsize = nframes * op_alsa_framesize;
+	op_alsa_period_size = nframes;
+	op_alsa_rate = rate;
+	op_alsa_xruns = 0;
 
 	snd_pcm_hw_params_free(params);
 
-	sf->byte_order = player_get_byte_order();
+	/*
+	 * Start with the part of the buffer that was asked for. Without a
+	 * buffer time, the buffer has not been enlarged, so all of it is used.
+	 */
+	if (op_alsa_adaptive && buffer_time > 0) {
+		op_alsa_min_target = op_alsa_buffer_size / OP_ALSA_MAX_GROWTH;
+		if (op_alsa_min_target < 2 * op_alsa_period_size)
+			op_alsa_min_target = 2 * op_alsa_period_size;
+	} else
+		op_alsa_min_target = op_alsa_buffer_size;
+	op_alsa_target = op_alsa_min_target;
+	op_alsa_stable_frames = 0;
+	op_alsa_primed = 0;
 
-	LOG_INFO("format=%s, channels=%u, rate=%u, bufsize=%zu",
-	    snd_pcm_format_name(format), sf->nchannels, rate, op_alsa_bufsize);
+	sf->byte_order = player_get_byte_order();
+	sf->rate = rate;
+
+	LOG_INFO("format=%s, channels=%u, rate=%u, bufsize=%zu, access=%s",
+	    snd_pcm_format_name(format), sf->nchannels, rate, op_alsa_bufsize,
+	    op_alsa_mmap ? "mmap" : "rw");
+	LOG_INFO("buffer=%lu ms, period=%lu ms, target=%lu ms",
+	    op_alsa_buffer_size * 1000 / rate,
+	    op_alsa_period_size * 1000 / rate,
+	    op_alsa_target * 1000 / rate);
 	return 0;
 
 error:
@@ -383,6 +893,58 @@ static int
 op_alsa_stop(void)
 {
 	snd_pcm_drain(op_alsa_pcm_handle);
+	if (op_alsa_xruns > 0)
+		LOG_INFO("%u underruns", op_alsa_xruns);
+	return 0;
+}
+
+/*
+ * In adaptive mode, wait until the specified number of frames can be written
+ * without filling the buffer beyond the target, and adapt the target to how
+ * close the buffer came to running empty.
+ */
+static int
+op_alsa_wait(snd_pcm_uframes_t nframes)
+{
+	struct timespec		ts;
+	snd_pcm_sframes_t	avail;
+	snd_pcm_uframes_t	fill, excess;
+
+	if (!op_alsa_adaptive)
+		return 0;
+
+	for (;;) {
+		avail = snd_pcm_avail_update(op_alsa_pcm_handle);
+		if (avail < 0)
+			return op_alsa_recover("snd_pcm_avail_update", avail);
+
+		if ((snd_pcm_uframes_t)avail >= op_alsa_buffer_size)
+			fill = 0;
+		else
+			fill = op_alsa_buffer_size - avail;
+
+		if (fill + nframes <= op_alsa_target)
+			break;
+
+		/* Sleep until enough frames have been played. */
+		op_alsa_primed = 1;
+		excess = fill + nframes - op_alsa_target;
+		ts.tv_sec = excess / op_alsa_rate;
+		ts.tv_nsec = (excess % op_alsa_rate) * 1000000000ULL /
+		    op_alsa_rate;
+		nanosleep(&ts, NULL);
+	}
+
+	if (op_alsa_primed && fill < op_alsa_period_size) {
+		op_alsa_primed = 0;
+		op_alsa_set_target(2 * op_alsa_target, "buffer almost empty");
+	} else if (op_alsa_target > op_alsa_min_target) {
+		op_alsa_stable_frames += nframes;
+		if (op_alsa_stable_frames >= (snd_pcm_uframes_t)op_alsa_rate *
+		    OP_ALSA_STABLE_TIME)
+			op_alsa_set_target(op_alsa_target / 2, "stable");
+	}
+
 	return 0;
 }
 
@@ -391,21 +953,19 @@ op_alsa_write(struct sample_buffer *sb)
 {
 	snd_pcm_sframes_t ret;
 
-	ret = snd_pcm_writei(op_alsa_pcm_handle, sb->data,
-	    sb->len_b / op_alsa_framesize);
-	if (ret == -EPIPE) {
-		/* An underrun occurred; attempt to recover. */
-		LOG_ERRX("snd_pcm_writei: %s", snd_strerror(ret));
-		ret = snd_pcm_prepare(op_alsa_pcm_handle);
-		if (ret) {
-			LOG_ERRX("snd_pcm_prepare: %s", snd_strerror(ret));
-			msg_errx("Playback error: %s", snd_strerror(ret));
-			return -1;
-		}
-	} else if (ret < 0) {
-		LOG_ERRX("snd_pcm_writei: %s", snd_strerror(ret));
-		msg_errx("Playback error: %s", snd_strerror(ret));
+	if (op_alsa_wait(sb->len_b / op_alsa_framesize) == -1)
 		return -1;
+
+	if (op_alsa_mmap) {
+		ret = snd_pcm_mmap_writei(op_alsa_pcm_handle, sb->data,
+		    sb->len_b / op_alsa_framesize);
+		if (ret < 0)
+			return op_alsa_recover("snd_pcm_mmap_writei", ret);
+	} else {
+		ret = snd_pcm_writei(op_alsa_pcm_handle, sb->data,
+		    sb->len_b / op_alsa_framesize);
+		if (ret < 0)
+			return op_alsa_recover("snd_pcm_writei", ret);
 	}
 	return 0;
 }
@@ -40,13 +40,21 @@ const struct op		 op = {
 	"ao",
 	OP_PRIORITY_AO,
 	"prot_exec",
+	NULL,
 	op_ao_close,
+	NULL,
+	NULL,
 	op_ao_get_buffer_size,
 	NULL,
+	NULL,
+	NULL,
 	op_ao_get_volume_support,
 	op_ao_init,
 	op_ao_open,
 	NULL,
+	NULL,
+	NULL,
+	NULL,
 	op_ao_start,
 	op_ao_stop,
 	op_ao_write
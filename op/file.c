@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2016 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The file output plug-in writes the samples to a WAVE file or, in raw mode,
+ * to a file without any header. The samples are written in little-endian
+ * byte order.
+ *
+ * The file is truncated only the first time the plug-in is started after it
+ * has been opened. Later starts append to the file, so that stopping and
+ * resuming playback does not discard what has been written already. Since a
+ * file can hold samples of only one format, a start with a different sample
+ * format is refused.
+ */
+
+#include "../config.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../siren.h"
+
+#define OP_FILE_BUFSIZE		4096
+#define OP_FILE_FORMAT		"wav"
+#define OP_FILE_PATH		"siren.wav"
+
+#define OP_FILE_HEADER_SIZE	44
+#define OP_FILE_WAVE_PCM	1
+#define OP_FILE_WAVE_FLOAT	3
+
+static void		 op_file_close(void);
+static size_t		 op_file_get_buffer_size(void);
+static int		 op_file_get_caps(struct sample_caps *);
+static int		 op_file_get_volume_support(void);
+static int		 op_file_init(void);
+static int		 op_file_open(void);
+static void		 op_file_put16(uint8_t *, uint16_t);
+static void		 op_file_put32(uint8_t *, uint32_t);
+static int		 op_file_start(struct sample_format *);
+static int		 op_file_stop(void);
+static int		 op_file_write(struct sample_buffer *);
+static int		 op_file_write_header(void);
+
+const struct op		 op = {
+	"file",
+	OP_PRIORITY_FILE,
+	NULL,
+	NULL,
+	op_file_close,
+	NULL,
+	NULL,
+	op_file_get_buffer_size,
+	op_file_get_caps,
+	NULL,
+	NULL,
+	op_file_get_volume_support,
+	op_file_init,
+	op_file_open,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	op_file_start,
+	op_file_stop,
+	op_file_write
+};
+
+static FILE		*op_file_fp;
+static char		*op_file_path;
+static int		 op_file_raw;
+static int		 op_file_append;
+static struct sample_format op_file_format;
+static unsigned long long op_file_size;
+
+static void
+op_file_close(void)
+{
+	free(op_file_path);
+}
+
+/* Return the buffer size in bytes. */
+static size_t
+op_file_get_buffer_size(void)
+{
+	return option_get_number("file-buffer-size");
+}
+
+static int
+op_file_get_caps(struct sample_caps *caps)
+{
+	if (op_file_raw)
+		caps->encodings = SAMPLE_ENCODING_S8 | SAMPLE_ENCODING_S16 |
+		    SAMPLE_ENCODING_S24 | SAMPLE_ENCODING_S24_3 |
+		    SAMPLE_ENCODING_S32 | SAMPLE_ENCODING_FLOAT;
+	else
+		/* 8-bit WAVE samples are unsigned. */
+		caps->encodings = SAMPLE_ENCODING_S16 | SAMPLE_ENCODING_S24_3 |
+		    SAMPLE_ENCODING_S32 | SAMPLE_ENCODING_FLOAT;
+	caps->minchannels = 1;
+	caps->maxchannels = UINT16_MAX;
+	caps->minrate = 1;
+	caps->maxrate = 0;
+	return 0;
+}
+
+static int
+op_file_get_volume_support(void)
+{
+	return 0;
+}
+
+static int
+op_file_init(void)
+{
+	option_add_number("file-buffer-size", OP_FILE_BUFSIZE, 1, INT_MAX,
+	    player_reopen_op);
+	option_add_string("file-format", OP_FILE_FORMAT, player_reopen_op);
+	option_add_string("file-path", OP_FILE_PATH, player_reopen_op);
+	return 0;
+}
+
+static int
+op_file_open(void)
+{
+	char *format;
+
+	format = option_get_string("file-format");
+	if (!strcmp(format, "wav"))
+		op_file_raw = 0;
+	else if (!strcmp(format, "raw"))
+		op_file_raw = 1;
+	else {
+		LOG_ERRX("%s: invalid file format", format);
+		msg_errx("Invalid file format: %s", format);
+		free(format);
+		return -1;
+	}
+	free(format);
+
+	op_file_path = option_get_string("file-path");
+	op_file_append = 0;
+	LOG_INFO("using file %s, raw=%d", op_file_path, op_file_raw);
+	return 0;
+}
+
+static void
+op_file_put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+
+static void
+op_file_put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = v >> 24;
+}
+
+static int
+op_file_start(struct sample_format *sf)
+{
+	sf->byte_order = BYTE_ORDER_LITTLE;
+
+	if (op_file_append) {
+		if (sf->encoding != op_file_format.encoding ||
+		    sf->nbits != op_file_format.nbits ||
+		    sf->nchannels != op_file_format.nchannels ||
+		    sf->rate != op_file_format.rate) {
+			LOG_ERRX("%s: sample format changed", op_file_path);
+			msg_errx("Cannot change sample format of %s",
+			    op_file_path);
+			return -1;
+		}
+
+		if ((op_file_fp = fopen(op_file_path, "r+")) == NULL) {
+			LOG_ERR("fopen: %s", op_file_path);
+			msg_err("Cannot open %s", op_file_path);
+			return -1;
+		}
+
+		if (fseek(op_file_fp, 0, SEEK_END) == -1) {
+			LOG_ERR("fseek: %s", op_file_path);
+			msg_err("Cannot seek in %s", op_file_path);
+			fclose(op_file_fp);
+			return -1;
+		}
+
+		return 0;
+	}
+
+	if ((op_file_fp = fopen(op_file_path, "w")) == NULL) {
+		LOG_ERR("fopen: %s", op_file_path);
+		msg_err("Cannot open %s", op_file_path);
+		return -1;
+	}
+
+	op_file_format = *sf;
+	op_file_size = 0;
+
+	/* Write a provisional header. It is completed when stopping. */
+	if (!op_file_raw && op_file_write_header() == -1) {
+		fclose(op_file_fp);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+op_file_stop(void)
+{
+	int ret;
+
+	ret = 0;
+	if (!op_file_raw) {
+		if (fseek(op_file_fp, 0, SEEK_SET) == -1) {
+			LOG_ERR("fseek: %s", op_file_path);
+			msg_err("Cannot write header to %s", op_file_path);
+			ret = -1;
+		} else
+			ret = op_file_write_header();
+	}
+
+	if (fclose(op_file_fp) == EOF) {
+		LOG_ERR("fclose: %s", op_file_path);
+		msg_err("Cannot close %s", op_file_path);
+		ret = -1;
+	}
+
+	if (ret == 0)
+		op_file_append = 1;
+
+	return ret;
+}
+
+static int
+op_file_write(struct sample_buffer *sb)
+{
+	if (fwrite(sb->data, 1, sb->len_b, op_file_fp) != sb->len_b) {
+		LOG_ERR("fwrite: %s", op_file_path);
+		msg_err("Cannot write to %s", op_file_path);
+		return -1;
+	}
+
+	op_file_size += sb->len_b;
+	return 0;
+}
+
+/*
+ * Write the WAVE header for the samples written so far. The sizes in the
+ * header are limited to 32 bits, so larger files are truncated as far as the
+ * header is concerned.
+ */
+static int
+op_file_write_header(void)
+{
+	uint32_t	size;
+	unsigned int	framesize, samplesize;
+	uint8_t		hdr[OP_FILE_HEADER_SIZE];
+
+	if (op_file_size > UINT32_MAX - (OP_FILE_HEADER_SIZE - 8))
+		size = UINT32_MAX - (OP_FILE_HEADER_SIZE - 8);
+	else
+		size = op_file_size;
+
+	samplesize = sample_encoding_size(op_file_format.encoding);
+	framesize = op_file_format.nchannels * samplesize;
+
+	memcpy(hdr, "RIFF", 4);
+	op_file_put32(hdr + 4, size + OP_FILE_HEADER_SIZE - 8);
+	memcpy(hdr + 8, "WAVE", 4);
+
+	memcpy(hdr + 12, "fmt ", 4);
+	op_file_put32(hdr + 16, 16);
+	op_file_put16(hdr + 20,
+	    op_file_format.encoding == SAMPLE_ENCODING_FLOAT ?
+	    OP_FILE_WAVE_FLOAT : OP_FILE_WAVE_PCM);
+	op_file_put16(hdr + 22, op_file_format.nchannels);
+	op_file_put32(hdr + 24, op_file_format.rate);
+	op_file_put32(hdr + 28, op_file_format.rate * framesize);
+	op_file_put16(hdr + 32, framesize);
+	op_file_put16(hdr + 34, samplesize * 8);
+
+	memcpy(hdr + 36, "data", 4);
+	op_file_put32(hdr + 40, size);
+
+	if (fwrite(hdr, 1, sizeof hdr, op_file_fp) != sizeof hdr) {
+		LOG_ERR("fwrite: %s", op_file_path);
+		msg_err("Cannot write header to %s", op_file_path);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2016 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The null output plug-in discards all samples. By default, it does so as
+ * fast as it is given them. In real-time mode, it plays them to a simulated
+ * clock instead, as if it were an audio device with a buffer of
+ * null-buffer-size bytes.
+ */
+
+#include "../config.h"
+
+#include <limits.h>
+#include <time.h>
+
+#include "../siren.h"
+
+#define OP_NULL_BUFSIZE	4096
+
+static void		 op_null_close(void);
+static int		 op_null_drop(void);
+static unsigned long long op_null_elapsed(void);
+static size_t		 op_null_get_buffer_size(void);
+static int		 op_null_get_caps(struct sample_caps *);
+static int		 op_null_get_delay(unsigned int *);
+static int		 op_null_get_volume_support(void);
+static int		 op_null_init(void);
+static long long	 op_null_now(void);
+static int		 op_null_open(void);
+static int		 op_null_pause(int);
+static int		 op_null_set_rate(unsigned int);
+static int		 op_null_start(struct sample_format *);
+static int		 op_null_stop(void);
+static int		 op_null_write(struct sample_buffer *);
+
+const struct op		 op = {
+	"null",
+	OP_PRIORITY_NULL,
+	NULL,
+	NULL,
+	op_null_close,
+	NULL,
+	op_null_drop,
+	op_null_get_buffer_size,
+	op_null_get_caps,
+	op_null_get_delay,
+	NULL,
+	op_null_get_volume_support,
+	op_null_init,
+	op_null_open,
+	op_null_pause,
+	op_null_set_rate,
+	NULL,
+	NULL,
+	op_null_start,
+	op_null_stop,
+	op_null_write
+};
+
+/*
+ * The simulated clock started at op_null_start_time and has been paused
+ * since op_null_pause_time if op_null_paused is set. Times are in
+ * microseconds.
+ */
+static int		 op_null_realtime;
+static int		 op_null_paused;
+static long long	 op_null_start_time;
+static long long	 op_null_pause_time;
+static unsigned long long op_null_frames;
+static size_t		 op_null_framesize;
+static unsigned int	 op_null_rate;
+
+static void
+op_null_close(void)
+{
+}
+
+static int
+op_null_drop(void)
+{
+	op_null_start_time = op_null_now();
+	op_null_frames = 0;
+	op_null_paused = 0;
+	return 0;
+}
+
+/*
+ * Return the number of frames the simulated clock has played.
+ */
+static unsigned long long
+op_null_elapsed(void)
+{
+	long long now;
+
+	now = op_null_paused ? op_null_pause_time : op_null_now();
+	return (now - op_null_start_time) * op_null_rate / 1000000;
+}
+
+/* Return the buffer size in bytes. */
+static size_t
+op_null_get_buffer_size(void)
+{
+	return option_get_number("null-buffer-size");
+}
+
+static int
+op_null_get_caps(struct sample_caps *caps)
+{
+	/* Accept every format so that the samples are never converted. */
+	caps->encodings = SAMPLE_ENCODING_S8 | SAMPLE_ENCODING_S16 |
+	    SAMPLE_ENCODING_S24 | SAMPLE_ENCODING_S24_3 | SAMPLE_ENCODING_S32 |
+	    SAMPLE_ENCODING_FLOAT;
+	caps->minchannels = 1;
+	caps->maxchannels = 0;
+	caps->minrate = 1;
+	caps->maxrate = 0;
+	return 0;
+}
+
+static int
+op_null_get_delay(unsigned int *delay)
+{
+	unsigned long long elapsed;
+
+	if (!op_null_realtime) {
+		*delay = 0;
+		return 0;
+	}
+
+	elapsed = op_null_elapsed();
+	*delay = op_null_frames > elapsed ? op_null_frames - elapsed : 0;
+	return 0;
+}
+
+static int
+op_null_get_volume_support(void)
+{
+	return 0;
+}
+
+static int
+op_null_init(void)
+{
+	option_add_number("null-buffer-size", OP_NULL_BUFSIZE, 1, INT_MAX,
+	    player_reopen_op);
+	option_add_boolean("null-realtime", 0, player_reopen_op);
+	return 0;
+}
+
+static long long
+op_null_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int
+op_null_open(void)
+{
+	op_null_realtime = option_get_boolean("null-realtime");
+	LOG_INFO("realtime=%d", op_null_realtime);
+	return 0;
+}
+
+static int
+op_null_pause(int pause)
+{
+	if (pause && !op_null_paused) {
+		op_null_pause_time = op_null_now();
+		op_null_paused = 1;
+	} else if (!pause && op_null_paused) {
+		op_null_start_time += op_null_now() - op_null_pause_time;
+		op_null_paused = 0;
+	}
+	return 0;
+}
+
+static int
+op_null_set_rate(unsigned int rate)
+{
+	op_null_rate = rate;
+	return op_null_drop();
+}
+
+static int
+op_null_start(struct sample_format *sf)
+{
+	op_null_framesize = sf->nchannels * sample_encoding_size(sf->encoding);
+	sf->byte_order = player_get_byte_order();
+	return op_null_set_rate(sf->rate);
+}
+
+static int
+op_null_stop(void)
+{
+	return 0;
+}
+
+static int
+op_null_write(struct sample_buffer *sb)
+{
+	struct timespec		ts;
+	unsigned long long	bufsize, elapsed, excess, usecs;
+
+	op_null_frames += sb->len_b / op_null_framesize;
+	if (!op_null_realtime)
+		return 0;
+
+	/*
+	 * Wait until the frames that do not fit in the simulated buffer have
+	 * been played.
+	 */
+	bufsize = op_null_get_buffer_size() / op_null_framesize;
+	elapsed = op_null_elapsed();
+	if (op_null_frames <= elapsed + bufsize)
+		return 0;
+
+	excess = op_null_frames - elapsed - bufsize;
+	usecs = excess * 1000000 / op_null_rate;
+	ts.tv_sec = usecs / 1000000;
+	ts.tv_nsec = usecs % 1000000 * 1000;
+	nanosleep(&ts, NULL);
+	return 0;
+}
@@ -35,14 +35,23 @@
 #define OP_OSS_HAVE_VOLUME_SUPPORT
 #endif
 
+/* OSS 4 renamed SNDCTL_DSP_RESET to SNDCTL_DSP_HALT. */
+#ifndef SNDCTL_DSP_HALT
+#define SNDCTL_DSP_HALT	SNDCTL_DSP_RESET
+#endif
+
 #define OP_OSS_BUFSIZE	4096
 #define OP_OSS_DEVICE	"/dev/dsp"
 
 static void		 op_oss_close(void);
+static int		 op_oss_drop(void);
 static size_t		 op_oss_get_buffer_size(void);
+static int		 op_oss_get_caps(struct sample_caps *);
+static int		 op_oss_get_delay(unsigned int *);
 static int		 op_oss_get_volume_support(void);
 static int		 op_oss_init(void);
 static int		 op_oss_open(void);
+static int		 op_oss_set_rate(unsigned int);
 static int		 op_oss_start(struct sample_format *);
 static int		 op_oss_stop(void);
 static int		 op_oss_write(struct sample_buffer *);
@@ -55,8 +64,13 @@ struct op		 op = {
 	"oss",
 	OP_PRIORITY_OSS,
 	NULL,
+	NULL,
 	op_oss_close,
+	NULL,
+	op_oss_drop,
 	op_oss_get_buffer_size,
+	op_oss_get_caps,
+	op_oss_get_delay,
 #ifdef OP_OSS_HAVE_VOLUME_SUPPORT
 	op_oss_get_volume,
 #else
@@ -65,11 +79,14 @@ struct op		 op = {
 	op_oss_get_volume_support,
 	op_oss_init,
 	op_oss_open,
+	NULL,
+	op_oss_set_rate,
 #ifdef OP_OSS_HAVE_VOLUME_SUPPORT
 	op_oss_set_volume,
 #else
 	NULL,
 #endif
+	NULL,
 	op_oss_start,
 	op_oss_stop,
 	op_oss_write
@@ -77,6 +94,7 @@ struct op		 op = {
 
 static size_t		 op_oss_buffer_size;
 static int		 op_oss_fd;
+static int		 op_oss_framesize;
 static char		*op_oss_device;
 #ifdef OP_OSS_HAVE_VOLUME_SUPPORT
 static int		 op_oss_volume;
@@ -88,6 +106,17 @@ op_oss_close(void)
 	free(op_oss_device);
 }
 
+static int
+op_oss_drop(void)
+{
+	if (ioctl(op_oss_fd, SNDCTL_DSP_HALT, NULL) == -1) {
+		LOG_ERR("ioctl: SNDCTL_DSP_HALT");
+		msg_err("Cannot stop playback");
+		return -1;
+	}
+	return 0;
+}
+
 /* Return the buffer size in bytes. */
 static size_t
 op_oss_get_buffer_size(void)
@@ -95,6 +124,35 @@ op_oss_get_buffer_size(void)
 	return op_oss_buffer_size;
 }
 
+static int
+op_oss_get_caps(struct sample_caps *caps)
+{
+	caps->encodings = SAMPLE_ENCODING_S8 | SAMPLE_ENCODING_S16;
+#ifdef AFMT_S32_NE
+	caps->encodings |= SAMPLE_ENCODING_S32;
+#endif
+	return 0;
+}
+
+/* Get the number of frames that have been written but not yet played. */
+static int
+op_oss_get_delay(unsigned int *delay)
+{
+#ifdef SNDCTL_DSP_GETODELAY
+	int bytes;
+
+	if (ioctl(op_oss_fd, SNDCTL_DSP_GETODELAY, &bytes) == -1) {
+		LOG_ERR("ioctl: SNDCTL_DSP_GETODELAY");
+		return -1;
+	}
+
+	*delay = bytes > 0 ? bytes / op_oss_framesize : 0;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
 #ifdef OP_OSS_HAVE_VOLUME_SUPPORT
 static int
 op_oss_get_volume(void)
@@ -161,6 +219,38 @@ op_oss_open(void)
 	return 0;
 }
 
+static int
+op_oss_set_rate(unsigned int rate)
+{
+	int arg;
+
+	/* Wait until all samples have been played. */
+	if (ioctl(op_oss_fd, SNDCTL_DSP_SYNC, NULL) == -1) {
+		LOG_ERR("ioctl: SNDCTL_DSP_SYNC");
+		return -1;
+	}
+
+	arg = rate;
+	if (ioctl(op_oss_fd, SNDCTL_DSP_SPEED, &arg) == -1) {
+		LOG_ERR("ioctl: SNDCTL_DSP_SPEED");
+		return -1;
+	}
+	/* Allow a 0.5% deviation in the sampling rate. */
+	if ((unsigned int)arg < rate * 995 / 1000 ||
+	    (unsigned int)arg > rate * 1005 / 1000) {
+		LOG_ERRX("sampling rate (%u Hz) not supported", rate);
+		return -1;
+	}
+
+	if (ioctl(op_oss_fd, SNDCTL_DSP_GETBLKSIZE, &arg) == -1) {
+		LOG_ERR("ioctl: SNDCTL_DSP_GETBLKSIZE");
+		op_oss_buffer_size = OP_OSS_BUFSIZE;
+	} else
+		op_oss_buffer_size = arg;
+
+	return 0;
+}
+
 #ifdef OP_OSS_HAVE_VOLUME_SUPPORT
 static void
 op_oss_set_volume(unsigned int volume)
@@ -211,10 +301,10 @@ op_oss_start(struct sample_format *sf)
 		goto error;
 	}
 
-	/* Set format. */
-	if (sf->nbits <= 8)
+	/* Set format. The player only uses the encodings we support. */
+	if (sf->encoding == SAMPLE_ENCODING_S8)
 		arg = AFMT_S8;
-	else if (sf->nbits <= 16)
+	else if (sf->encoding == SAMPLE_ENCODING_S16)
 		arg = AFMT_S16_NE;
 	else {
 #ifdef AFMT_S32_NE
@@ -253,6 +343,8 @@ op_oss_start(struct sample_format *sf)
 		goto error;
 	}
 
+	op_oss_framesize = sf->nchannels * sample_encoding_size(sf->encoding);
+
 	/* Set byte order of sample format. */
 #if AFMT_S16_NE == AFMT_S16_BE
 	sf->byte_order = BYTE_ORDER_BIG;
@@ -37,13 +37,21 @@ const struct op	 op = {
 	"portaudio",
 	OP_PRIORITY_PORTAUDIO,
 	NULL,
+	NULL,
 	op_portaudio_close,
+	NULL,
+	NULL,
 	op_portaudio_get_buffer_size,
 	NULL,
+	NULL,
+	NULL,
 	op_portaudio_get_volume_support,
 	op_portaudio_init,
 	op_portaudio_open,
 	NULL,
+	NULL,
+	NULL,
+	NULL,
 	op_portaudio_start,
 	op_portaudio_stop,
 	op_portaudio_write
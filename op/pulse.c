@@ -17,44 +17,109 @@
 #include "../config.h"
 
 #include <limits.h>
+#include <stdint.h>
 
-#include <pulse/error.h>
-#include <pulse/simple.h>
+#include <pulse/pulseaudio.h>
 
 #include "../siren.h"
 
-#define OP_PULSE_BUFSIZE 4096
+#define OP_PULSE_BUFSIZE	4096
+#define OP_PULSE_MINREQ		0
+#define OP_PULSE_TLENGTH	0
 
 static void		 op_pulse_close(void);
+static void		 op_pulse_context_state_cb(pa_context *, void *);
+static int		 op_pulse_drop(void);
 static size_t		 op_pulse_get_buffer_size(void);
+static int		 op_pulse_get_caps(struct sample_caps *);
+static int		 op_pulse_get_delay(unsigned int *);
 static int		 op_pulse_get_volume_support(void);
 static int		 op_pulse_init(void);
 static int		 op_pulse_open(void);
+static int		 op_pulse_pause(int);
 static int		 op_pulse_start(struct sample_format *);
 static int		 op_pulse_stop(void);
+static void		 op_pulse_stream_state_cb(pa_stream *, void *);
+static void		 op_pulse_stream_success_cb(pa_stream *, int, void *);
+static void		 op_pulse_stream_write_cb(pa_stream *, size_t, void *);
+static int		 op_pulse_wait_operation(pa_operation *);
 static int		 op_pulse_write(struct sample_buffer *);
 
 const struct op		 op = {
 	"pulse",
 	OP_PRIORITY_PULSE,
 	"ps proc",
+	NULL,
 	op_pulse_close,
+	NULL,
+	op_pulse_drop,
 	op_pulse_get_buffer_size,
+	op_pulse_get_caps,
+	op_pulse_get_delay,
 	NULL,
 	op_pulse_get_volume_support,
 	op_pulse_init,
 	op_pulse_open,
+	op_pulse_pause,
+	NULL,
+	NULL,
 	NULL,
 	op_pulse_start,
 	op_pulse_stop,
 	op_pulse_write
 };
 
-static pa_simple	*op_pulse_conn;
+/*
+ * The callbacks run in the thread of the threaded main loop. Everything else
+ * accesses the context and the stream with the main loop locked, and waits
+ * for the callbacks to signal the main loop.
+ */
+static pa_threaded_mainloop	*op_pulse_mainloop;
+static pa_context		*op_pulse_context;
+static pa_stream		*op_pulse_stream;
 
 static void
 op_pulse_close(void)
 {
+	pa_threaded_mainloop_lock(op_pulse_mainloop);
+	pa_context_disconnect(op_pulse_context);
+	pa_threaded_mainloop_unlock(op_pulse_mainloop);
+
+	pa_threaded_mainloop_stop(op_pulse_mainloop);
+	pa_context_unref(op_pulse_context);
+	pa_threaded_mainloop_free(op_pulse_mainloop);
+}
+
+static void
+op_pulse_context_state_cb(UNUSED pa_context *c, UNUSED void *p)
+{
+	pa_threaded_mainloop_signal(op_pulse_mainloop, 0);
+}
+
+/*
+ * Flush the stream. This also resumes a corked stream.
+ */
+static int
+op_pulse_drop(void)
+{
+	int ret;
+
+	pa_threaded_mainloop_lock(op_pulse_mainloop);
+
+	ret = op_pulse_wait_operation(pa_stream_flush(op_pulse_stream,
+	    op_pulse_stream_success_cb, NULL));
+	if (ret == 0 && pa_stream_is_corked(op_pulse_stream) == 1)
+		ret = op_pulse_wait_operation(pa_stream_cork(op_pulse_stream, 0,
+		    op_pulse_stream_success_cb, NULL));
+	if (ret == -1) {
+		LOG_ERRX("pa_stream_flush: %s",
+		    pa_strerror(pa_context_errno(op_pulse_context)));
+		msg_errx("Cannot stop playback: %s",
+		    pa_strerror(pa_context_errno(op_pulse_context)));
+	}
+
+	pa_threaded_mainloop_unlock(op_pulse_mainloop);
+	return ret;
 }
 
 /* Return the buffer size in bytes. */
@@ -64,6 +129,46 @@ op_pulse_get_buffer_size(void)
 	return option_get_number("pulse-buffer-size");
 }
 
+static int
+op_pulse_get_caps(struct sample_caps *caps)
+{
+	/* PulseAudio does not support signed 8-bit samples. */
+	caps->encodings = SAMPLE_ENCODING_S16 | SAMPLE_ENCODING_S24 |
+	    SAMPLE_ENCODING_S24_3 | SAMPLE_ENCODING_S32 | SAMPLE_ENCODING_FLOAT;
+	caps->minchannels = 1;
+	caps->maxchannels = PA_CHANNELS_MAX;
+	caps->minrate = 1;
+	caps->maxrate = PA_RATE_MAX;
+	return 0;
+}
+
+/*
+ * Get the number of frames that have been written but not yet played. The
+ * latency is interpolated from the timing information the server sends.
+ */
+static int
+op_pulse_get_delay(unsigned int *delay)
+{
+	const pa_sample_spec	*spec;
+	pa_usec_t		 usecs;
+	int			 negative, ret;
+
+	pa_threaded_mainloop_lock(op_pulse_mainloop);
+	ret = pa_stream_get_latency(op_pulse_stream, &usecs, &negative);
+	spec = pa_stream_get_sample_spec(op_pulse_stream);
+	pa_threaded_mainloop_unlock(op_pulse_mainloop);
+
+	/* No timing information may have been received yet. */
+	if (ret < 0)
+		return -1;
+
+	if (negative)
+		*delay = 0;
+	else
+		*delay = usecs * spec->rate / 1000000;
+	return 0;
+}
+
 static int
 op_pulse_get_volume_support(void)
 {
@@ -75,76 +180,301 @@ op_pulse_init(void)
 {
 	option_add_number("pulse-buffer-size", OP_PULSE_BUFSIZE, 1, INT_MAX,
 	    player_reopen_op);
+	option_add_number("pulse-minreq", OP_PULSE_MINREQ, 0, 1000,
+	    player_reopen_op);
+	option_add_number("pulse-tlength", OP_PULSE_TLENGTH, 0, 10000,
+	    player_reopen_op);
 	return 0;
 }
 
 static int
 op_pulse_open(void)
 {
+	pa_context_state_t state;
+
+	if ((op_pulse_mainloop = pa_threaded_mainloop_new()) == NULL) {
+		LOG_ERRX("pa_threaded_mainloop_new() failed");
+		msg_errx("Cannot create main loop");
+		return -1;
+	}
+
+	op_pulse_context = pa_context_new(
+	    pa_threaded_mainloop_get_api(op_pulse_mainloop), "Siren");
+	if (op_pulse_context == NULL) {
+		LOG_ERRX("pa_context_new() failed");
+		msg_errx("Cannot create context");
+		goto error1;
+	}
+
+	pa_context_set_state_callback(op_pulse_context,
+	    op_pulse_context_state_cb, NULL);
+
+	pa_threaded_mainloop_lock(op_pulse_mainloop);
+
+	if (pa_threaded_mainloop_start(op_pulse_mainloop) < 0) {
+		LOG_ERRX("pa_threaded_mainloop_start() failed");
+		msg_errx("Cannot start main loop");
+		pa_threaded_mainloop_unlock(op_pulse_mainloop);
+		goto error2;
+	}
+
+	if (pa_context_connect(op_pulse_context, NULL, PA_CONTEXT_NOFLAGS,
+	    NULL) < 0)
+		goto error3;
+
+	for (;;) {
+		state = pa_context_get_state(op_pulse_context);
+		if (state == PA_CONTEXT_READY)
+			break;
+		if (!PA_CONTEXT_IS_GOOD(state))
+			goto error3;
+		pa_threaded_mainloop_wait(op_pulse_mainloop);
+	}
+
+	pa_threaded_mainloop_unlock(op_pulse_mainloop);
 	return 0;
+
+error3:
+	LOG_ERRX("pa_context_connect: %s",
+	    pa_strerror(pa_context_errno(op_pulse_context)));
+	msg_errx("Cannot connect to server: %s",
+	    pa_strerror(pa_context_errno(op_pulse_context)));
+	pa_threaded_mainloop_unlock(op_pulse_mainloop);
+	pa_threaded_mainloop_stop(op_pulse_mainloop);
+error2:
+	pa_context_unref(op_pulse_context);
+error1:
+	pa_threaded_mainloop_free(op_pulse_mainloop);
+	return -1;
+}
+
+/*
+ * Cork or uncork the stream. The server stops playing immediately.
+ */
+static int
+op_pulse_pause(int pause)
+{
+	int ret;
+
+	pa_threaded_mainloop_lock(op_pulse_mainloop);
+	ret = op_pulse_wait_operation(pa_stream_cork(op_pulse_stream, pause,
+	    op_pulse_stream_success_cb, NULL));
+	if (ret == -1)
+		LOG_ERRX("pa_stream_cork: %s",
+		    pa_strerror(pa_context_errno(op_pulse_context)));
+	pa_threaded_mainloop_unlock(op_pulse_mainloop);
+	return ret;
 }
 
 static int
 op_pulse_start(struct sample_format *sf)
 {
-	pa_sample_spec	spec;
-	int		error;
+	const pa_buffer_attr	*battr;
+	pa_buffer_attr		 attr;
+	pa_sample_spec		 spec;
+	pa_stream_state_t	 state;
+	unsigned int		 msecs;
 
-	if (sf->nbits <= 8) {
-		/* PulseAudio doesn't support signed 8-bit samples. */
-		LOG_ERRX("8 bits or less per sample not supported");
-		msg_errx("8 bits or less per sample not supported");
-		return -1;
-	} else if (sf->nbits <= 16)
+	switch (sf->encoding) {
+	case SAMPLE_ENCODING_S16:
 		spec.format = PA_SAMPLE_S16NE;
-	else if (sf->nbits <= 24)
+		break;
+	case SAMPLE_ENCODING_S24:
 		spec.format = PA_SAMPLE_S24_32NE;
-	else
+		break;
+	case SAMPLE_ENCODING_S24_3:
+		spec.format = PA_SAMPLE_S24NE;
+		break;
+	case SAMPLE_ENCODING_S32:
 		spec.format = PA_SAMPLE_S32NE;
+		break;
+	case SAMPLE_ENCODING_FLOAT:
+		spec.format = PA_SAMPLE_FLOAT32NE;
+		break;
+	default:
+		LOG_ERRX("8 bits or less per sample not supported");
+		msg_errx("8 bits or less per sample not supported");
+		return -1;
+	}
 
 	spec.channels = sf->nchannels;
 	spec.rate = sf->rate;
 
-	if ((op_pulse_conn = pa_simple_new(NULL, "Siren", PA_STREAM_PLAYBACK,
-	    NULL, "Siren", &spec, NULL, NULL, &error)) == NULL) {
-		LOG_ERRX("pa_simple_new: %s", pa_strerror(error));
-		msg_errx("Cannot connect to server: %s", pa_strerror(error));
-		return -1;
+	/*
+	 * Ask for the configured target length and minimum request, and let
+	 * the server choose everything else.
+	 */
+	attr.maxlength = UINT32_MAX;
+	attr.prebuf = UINT32_MAX;
+	attr.fragsize = UINT32_MAX;
+	msecs = option_get_number("pulse-tlength");
+	attr.tlength = msecs ? pa_usec_to_bytes(msecs * 1000ULL, &spec) :
+	    UINT32_MAX;
+	msecs = option_get_number("pulse-minreq");
+	attr.minreq = msecs ? pa_usec_to_bytes(msecs * 1000ULL, &spec) :
+	    UINT32_MAX;
+
+	pa_threaded_mainloop_lock(op_pulse_mainloop);
+
+	if (pa_context_get_state(op_pulse_context) != PA_CONTEXT_READY) {
+		LOG_ERRX("connection to server lost");
+		msg_errx("Connection to server lost");
+		goto error1;
 	}
 
-	sf->byte_order = player_get_byte_order();
+	op_pulse_stream = pa_stream_new(op_pulse_context, "Siren", &spec,
+	    NULL);
+	if (op_pulse_stream == NULL) {
+		LOG_ERRX("pa_stream_new: %s",
+		    pa_strerror(pa_context_errno(op_pulse_context)));
+		msg_errx("Cannot create stream: %s",
+		    pa_strerror(pa_context_errno(op_pulse_context)));
+		goto error1;
+	}
+
+	pa_stream_set_state_callback(op_pulse_stream, op_pulse_stream_state_cb,
+	    NULL);
+	pa_stream_set_write_callback(op_pulse_stream, op_pulse_stream_write_cb,
+	    NULL);
 
-	LOG_INFO("format=%s, rate=%u, channels=%u",
+	if (pa_stream_connect_playback(op_pulse_stream, NULL, &attr,
+	    PA_STREAM_ADJUST_LATENCY | PA_STREAM_AUTO_TIMING_UPDATE |
+	    PA_STREAM_INTERPOLATE_TIMING, NULL, NULL) < 0)
+		goto error2;
+
+	for (;;) {
+		state = pa_stream_get_state(op_pulse_stream);
+		if (state == PA_STREAM_READY)
+			break;
+		if (!PA_STREAM_IS_GOOD(state))
+			goto error2;
+		pa_threaded_mainloop_wait(op_pulse_mainloop);
+	}
+
+	battr = pa_stream_get_buffer_attr(op_pulse_stream);
+	LOG_INFO("format=%s, rate=%u, channels=%u, tlength=%u, minreq=%u",
 	    pa_sample_format_to_string(spec.format), spec.rate,
-	    spec.channels);
+	    spec.channels, battr->tlength, battr->minreq);
+
+	pa_threaded_mainloop_unlock(op_pulse_mainloop);
 
+	sf->byte_order = player_get_byte_order();
 	return 0;
+
+error2:
+	LOG_ERRX("pa_stream_connect_playback: %s",
+	    pa_strerror(pa_context_errno(op_pulse_context)));
+	msg_errx("Cannot start playback: %s",
+	    pa_strerror(pa_context_errno(op_pulse_context)));
+	pa_stream_unref(op_pulse_stream);
+	op_pulse_stream = NULL;
+error1:
+	pa_threaded_mainloop_unlock(op_pulse_mainloop);
+	return -1;
 }
 
 static int
 op_pulse_stop(void)
 {
-	int error;
+	int ret;
+
+	pa_threaded_mainloop_lock(op_pulse_mainloop);
 
-	error = 0;
-	if (pa_simple_drain(op_pulse_conn, &error) < 0) {
-		LOG_ERRX("pa_simple_drain: %s", pa_strerror(error));
-		msg_errx("%s", pa_strerror(error));
+	ret = op_pulse_wait_operation(pa_stream_drain(op_pulse_stream,
+	    op_pulse_stream_success_cb, NULL));
+	if (ret == -1) {
+		LOG_ERRX("pa_stream_drain: %s",
+		    pa_strerror(pa_context_errno(op_pulse_context)));
+		msg_errx("%s", pa_strerror(pa_context_errno(op_pulse_context)));
 	}
 
-	pa_simple_free(op_pulse_conn);
-	return error ? -1 : 0;
+	pa_stream_disconnect(op_pulse_stream);
+	pa_stream_unref(op_pulse_stream);
+	op_pulse_stream = NULL;
+
+	pa_threaded_mainloop_unlock(op_pulse_mainloop);
+	return ret;
+}
+
+static void
+op_pulse_stream_state_cb(UNUSED pa_stream *s, UNUSED void *p)
+{
+	pa_threaded_mainloop_signal(op_pulse_mainloop, 0);
 }
 
+static void
+op_pulse_stream_success_cb(UNUSED pa_stream *s, UNUSED int success,
+    UNUSED void *p)
+{
+	pa_threaded_mainloop_signal(op_pulse_mainloop, 0);
+}
+
+static void
+op_pulse_stream_write_cb(UNUSED pa_stream *s, UNUSED size_t len,
+    UNUSED void *p)
+{
+	pa_threaded_mainloop_signal(op_pulse_mainloop, 0);
+}
+
+/*
+ * Wait for an operation to complete and release it. The main loop must be
+ * locked before calling this function.
+ */
 static int
-op_pulse_write(struct sample_buffer *sb)
+op_pulse_wait_operation(pa_operation *o)
 {
-	int error;
+	pa_operation_state_t state;
 
-	if (pa_simple_write(op_pulse_conn, sb->data, sb->len_b, &error) < 0) {
-		LOG_ERRX("pa_simple_write: %s", pa_strerror(error));
-		msg_errx("Playback error: %s", pa_strerror(error));
+	if (o == NULL)
 		return -1;
+
+	while ((state = pa_operation_get_state(o)) == PA_OPERATION_RUNNING)
+		pa_threaded_mainloop_wait(op_pulse_mainloop);
+
+	pa_operation_unref(o);
+	return state == PA_OPERATION_DONE ? 0 : -1;
+}
+
+/*
+ * Write the samples as soon as the server has room for them. Unlike
+ * pa_simple_write(), pa_stream_write() does not wait for the server.
+ */
+static int
+op_pulse_write(struct sample_buffer *sb)
+{
+	const char	*data;
+	size_t		 len, n;
+
+	data = sb->data;
+	len = sb->len_b;
+
+	pa_threaded_mainloop_lock(op_pulse_mainloop);
+
+	while (len > 0) {
+		while ((n = pa_stream_writable_size(op_pulse_stream)) == 0)
+			pa_threaded_mainloop_wait(op_pulse_mainloop);
+
+		if (n == (size_t)-1)
+			goto error;
+		if (n > len)
+			n = len;
+
+		if (pa_stream_write(op_pulse_stream, data, n, NULL, 0,
+		    PA_SEEK_RELATIVE) < 0)
+			goto error;
+
+		data += n;
+		len -= n;
 	}
+
+	pa_threaded_mainloop_unlock(op_pulse_mainloop);
 	return 0;
+
+error:
+	LOG_ERRX("pa_stream_write: %s",
+	    pa_strerror(pa_context_errno(op_pulse_context)));
+	msg_errx("Playback error: %s",
+	    pa_strerror(pa_context_errno(op_pulse_context)));
+	pa_threaded_mainloop_unlock(op_pulse_mainloop);
+	return -1;
 }
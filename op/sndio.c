@@ -26,12 +26,17 @@
 	((100 * (v) + ((SIO_MAXVOL + 1) / 2)) / SIO_MAXVOL)
 
 static void		 op_sndio_close(void);
+#ifdef HAVE_SIO_FLUSH
+static int		 op_sndio_drop(void);
+#endif
 static size_t		 op_sndio_get_buffer_size(void);
 static int		 op_sndio_get_volume(void);
 static int		 op_sndio_get_volume_support(void);
 static int		 op_sndio_init(void);
 static int		 op_sndio_open(void);
+static int		 op_sndio_set_rate(unsigned int);
 static void		 op_sndio_set_volume(unsigned int);
+static void		 op_sndio_set_volume_handler(void (*)(int));
 static int		 op_sndio_start(struct sample_format *);
 static int		 op_sndio_stop(void);
 static void		 op_sndio_volume_cb(void *, unsigned int);
@@ -41,13 +46,25 @@ struct op		 op = {
 	"sndio",
 	OP_PRIORITY_SNDIO,
 	"inet unix dns audio",
+	NULL,
 	op_sndio_close,
+	NULL,
+#ifdef HAVE_SIO_FLUSH
+	op_sndio_drop,
+#else
+	NULL,
+#endif
 	op_sndio_get_buffer_size,
+	NULL,
+	NULL,
 	op_sndio_get_volume,
 	op_sndio_get_volume_support,
 	op_sndio_init,
 	op_sndio_open,
+	NULL,
+	op_sndio_set_rate,
 	op_sndio_set_volume,
+	op_sndio_set_volume_handler,
 	op_sndio_start,
 	op_sndio_stop,
 	op_sndio_write
@@ -57,6 +74,7 @@ static struct sio_hdl	*op_sndio_handle;
 static struct sio_par	 op_sndio_par;
 static unsigned int	 op_sndio_volume;
 static int		 op_sndio_volume_support;
+static void		 (*op_sndio_volume_handler)(int);
 
 static void
 op_sndio_close(void)
@@ -64,6 +82,32 @@ op_sndio_close(void)
 	sio_close(op_sndio_handle);
 }
 
+#ifdef HAVE_SIO_FLUSH
+/*
+ * Stop the stream without playing the buffered samples and start it again,
+ * so that it is ready for the samples of the next track. Unlike sio_flush(),
+ * sio_stop() waits until the buffered samples have been played, so without
+ * sio_flush() samples cannot be dropped.
+ */
+static int
+op_sndio_drop(void)
+{
+	if (!sio_flush(op_sndio_handle)) {
+		LOG_ERRX("sio_flush() failed");
+		msg_errx("Cannot flush stream");
+		return -1;
+	}
+
+	if (!sio_start(op_sndio_handle)) {
+		LOG_ERRX("sio_start() failed");
+		msg_errx("Cannot start stream");
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
 /* Return the buffer size in bytes. */
 static size_t
 op_sndio_get_buffer_size(void)
@@ -119,6 +163,50 @@ op_sndio_open(void)
 	return 0;
 }
 
+static int
+op_sndio_set_rate(unsigned int rate)
+{
+	struct sio_par par;
+
+	/* This waits until all samples have been played. */
+	if (!sio_stop(op_sndio_handle)) {
+		LOG_ERRX("sio_stop() failed");
+		return -1;
+	}
+
+	sio_initpar(&par);
+	par.bits = op_sndio_par.bits;
+	par.pchan = op_sndio_par.pchan;
+	par.rate = rate;
+	par.sig = op_sndio_par.sig;
+
+	if (!sio_setpar(op_sndio_handle, &par)) {
+		LOG_ERRX("sio_setpar() failed");
+		return -1;
+	}
+
+	if (!sio_getpar(op_sndio_handle, &par)) {
+		LOG_ERRX("sio_getpar() failed");
+		return -1;
+	}
+
+	/* Allow a 0.5% deviation in the sampling rate. */
+	if (par.bits != op_sndio_par.bits || par.pchan != op_sndio_par.pchan ||
+	    par.rate < rate * 995 / 1000 || par.rate > rate * 1005 / 1000) {
+		LOG_ERRX("cannot set sampling rate");
+		return -1;
+	}
+
+	op_sndio_par = par;
+
+	if (!sio_start(op_sndio_handle)) {
+		LOG_ERRX("sio_start() failed");
+		return -1;
+	}
+
+	return 0;
+}
+
 static void
 op_sndio_set_volume(unsigned int volume)
 {
@@ -128,6 +216,12 @@ op_sndio_set_volume(unsigned int volume)
 	}
 }
 
+static void
+op_sndio_set_volume_handler(void (*handler)(int))
+{
+	op_sndio_volume_handler = handler;
+}
+
 static int
 op_sndio_start(struct sample_format *sf)
 {
@@ -196,8 +290,11 @@ op_sndio_stop(void)
 static void
 op_sndio_volume_cb(UNUSED void *p, unsigned int volume)
 {
-	if (volume != OP_SNDIO_PERCENT_TO_VOLUME(op_sndio_volume))
+	if (volume != OP_SNDIO_PERCENT_TO_VOLUME(op_sndio_volume)) {
 		op_sndio_volume = OP_SNDIO_VOLUME_TO_PERCENT(volume);
+		if (op_sndio_volume_handler != NULL)
+			op_sndio_volume_handler(op_sndio_volume);
+	}
 }
 
 static int
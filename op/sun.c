@@ -44,11 +44,16 @@
 	(((AUDIO_MAX_GAIN - AUDIO_MIN_GAIN) * (percent) + 50) / 100)
 
 static void		 op_sun_close(void);
+#ifdef AUDIO_FLUSH
+static int		 op_sun_drop(void);
+#endif
 static size_t		 op_sun_get_buffer_size(void);
 static int		 op_sun_get_volume(void);
 static int		 op_sun_get_volume_support(void);
 static int		 op_sun_init(void);
 static int		 op_sun_open(void);
+static int		 op_sun_pause(int);
+static int		 op_sun_set_rate(unsigned int);
 static void		 op_sun_set_volume(unsigned int);
 static int		 op_sun_start(struct sample_format *);
 static int		 op_sun_stop(void);
@@ -58,13 +63,25 @@ struct op		 op = {
 	"sun",
 	OP_PRIORITY_SUN,
 	NULL,
+	NULL,
 	op_sun_close,
+	NULL,
+#ifdef AUDIO_FLUSH
+	op_sun_drop,
+#else
+	NULL,
+#endif
 	op_sun_get_buffer_size,
+	NULL,
+	NULL,
 	op_sun_get_volume,
 	op_sun_get_volume_support,
 	op_sun_init,
 	op_sun_open,
+	op_sun_pause,
+	op_sun_set_rate,
 	op_sun_set_volume,
+	NULL,
 	op_sun_start,
 	op_sun_stop,
 	op_sun_write
@@ -80,6 +97,28 @@ op_sun_close(void)
 	free(op_sun_device);
 }
 
+#ifdef AUDIO_FLUSH
+static int
+op_sun_drop(void)
+{
+	audio_info_t info;
+
+	if (ioctl(op_sun_fd, AUDIO_FLUSH) == -1) {
+		LOG_ERR("ioctl: AUDIO_FLUSH");
+		msg_err("Cannot flush audio buffer");
+		return -1;
+	}
+
+	/* Resume playback in case it was paused. */
+	AUDIO_INITINFO(&info);
+	info.play.pause = 0;
+	if (ioctl(op_sun_fd, AUDIO_SETINFO, &info) == -1)
+		LOG_ERR("ioctl: AUDIO_SETINFO");
+
+	return 0;
+}
+#endif
+
 /* Return the buffer size in bytes. */
 static size_t
 op_sun_get_buffer_size(void)
@@ -145,6 +184,21 @@ op_sun_open(void)
 	return 0;
 }
 
+static int
+op_sun_pause(int pause)
+{
+	audio_info_t info;
+
+	AUDIO_INITINFO(&info);
+	info.play.pause = pause;
+	if (ioctl(op_sun_fd, AUDIO_SETINFO, &info) == -1) {
+		LOG_ERR("ioctl: AUDIO_SETINFO");
+		return -1;
+	}
+
+	return 0;
+}
+
 static void
 op_sun_set_volume(unsigned int volume)
 {
@@ -165,6 +219,40 @@ op_sun_set_volume(unsigned int volume)
 	}
 }
 
+static int
+op_sun_set_rate(unsigned int rate)
+{
+	audio_info_t info;
+
+	/* Wait until all samples have been played. */
+	if (ioctl(op_sun_fd, AUDIO_DRAIN) == -1) {
+		LOG_ERR("ioctl: AUDIO_DRAIN");
+		return -1;
+	}
+
+	AUDIO_INITINFO(&info);
+	info.play.sample_rate = rate;
+
+	if (ioctl(op_sun_fd, AUDIO_SETINFO, &info) == -1) {
+		LOG_ERR("ioctl: AUDIO_SETINFO");
+		return -1;
+	}
+
+	if (ioctl(op_sun_fd, AUDIO_GETINFO, &info) == -1) {
+		LOG_ERR("ioctl: AUDIO_GETINFO");
+		return -1;
+	}
+
+	/* Allow a 0.5% deviation in the sampling rate. */
+	if (info.play.sample_rate < rate * 995 / 1000 ||
+	    info.play.sample_rate > rate * 1005 / 1000) {
+		LOG_ERRX("sampling rate (%u Hz) not supported", rate);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int
 op_sun_start(struct sample_format *sf)
 {
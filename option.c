@@ -18,6 +18,7 @@
 
 #include <limits.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
@@ -31,12 +32,17 @@
  */
 #define OPTION_ATTRIB_MAXLEN 42
 
+/*
+ * Boolean and number values are atomic so that they can be read through a
+ * handle without locking the option tree. They are still only changed with
+ * the option tree locked.
+ */
 struct option_entry {
 	char			*name;
 	enum option_type	 type;
 	union {
 		struct {
-			int		 cur;
+			atomic_int	 cur;
 			int		 min;
 			int		 max;
 		} number;
@@ -44,7 +50,7 @@ struct option_entry {
 		struct format		*format;
 		int			 colour;
 		int			 attrib;
-		int			 boolean;
+		atomic_int		 boolean;
 		char			*string;
 	} value;
 	void			 (*callback)(void);
@@ -119,7 +125,7 @@ option_add_attrib(const char *name, int value)
 	option_insert_entry(o);
 }
 
-static void
+void
 option_add_boolean(const char *name, int value, void (*callback)(void))
 {
 	struct option_entry *o;
@@ -361,6 +367,21 @@ option_get_format(const char *name)
 	return format;
 }
 
+/*
+ * Look up an option once and return a handle to it. The handle remains valid
+ * until option_end() is called.
+ */
+struct option_entry *
+option_get_handle(const char *name, enum option_type type)
+{
+	struct option_entry *o;
+
+	XPTHREAD_MUTEX_LOCK(&option_tree_mtx);
+	o = option_find_type(name, type);
+	XPTHREAD_MUTEX_UNLOCK(&option_tree_mtx);
+	return o;
+}
+
 int
 option_get_number(const char *name)
 {
@@ -416,18 +437,45 @@ option_get_type(const char *name, enum option_type *type)
 	return ret;
 }
 
+/*
+ * Read the value of a Boolean option through a handle returned by
+ * option_get_handle(). This function does not lock the option tree.
+ */
+int
+option_handle_get_boolean(struct option_entry *o)
+{
+	return atomic_load(&o->value.boolean);
+}
+
+/*
+ * Read the value of a number option through a handle returned by
+ * option_get_handle(). This function does not lock the option tree.
+ */
+int
+option_handle_get_number(struct option_entry *o)
+{
+	return atomic_load(&o->value.number.cur);
+}
+
 void
 option_init(void)
 {
+	option_add_number("buffer-time", 2, 2, 10, NULL);
 	option_add_boolean("continue", 1, player_print);
 	option_add_boolean("continue-after-error", 0, NULL);
+	option_add_number("directory-max-depth", 0, 0, INT_MAX, NULL);
+	option_add_number("directory-threads", 8, 1, 64, NULL);
+	option_add_boolean("gapless", 1, NULL);
 	option_add_format("library-format", "%-*a %-*l %4y %2n. %-*t %5d",
 	    library_print);
 	option_add_format("library-format-alt", "%-*F %5d", library_print);
+	option_add_number("metadata-threads", 0, 0, 64, NULL);
 	option_add_string("output-plugin", "default", player_change_op);
+	option_add_number("output-rate", 0, 0, 768000, NULL);
 	option_add_format("player-status-format",
 	    "%-7s  %5p / %5d  %3v%%  %u%{?c,  continue,}%{?r,  repeat-all,}"
 	    "%{?t,  repeat-track,}", player_print);
+	option_add_number("player-status-rate", 4, 1, 10, NULL);
 	option_add_format("player-track-format", "%a - %l (%y) - %n. %t",
 	    player_print);
 	option_add_format("player-track-format-alt", "%F", player_print);
@@ -437,9 +485,14 @@ option_init(void)
 	option_add_format("queue-format-alt", "%-*F %5d", queue_print);
 	option_add_boolean("repeat-all", 1, player_print);
 	option_add_boolean("repeat-track", 0, player_print);
+	option_add_string("replaygain", "off", player_configure_dsp);
+	option_add_number("replaygain-preamp", 0, -15, 15,
+	    player_configure_dsp);
+	option_add_string("resample-quality", "off", NULL);
 	option_add_boolean("show-all-files", 0, browser_refresh_dir);
 	option_add_boolean("show-cursor", 0, screen_configure_cursor);
 	option_add_boolean("show-hidden-files", 0, browser_refresh_dir);
+	option_add_boolean("software-volume", 0, player_configure_dsp);
 
 	option_add_attrib("active-attr", ATTRIB_NORMAL);
 	option_add_colour("active-bg", COLOUR_DEFAULT);
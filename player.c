@@ -16,22 +16,28 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <math.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "siren.h"
 
-#define PLAYER_FMT_CONTINUE	0
-#define PLAYER_FMT_DURATION	1
-#define PLAYER_FMT_POSITION	2
-#define PLAYER_FMT_REPEAT_ALL	3
-#define PLAYER_FMT_REPEAT_TRACK	4
-#define PLAYER_FMT_SOURCE	5
-#define PLAYER_FMT_STATE	6
-#define PLAYER_FMT_VOLUME	7
-#define PLAYER_FMT_NVARS	8
+#define PLAYER_FMT_BUFFER	0
+#define PLAYER_FMT_CONTINUE	1
+#define PLAYER_FMT_DURATION	2
+#define PLAYER_FMT_POSITION	3
+#define PLAYER_FMT_REPEAT_ALL	4
+#define PLAYER_FMT_REPEAT_TRACK	5
+#define PLAYER_FMT_SOURCE	6
+#define PLAYER_FMT_STATE	7
+#define PLAYER_FMT_VOLUME	8
+#define PLAYER_FMT_NVARS	9
 
 enum player_command {
 	PLAYER_COMMAND_PAUSE,
@@ -40,21 +46,63 @@ enum player_command {
 	PLAYER_COMMAND_STOP
 };
 
+enum player_decode_status {
+	PLAYER_DECODE_EOF,
+	PLAYER_DECODE_ERROR,
+	PLAYER_DECODE_RUNNING
+};
+
 enum player_state {
 	PLAYER_STATE_PAUSED,
 	PLAYER_STATE_PLAYING,
 	PLAYER_STATE_STOPPED
 };
 
+static void			 player_apply_dsp(struct sample_buffer *);
 static void			 player_close_op(void);
+static void			 player_compute_dsp_gain(void);
+static void			*player_decode_handler(void *);
+static int			 player_decode_next_track(void);
+static void			 player_decode_seek(unsigned int);
+static void			 player_decode_start(void);
+static void			 player_decode_stop(void);
+static void			 player_drop_op(void);
+static void			 player_finish_switch(void);
+static struct track		*player_get_next_track(void);
+static int			 player_get_position(unsigned int *);
+static double			 player_get_replaygain(void);
+static int			 player_get_volume(void);
+static void			 player_handle_volume_change(int);
+static int			 player_negotiate_format(
+				    struct sample_format *);
 static int			 player_open_op(void);
+static int			 player_open_resampler(struct track *);
+static int			 player_pause_op(int);
+static struct track		*player_peek_next_track(void);
 static void			*player_playback_handler(void *);
 static void			 player_print_status(void);
 static void			 player_print_track(void);
+static void			 player_publish_status(void);
 static void			 player_quit(void);
+static int			 player_ring_at_boundary(void);
+static size_t			 player_ring_get_fill(void);
+static size_t			 player_ring_read(void *, size_t);
+static int			 player_ring_readable(size_t);
+static void			 player_ring_wakeup(void);
+static int			 player_ring_writable(void);
+static int			 player_ring_write(const void *, size_t);
 static void			 player_set_signal_mask(void);
+static void			 player_set_state(enum player_state);
+static void			*player_status_handler(void *);
+static void			 player_update_status(void);
+static int			 player_start_op(struct sample_format *);
+static void			 player_stop_op(void);
+static int			 player_switch_track(void);
+static int			 player_use_software_volume(void);
 
 static pthread_t		 player_playback_thd;
+static pthread_t		 player_decode_thd;
+static pthread_t		 player_status_thd;
 
 static enum player_state	 player_state = PLAYER_STATE_STOPPED;
 static pthread_mutex_t		 player_state_mtx = PTHREAD_MUTEX_INITIALIZER;
@@ -67,19 +115,177 @@ static enum player_source	 player_source = PLAYER_SOURCE_LIBRARY;
 
 static const struct op		*player_op = NULL;
 static int			 player_op_opened;
+static int			 player_op_started;
+static struct sample_format	 player_op_format;
 static pthread_mutex_t		 player_op_mtx = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * If the output plug-in does not support the encoding of the decoded samples,
+ * then the playback thread converts them into the conversion buffer before
+ * passing them to the output plug-in.
+ */
+static enum sample_encoding	 player_encoding;
+static enum sample_encoding	 player_convert_encoding;
+static struct sample_buffer	 player_convert_sb;
+static int			 player_converting;
+
+/*
+ * The track being played and the track being decoded. These differ only when
+ * the decode thread has continued with the next track while the playback
+ * thread is still playing the end of the current track. The decode thread
+ * only peeks at the next track. The queue and the player source are advanced
+ * when the playback thread reaches it.
+ */
 static struct track		*player_track = NULL;
+static struct track		*player_decode_track = NULL;
 static pthread_mutex_t		 player_track_mtx = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * When the playback thread switches to the next track, the output plug-in
+ * still has to play the samples of the previous track it has buffered. Until
+ * then, the previous track is shown, and its position is computed from the
+ * number of frames written up to the switch. The previous track is set and
+ * cleared with both player_state_mtx and player_track_mtx locked, so either
+ * suffices to read it.
+ */
+static struct track		*player_prev_track = NULL;
+static size_t			 player_prev_frames;
+
 static enum byte_order		 player_byte_order;
 
+static int			 player_seek_pending;
+static unsigned int		 player_seek_pos;
+
+/*
+ * The playback position is the position at which playback started plus the
+ * number of frames written to the output plug-in since, minus the number of
+ * frames the output plug-in has buffered but not yet played.
+ */
+static unsigned int		 player_position_base;
+static atomic_size_t		 player_position_frames;
+static atomic_uint		 player_position_delay;
+
+/*
+ * A snapshot of the playback state. It is published by the playback thread
+ * and read by the status thread, which prints the player status at most
+ * player-status-rate times per second or when the status thread is woken up.
+ */
+static atomic_int		 player_status_state = PLAYER_STATE_STOPPED;
+static atomic_uint		 player_status_position;
+static atomic_int		 player_status_buffer;
+static int			 player_status_pending;
+static int			 player_status_track;
+static int			 player_status_quit;
+static pthread_mutex_t		 player_status_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		 player_status_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * The volume level last reported by the output plug-in, or -1 if it is not
+ * known. Only output plug-ins that notify us of volume changes have their
+ * volume level cached.
+ */
+static atomic_int		 player_volume = -1;
+
+/*
+ * The software volume level. It is used instead of the volume level of the
+ * output plug-in if the software-volume option is set or if the output
+ * plug-in does not have volume support.
+ */
+static atomic_int		 player_software_volume = 100;
+
+/*
+ * The DSP stage processes the samples read from the ring buffer before they
+ * are written to the output plug-in. It applies a single gain that combines
+ * the software volume level and the ReplayGain adjustment of the track being
+ * played. The gain is recomputed by the playback thread whenever
+ * player_dsp_changed is set. If the gain is unity, the samples are passed on
+ * untouched.
+ */
+static atomic_int		 player_dsp_changed = 1;
+static float			 player_dsp_gain = 1.0f;
+static int32_t			 player_dsp_max;
+
+/* Handles of the options that are read during playback. */
+static struct option_entry	*player_opt_buffer_time;
+static struct option_entry	*player_opt_continue;
+static struct option_entry	*player_opt_continue_after_error;
+static struct option_entry	*player_opt_gapless;
+static struct option_entry	*player_opt_output_rate;
+static struct option_entry	*player_opt_repeat_all;
+static struct option_entry	*player_opt_repeat_track;
+static struct option_entry	*player_opt_replaygain_preamp;
+static struct option_entry	*player_opt_software_volume;
+static struct option_entry	*player_opt_status_rate;
+
+/* Used to measure the time it takes to change tracks. */
+static struct timespec		 player_eof_time;
+static int			 player_eof_pending;
+
+/*
+ * The decode thread reads samples from the input plug-in and writes them to
+ * the ring buffer. The playback thread reads samples from the ring buffer and
+ * writes them to the output plug-in. The ring buffer is lock-free: the head
+ * is only advanced by the decode thread and the tail only by the playback
+ * thread. The mutex and condition variable are used only to sleep when the
+ * ring buffer is full or empty.
+ */
+static struct sample_buffer	 player_decode_sb;
+static atomic_int		 player_decode_quit;
+static atomic_int		 player_decode_status;
+
+/*
+ * The decode thread resamples the samples of the track being decoded if its
+ * rate differs from the rate of the output plug-in.
+ */
+static unsigned int		 player_output_rate;
+static int			 player_resampling;
+
+static char			*player_ring_data = NULL;
+static size_t			 player_ring_size;
+static size_t			 player_ring_limit;
+static size_t			 player_ring_rate;
+static atomic_size_t		 player_ring_head;
+static atomic_size_t		 player_ring_tail;
+static atomic_int		 player_ring_reader_waiting;
+static atomic_int		 player_ring_writer_waiting;
+static atomic_size_t		 player_ring_boundary;
+static atomic_int		 player_ring_boundary_pending;
+static int			 player_ring_primed;
+static unsigned int		 player_ring_underruns;
+static pthread_mutex_t		 player_ring_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		 player_ring_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Apply the DSP stage to the samples in the sample buffer.
+ */
+static void
+player_apply_dsp(struct sample_buffer *sb)
+{
+	if (atomic_exchange(&player_dsp_changed, 0))
+		player_compute_dsp_gain();
+
+	if (player_dsp_gain == 1.0f)
+		return;
+
+	if (sb->nbytes == 1)
+		sample_scale_s8(sb->data1, sb->len_s, player_dsp_gain);
+	else if (sb->nbytes == 2)
+		sample_scale_s16(sb->data2, sb->len_s, player_dsp_gain);
+	else
+		sample_scale_s32(sb->data4, sb->len_s, player_dsp_gain,
+		    player_dsp_max);
+}
+
 /*
  * The player_state_mtx mutex must be locked before calling this function.
  */
 static int
 player_begin_playback(struct sample_buffer *sb)
 {
+	struct sample_format	sf;
+	size_t			size;
+	unsigned int		rate;
+
 	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
 	XPTHREAD_MUTEX_LOCK(&player_op_mtx);
 
@@ -100,7 +306,33 @@ player_begin_playback(struct sample_buffer *sb)
 	if (player_open_op() == -1)
 		goto error2;
 
-	if (player_op->start(&player_track->format) == -1)
+	if (player_track->format.nbits <= 8)
+		player_encoding = SAMPLE_ENCODING_S8;
+	else if (player_track->format.nbits <= 16)
+		player_encoding = SAMPLE_ENCODING_S16;
+	else if (player_track->format.nbits <= 24)
+		player_encoding = SAMPLE_ENCODING_S24;
+	else
+		player_encoding = SAMPLE_ENCODING_S32;
+
+	/* Keep the output plug-in at a fixed rate if one has been set. */
+	sf = player_track->format;
+	sf.encoding = player_encoding;
+	if (resample_enabled() &&
+	    (rate = option_handle_get_number(player_opt_output_rate)) != 0)
+		sf.rate = rate;
+
+	if (player_negotiate_format(&sf) == -1)
+		goto error2;
+
+	if (player_start_op(&sf) == -1)
+		goto error2;
+
+	/* Use the byte order negotiated with the output plug-in. */
+	player_track->format.byte_order = sf.byte_order;
+
+	player_output_rate = sf.rate;
+	if (player_open_resampler(player_track) == -1)
 		goto error2;
 
 	if (player_track->format.nbits <= 8)
@@ -110,8 +342,10 @@ player_begin_playback(struct sample_buffer *sb)
 	else
 		sb->nbytes = 4;
 
-	sb->size_b = player_op->get_buffer_size();
-	sb->size_s = sb->size_b / sb->nbytes;
+	/* The buffer size of the output plug-in is in output samples. */
+	sb->size_s = player_op->get_buffer_size() /
+	    sample_encoding_size(sf.encoding);
+	sb->size_b = sb->size_s * sb->nbytes;
 
 	if (sb->size_s == 0) {
 		msg_errx("Output buffer too small");
@@ -129,11 +363,68 @@ player_begin_playback(struct sample_buffer *sb)
 	else
 		sb->swap = 1;
 
-	LOG_DEBUG("size_b=%zu, size_s=%zu, nbytes=%u, swap=%d", sb->size_b,
-	    sb->size_s, sb->nbytes, sb->swap);
+	player_converting = sf.encoding != player_encoding;
+	if (player_converting) {
+		player_convert_encoding = sf.encoding;
+		player_convert_sb.nbytes = sample_encoding_size(sf.encoding);
+		player_convert_sb.size_s = sb->size_s;
+		player_convert_sb.size_b = sb->size_s *
+		    player_convert_sb.nbytes;
+		player_convert_sb.data = xmalloc(player_convert_sb.size_b);
+		player_convert_sb.data1 = player_convert_sb.data;
+		player_convert_sb.data2 = player_convert_sb.data;
+		player_convert_sb.data4 = player_convert_sb.data;
+
+		/* Packed 24-bit samples are converted in the right order. */
+		player_convert_sb.swap = sb->swap ||
+		    (player_track->format.byte_order != player_byte_order &&
+		    (player_convert_sb.nbytes == 2 ||
+		    player_convert_sb.nbytes == 4));
+		sb->swap = 0;
+	}
+
+	LOG_DEBUG("size_b=%zu, size_s=%zu, nbytes=%u, swap=%d, converting=%d",
+	    sb->size_b, sb->size_s, sb->nbytes, sb->swap, player_converting);
+
+	player_decode_sb = *sb;
+	player_decode_sb.data = xmalloc(sb->size_b);
+	player_decode_sb.data1 = player_decode_sb.data;
+	player_decode_sb.data2 = player_decode_sb.data;
+	player_decode_sb.data4 = player_decode_sb.data;
+
+	/*
+	 * Size the ring buffer so that it can hold the requested amount of
+	 * time, but at least two output buffers. Round the size up to a power
+	 * of two so that offsets can be masked instead of divided, but fill
+	 * it only up to the requested size.
+	 */
+	player_ring_rate = player_output_rate *
+	    player_track->format.nchannels * sb->nbytes;
+	size = player_ring_rate *
+	    option_handle_get_number(player_opt_buffer_time);
+	if (size < 2 * sb->size_b)
+		size = 2 * sb->size_b;
+	for (player_ring_size = 1; player_ring_size < size;)
+		player_ring_size <<= 1;
+	player_ring_limit = size;
+	player_ring_data = xmalloc(player_ring_size);
+	player_ring_underruns = 0;
+	player_seek_pending = 0;
+	player_position_base = 0;
+	atomic_store(&player_position_frames, 0);
+	atomic_store(&player_position_delay, 0);
+	atomic_store(&player_ring_boundary_pending, 0);
+	atomic_store(&player_dsp_changed, 1);
+	player_decode_track = player_track;
+	player_publish_status();
+
+	LOG_DEBUG("ring_size=%zu, ring_limit=%zu", player_ring_size,
+	    player_ring_limit);
 
 	XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
 	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+
+	player_decode_start();
 	return 0;
 
 error2:
@@ -155,9 +446,7 @@ player_change_op(void)
 	player_open_op();
 	XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
 
-	XPTHREAD_MUTEX_LOCK(&player_state_mtx);
-	player_print_status();
-	XPTHREAD_MUTEX_UNLOCK(&player_state_mtx);
+	player_update_status();
 }
 
 /*
@@ -169,7 +458,315 @@ player_close_op(void)
 	if (player_op_opened) {
 		player_op->close();
 		player_op_opened = 0;
+		player_op_started = 0;
+		atomic_store(&player_volume, -1);
+	}
+}
+
+/*
+ * Compute the gain of the DSP stage. This function is called by the playback
+ * thread only.
+ */
+static void
+player_compute_dsp_gain(void)
+{
+	double		gain, vol;
+	unsigned int	nbits;
+
+	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+	gain = player_get_replaygain();
+	nbits = player_track->format.nbits;
+	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+
+	XPTHREAD_MUTEX_LOCK(&player_op_mtx);
+	if (player_use_software_volume()) {
+		/* Use a cubic curve to approximate a logarithmic one. */
+		vol = atomic_load(&player_software_volume) / 100.0;
+		gain *= vol * vol * vol;
+	}
+	XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
+
+	/*
+	 * Samples with more than 24 bits are clipped to the largest value
+	 * below INT32_MAX that is representable as a float.
+	 */
+	if (nbits > 24)
+		player_dsp_max = INT32_MAX - 127;
+	else if (nbits > 1)
+		player_dsp_max = ((int32_t)1 << (nbits - 1)) - 1;
+
+	player_dsp_gain = gain;
+	LOG_DEBUG("gain=%f", gain);
+}
+
+void
+player_configure_dsp(void)
+{
+	char *mode;
+
+	mode = option_get_string("replaygain");
+	if (strcmp(mode, "off") && strcmp(mode, "track") &&
+	    strcmp(mode, "album"))
+		msg_errx("Invalid replaygain mode: %s", mode);
+	free(mode);
+
+	atomic_store(&player_dsp_changed, 1);
+	player_update_status();
+}
+
+static void *
+player_decode_handler(UNUSED void *p)
+{
+	struct sample_buffer	*sb;
+	size_t			 len;
+	int			 ret;
+	void			*data;
+
+	sb = &player_decode_sb;
+
+	for (;;) {
+		if (atomic_load(&player_decode_quit))
+			return NULL;
+
+		XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+		ret = player_decode_track->ip->read(player_decode_track, sb);
+		XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+
+		if (ret == 0 && player_decode_next_track() == 0)
+			/* Continue with the next track without a gap. */
+			continue;
+
+		if (ret <= 0)
+			/* EOF reached or error encountered. */
+			break;
+
+		if (player_resampling)
+			len = resample_process(sb, &data);
+		else {
+			data = sb->data;
+			len = sb->len_b;
+		}
+
+		if (player_ring_write(data, len) == -1)
+			/* Asked to quit. */
+			return NULL;
 	}
+
+	if (ret == 0 && player_resampling) {
+		/* Write the samples still held by the resampler. */
+		len = resample_flush(&data);
+		if (player_ring_write(data, len) == -1)
+			return NULL;
+	}
+
+	atomic_store(&player_decode_status,
+	    ret == 0 ? PLAYER_DECODE_EOF : PLAYER_DECODE_ERROR);
+	player_ring_wakeup();
+	return NULL;
+}
+
+/*
+ * Open the next track so that its samples can be appended to those of the
+ * current track. This is possible only if both tracks have the same sample
+ * format. Return -1 if playback cannot continue without a gap.
+ */
+static int
+player_decode_next_track(void)
+{
+	struct track	*t;
+	size_t		 len;
+	int		 newrate;
+	void		*data;
+
+	if (!option_handle_get_boolean(player_opt_gapless) ||
+	    !option_handle_get_boolean(player_opt_continue))
+		return -1;
+
+	/*
+	 * Wait until the playback thread has reached the start of the
+	 * previous track, if any.
+	 */
+	if (atomic_load(&player_ring_boundary_pending)) {
+		XPTHREAD_MUTEX_LOCK(&player_ring_mtx);
+		atomic_store(&player_ring_writer_waiting, 1);
+		while (atomic_load(&player_ring_boundary_pending) &&
+		    !atomic_load(&player_decode_quit))
+			XPTHREAD_COND_WAIT(&player_ring_cond,
+			    &player_ring_mtx);
+		atomic_store(&player_ring_writer_waiting, 0);
+		XPTHREAD_MUTEX_UNLOCK(&player_ring_mtx);
+
+		if (atomic_load(&player_decode_quit))
+			return -1;
+	}
+
+	if ((t = player_peek_next_track()) == NULL)
+		return -1;
+
+	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+
+	newrate = 0;
+	if (t->ip == NULL)
+		goto out;
+
+	if (t == player_decode_track)
+		/* The same track is played again. */
+		t->ip->seek(t, 0);
+	else {
+		if (t->ip->open(t) == -1)
+			goto out;
+
+		if (t->format.nbits != player_decode_track->format.nbits ||
+		    t->format.nchannels !=
+		    player_decode_track->format.nchannels) {
+			LOG_DEBUG("%s: sample format differs", t->path);
+			t->ip->close(t);
+			goto out;
+		}
+
+		/*
+		 * Continue without a gap if the rate of the output plug-in is
+		 * held fixed, so that the track can be resampled to it.
+		 */
+		newrate = t->format.rate != player_decode_track->format.rate;
+		if (newrate && (!resample_enabled() ||
+		    option_handle_get_number(player_opt_output_rate) == 0)) {
+			LOG_DEBUG("%s: sample rate differs", t->path);
+			t->ip->close(t);
+			goto out;
+		}
+
+		/* Use the byte order negotiated with the output plug-in. */
+		t->format.byte_order = player_decode_track->format.byte_order;
+	}
+
+	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+
+	/*
+	 * Before the resampler is replaced, write the samples it still holds,
+	 * so that the end of the current track is not cut off. The ring
+	 * buffer may be full, so player_track_mtx must not be held.
+	 */
+	if (newrate) {
+		if (player_resampling) {
+			len = resample_flush(&data);
+			if (player_ring_write(data, len) == -1)
+				goto close;
+		}
+		if (player_open_resampler(t) == -1) {
+			LOG_DEBUG("%s: cannot resample", t->path);
+			goto close;
+		}
+	}
+
+	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+	player_decode_track = t;
+
+	/* Mark the start of the next track in the ring buffer. */
+	atomic_store(&player_ring_boundary, atomic_load(&player_ring_head));
+	atomic_store(&player_ring_boundary_pending, 1);
+
+	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+	LOG_DEBUG("continuing with %s", t->path);
+	return 0;
+
+close:
+	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+	t->ip->close(t);
+out:
+	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+	return -1;
+}
+
+/*
+ * Seek to the specified position. Samples already in the ring buffer are
+ * discarded. The playback thread must not be reading from the ring buffer
+ * while this function is called.
+ */
+static void
+player_decode_seek(unsigned int pos)
+{
+	struct track *prev;
+
+	player_decode_stop();
+
+	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+
+	/* The seek applies to the track being decoded, so show it now. */
+	prev = player_prev_track;
+	player_prev_track = NULL;
+
+	/*
+	 * If the decode thread has already continued with the next track,
+	 * then go back to the track being played. The next track will be
+	 * played after it.
+	 */
+	if (player_decode_track != player_track) {
+		player_decode_track->ip->close(player_decode_track);
+		player_decode_track = player_track;
+		atomic_store(&player_ring_boundary_pending, 0);
+
+		/* The next track may have been resampled from another rate. */
+		player_open_resampler(player_track);
+	}
+
+	player_track->ip->seek(player_track, pos);
+
+	/* Do not play what was buffered before the seek. */
+	XPTHREAD_MUTEX_LOCK(&player_op_mtx);
+	player_drop_op();
+	XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
+
+	if (player_resampling)
+		resample_reset();
+	if (player_track->ip->get_position(player_track,
+	    &player_position_base) == -1)
+		player_position_base = pos;
+	atomic_store(&player_position_frames, 0);
+	player_publish_status();
+
+	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+
+	if (prev != NULL)
+		player_print_track();
+
+	player_decode_start();
+}
+
+static void
+player_decode_start(void)
+{
+	atomic_store(&player_ring_head, 0);
+	atomic_store(&player_ring_tail, 0);
+	atomic_store(&player_decode_quit, 0);
+	atomic_store(&player_decode_status, PLAYER_DECODE_RUNNING);
+	player_ring_primed = 0;
+
+	XPTHREAD_CREATE(&player_decode_thd, NULL, player_decode_handler,
+	    NULL);
+}
+
+static void
+player_decode_stop(void)
+{
+	atomic_store(&player_decode_quit, 1);
+	player_ring_wakeup();
+	XPTHREAD_JOIN(player_decode_thd, NULL);
+}
+
+/*
+ * Discard the samples that the output plug-in has not played yet, so that a
+ * user action takes effect without waiting for its buffer to play out.
+ *
+ * The player_op_mtx mutex must be locked before calling this function.
+ */
+static void
+player_drop_op(void)
+{
+	if (player_op_started && player_op->drop != NULL &&
+	    player_op->drop() == -1)
+		player_stop_op();
+	atomic_store(&player_position_delay, 0);
 }
 
 static void
@@ -189,22 +786,81 @@ player_end(void)
 {
 	player_quit();
 	XPTHREAD_JOIN(player_playback_thd, NULL);
+
+	XPTHREAD_MUTEX_LOCK(&player_status_mtx);
+	player_status_quit = 1;
+	XPTHREAD_COND_BROADCAST(&player_status_cond);
+	XPTHREAD_MUTEX_UNLOCK(&player_status_mtx);
+	XPTHREAD_JOIN(player_status_thd, NULL);
+
 	player_close_op();
 }
 
 static void
 player_end_playback(struct sample_buffer *sb)
 {
+	player_decode_stop();
+
+	if (player_ring_underruns > 0)
+		LOG_INFO("%u buffer underruns", player_ring_underruns);
+
 	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+	if (player_decode_track != player_track) {
+		player_decode_track->ip->close(player_decode_track);
+		player_decode_track = player_track;
+	}
 	player_track->ip->close(player_track);
+	player_prev_track = NULL;
 	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
 
-	XPTHREAD_MUTEX_LOCK(&player_op_mtx);
-	if (player_op->stop() == -1)
-		player_close_op();
-	XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
+	/*
+	 * If another track is to be played, keep the output plug-in running.
+	 * It might be able to play the next track without being restarted.
+	 */
+	if (player_command != PLAYER_COMMAND_PLAY) {
+		player_eof_pending = 0;
+		XPTHREAD_MUTEX_LOCK(&player_op_mtx);
+		player_stop_op();
+		XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
+	}
+
+	if (player_resampling) {
+		resample_close();
+		player_resampling = 0;
+	}
 
 	free(sb->data);
+	free(player_decode_sb.data);
+	if (player_converting) {
+		free(player_convert_sb.data);
+		player_converting = 0;
+	}
+	free(player_ring_data);
+	player_ring_data = NULL;
+	player_ring_size = 0;
+	player_ring_limit = 0;
+	player_ring_rate = 0;
+}
+
+/*
+ * Show the next track once the output plug-in has played the last samples of
+ * the previous one. The position of the next track starts at the frame that
+ * followed them.
+ *
+ * The player_state_mtx mutex must be locked before calling this function.
+ */
+static void
+player_finish_switch(void)
+{
+	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+	player_prev_track = NULL;
+	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+
+	player_position_base = 0;
+	atomic_fetch_sub(&player_position_frames, player_prev_frames);
+	player_publish_status();
+	player_print_track();
+	player_update_status();
 }
 
 void
@@ -217,6 +873,8 @@ player_forcibly_close_op(void)
 		LOG_INFO("forcibly closing %s", player_op->name);
 		player_op->close();
 		player_op_opened = 0;
+		player_op_started = 0;
+		atomic_store(&player_volume, -1);
 	}
 	XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
 }
@@ -227,45 +885,322 @@ player_get_byte_order(void)
 	return player_byte_order;
 }
 
+/*
+ * Select the track to be played after the current one.
+ */
+static struct track *
+player_get_next_track(void)
+{
+	struct track *t;
+
+	if (option_handle_get_boolean(player_opt_repeat_track)) {
+		XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+		t = player_track;
+		XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+		return t;
+	}
+
+	if ((t = queue_get_next_track()) == NULL) {
+		XPTHREAD_MUTEX_LOCK(&player_source_mtx);
+		switch (player_source) {
+		case PLAYER_SOURCE_BROWSER:
+			t = browser_get_next_track();
+			break;
+		case PLAYER_SOURCE_LIBRARY:
+			t = library_get_next_track();
+			break;
+		case PLAYER_SOURCE_PLAYLIST:
+			t = playlist_get_next_track();
+			break;
+		}
+		XPTHREAD_MUTEX_UNLOCK(&player_source_mtx);
+	}
+
+	return t;
+}
+
+/*
+ * Get the audible playback position from the number of frames written to the
+ * output plug-in and the delay last reported by it.
+ *
+ * This function must be called from the playback thread or with the
+ * player_state_mtx mutex locked.
+ */
+static int
+player_get_position(unsigned int *pos)
+{
+	size_t		frames;
+	unsigned int	delay;
+
+	if (player_ring_rate == 0)
+		return -1;
+
+	frames = atomic_load(&player_position_frames);
+	delay = atomic_load(&player_position_delay);
+	if (frames > delay)
+		frames -= delay;
+	else
+		frames = 0;
+
+	/* The next track is not heard yet. */
+	if (player_prev_track != NULL && frames > player_prev_frames)
+		frames = player_prev_frames;
+
+	*pos = player_position_base + frames / player_output_rate;
+	return 0;
+}
+
+/*
+ * Get the ReplayGain adjustment of the track being played as a linear gain.
+ * If the track has a peak value, then the gain is reduced so that the track
+ * does not clip.
+ *
+ * The player_track_mtx mutex must be locked before calling this function.
+ */
+static double
+player_get_replaygain(void)
+{
+	double	 gain, peak;
+	int	 album, found;
+	char	*mode;
+
+	mode = option_get_string("replaygain");
+	if (!strcmp(mode, "album"))
+		album = 1;
+	else if (!strcmp(mode, "track"))
+		album = 0;
+	else {
+		free(mode);
+		return 1.0;
+	}
+	free(mode);
+
+	gain = peak = 0.0;
+	found = 1;
+
+	track_lock_metadata();
+	if (album && player_track->albumgain != NULL) {
+		gain = strtod(player_track->albumgain, NULL);
+		if (player_track->albumpeak != NULL)
+			peak = strtod(player_track->albumpeak, NULL);
+	} else if (player_track->trackgain != NULL) {
+		/* Fall back to the track gain if there is no album gain. */
+		gain = strtod(player_track->trackgain, NULL);
+		if (player_track->trackpeak != NULL)
+			peak = strtod(player_track->trackpeak, NULL);
+	} else
+		found = 0;
+	track_unlock_metadata();
+
+	if (!found)
+		return 1.0;
+
+	gain += option_handle_get_number(player_opt_replaygain_preamp);
+	gain = pow(10.0, gain / 20.0);
+	if (!isfinite(gain))
+		return 1.0;
+
+	if (peak > 0.0 && gain * peak > 1.0)
+		gain = 1.0 / peak;
+
+	return gain;
+}
+
 static int
 player_get_track(void)
 {
 	struct track *t;
 
-	if (!option_get_boolean("repeat-track")) {
-		if ((t = queue_get_next_track()) == NULL) {
-			XPTHREAD_MUTEX_LOCK(&player_source_mtx);
-			switch (player_source) {
-			case PLAYER_SOURCE_BROWSER:
-				t = browser_get_next_track();
-				break;
-			case PLAYER_SOURCE_LIBRARY:
-				t = library_get_next_track();
-				break;
-			case PLAYER_SOURCE_PLAYLIST:
-				t = playlist_get_next_track();
-				break;
-			}
-			XPTHREAD_MUTEX_UNLOCK(&player_source_mtx);
+	if ((t = player_get_next_track()) == NULL)
+		return -1;
 
-			if (t == NULL)
-				return -1;
-		}
+	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+	player_track = t;
+	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
 
-		XPTHREAD_MUTEX_LOCK(&player_track_mtx);
-		player_track = t;
-		XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+	return option_handle_get_boolean(player_opt_continue) ? 0 : -1;
+}
+
+/*
+ * Get the volume level of the output plug-in, or the software volume level if
+ * that is used instead. If the output plug-in notifies us of volume changes,
+ * then it is asked for the volume level only once.
+ *
+ * The player_op_mtx mutex must be locked before calling this function.
+ */
+static int
+player_get_volume(void)
+{
+	int vol, unknown;
+
+	if (player_use_software_volume())
+		return atomic_load(&player_software_volume);
+
+	if (player_op->set_volume_handler == NULL)
+		return player_op->get_volume();
+
+	if ((vol = atomic_load(&player_volume)) == -1 &&
+	    (vol = player_op->get_volume()) != -1) {
+		/* Do not overwrite a newly reported volume level. */
+		unknown = -1;
+		if (!atomic_compare_exchange_strong(&player_volume, &unknown,
+		    vol))
+			vol = unknown;
 	}
 
-	return option_get_boolean("continue") ? 0 : -1;
+	return vol;
+}
+
+/*
+ * Called by the output plug-in when the volume level has changed. This
+ * function can be called from any thread.
+ */
+static void
+player_handle_volume_change(int vol)
+{
+	atomic_store(&player_volume, vol);
+	player_update_status();
 }
 
 void
 player_init(void)
 {
+	player_opt_buffer_time = option_get_handle("buffer-time",
+	    OPTION_TYPE_NUMBER);
+	player_opt_continue = option_get_handle("continue",
+	    OPTION_TYPE_BOOLEAN);
+	player_opt_continue_after_error = option_get_handle(
+	    "continue-after-error", OPTION_TYPE_BOOLEAN);
+	player_opt_gapless = option_get_handle("gapless", OPTION_TYPE_BOOLEAN);
+	player_opt_output_rate = option_get_handle("output-rate",
+	    OPTION_TYPE_NUMBER);
+	player_opt_repeat_all = option_get_handle("repeat-all",
+	    OPTION_TYPE_BOOLEAN);
+	player_opt_repeat_track = option_get_handle("repeat-track",
+	    OPTION_TYPE_BOOLEAN);
+	player_opt_replaygain_preamp = option_get_handle("replaygain-preamp",
+	    OPTION_TYPE_NUMBER);
+	player_opt_software_volume = option_get_handle("software-volume",
+	    OPTION_TYPE_BOOLEAN);
+	player_opt_status_rate = option_get_handle("player-status-rate",
+	    OPTION_TYPE_NUMBER);
+
 	player_determine_byte_order();
 	XPTHREAD_CREATE(&player_playback_thd, NULL, player_playback_handler,
 	    NULL);
+	XPTHREAD_CREATE(&player_status_thd, NULL, player_status_handler,
+	    NULL);
+}
+
+/*
+ * Return whether playback has been requested and has not been stopped or
+ * paused since. This is also the case while the player moves on to the next
+ * track.
+ */
+int
+player_is_playing(void)
+{
+	int playing;
+
+	XPTHREAD_MUTEX_LOCK(&player_state_mtx);
+	playing = player_command == PLAYER_COMMAND_PLAY;
+	XPTHREAD_MUTEX_UNLOCK(&player_state_mtx);
+	return playing;
+}
+
+/*
+ * Choose the sample format in which the output plug-in is started. The
+ * encoding of the decoded samples is kept if the output plug-in supports it.
+ * Otherwise, the supported encoding that loses the least precision is used.
+ * If resampling is enabled, a sampling rate the output plug-in does not
+ * support is replaced with the nearest one it does support.
+ *
+ * The player_op_mtx mutex must be locked before calling this function.
+ */
+static int
+player_negotiate_format(struct sample_format *sf)
+{
+	static const struct {
+		enum sample_encoding	encoding;
+		enum sample_encoding	alternatives[5];
+	} prefs[] = {
+		{
+			SAMPLE_ENCODING_S8,
+			{ SAMPLE_ENCODING_S16, SAMPLE_ENCODING_S32,
+			  SAMPLE_ENCODING_S24, SAMPLE_ENCODING_S24_3,
+			  SAMPLE_ENCODING_FLOAT }
+		},
+		{
+			SAMPLE_ENCODING_S16,
+			{ SAMPLE_ENCODING_S32, SAMPLE_ENCODING_S24,
+			  SAMPLE_ENCODING_S24_3, SAMPLE_ENCODING_FLOAT,
+			  SAMPLE_ENCODING_S8 }
+		},
+		{
+			SAMPLE_ENCODING_S24,
+			{ SAMPLE_ENCODING_S24_3, SAMPLE_ENCODING_S32,
+			  SAMPLE_ENCODING_FLOAT, SAMPLE_ENCODING_S16,
+			  SAMPLE_ENCODING_S8 }
+		},
+		{
+			SAMPLE_ENCODING_S32,
+			{ SAMPLE_ENCODING_S24, SAMPLE_ENCODING_S24_3,
+			  SAMPLE_ENCODING_FLOAT, SAMPLE_ENCODING_S16,
+			  SAMPLE_ENCODING_S8 }
+		}
+	};
+	struct sample_caps	caps;
+	size_t			i, j;
+
+	/* Without capabilities, leave it to the output plug-in. */
+	if (player_op->get_caps == NULL)
+		return 0;
+
+	memset(&caps, 0, sizeof caps);
+	if (player_op->get_caps(&caps) == -1)
+		return 0;
+
+	LOG_DEBUG("encodings=%#x, channels=%u-%u, rate=%u-%u", caps.encodings,
+	    caps.minchannels, caps.maxchannels, caps.minrate, caps.maxrate);
+
+	if (sf->nchannels < caps.minchannels ||
+	    (caps.maxchannels != 0 && sf->nchannels > caps.maxchannels)) {
+		LOG_ERRX("%u channels not supported", sf->nchannels);
+		msg_errx("%u channels not supported", sf->nchannels);
+		return -1;
+	}
+
+	if (resample_enabled()) {
+		if (sf->rate < caps.minrate)
+			sf->rate = caps.minrate;
+		else if (caps.maxrate != 0 && sf->rate > caps.maxrate)
+			sf->rate = caps.maxrate;
+	}
+
+	if (caps.encodings & sf->encoding)
+		return 0;
+
+	for (i = 0; i < nitems(prefs); i++) {
+		if (prefs[i].encoding != sf->encoding)
+			continue;
+
+		for (j = 0; j < nitems(prefs[i].alternatives); j++)
+			if (caps.encodings & prefs[i].alternatives[j]) {
+				sf->encoding = prefs[i].alternatives[j];
+				if (sf->encoding == SAMPLE_ENCODING_S24)
+					sf->nbits = 24;
+				else
+					sf->nbits = 8 *
+					    sample_encoding_size(sf->encoding);
+				LOG_INFO("converting samples to %u bits",
+				    sf->nbits);
+				return 0;
+			}
+	}
+
+	LOG_ERRX("%u bits per sample not supported", sf->nbits);
+	msg_errx("%u bits per sample not supported", sf->nbits);
+	return -1;
 }
 
 /*
@@ -290,11 +1225,37 @@ player_open_op(void)
 		free(name);
 	}
 
-	LOG_INFO("opening %s", player_op->name);
-	if (player_op->open() == -1)
+	LOG_INFO("opening %s", player_op->name);
+	if (player_op->open() == -1)
+		return -1;
+
+	if (player_op->set_volume_handler != NULL)
+		player_op->set_volume_handler(player_handle_volume_change);
+
+	player_op_opened = 1;
+	return 0;
+}
+
+/*
+ * Set up the resampler if the rate of the track differs from the rate of the
+ * output plug-in. A resampler that is already set up is replaced; the samples
+ * it still holds are discarded.
+ */
+static int
+player_open_resampler(struct track *t)
+{
+	if (player_resampling) {
+		resample_close();
+		player_resampling = 0;
+	}
+
+	if (t->format.rate == player_output_rate)
+		return 0;
+
+	if (resample_open(&t->format, player_output_rate) == -1)
 		return -1;
 
-	player_op_opened = 1;
+	player_resampling = 1;
 	return 0;
 }
 
@@ -377,44 +1338,172 @@ player_play_prev(void)
 		player_play_track(t);
 }
 
+/*
+ * Pause or resume the output plug-in. Without support for pausing, the output
+ * plug-in plays out its buffer when the player is paused.
+ *
+ * The player_op_mtx mutex must be locked before calling this function.
+ */
+static int
+player_pause_op(int pause)
+{
+	if (!player_op_started || player_op->pause == NULL)
+		return -1;
+
+	return player_op->pause(pause);
+}
+
+/*
+ * Return the track to be played after the current one, like
+ * player_get_next_track(), but without advancing the queue or the player
+ * source.
+ */
+static struct track *
+player_peek_next_track(void)
+{
+	struct track *t;
+
+	if (option_handle_get_boolean(player_opt_repeat_track)) {
+		XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+		t = player_track;
+		XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+		return t;
+	}
+
+	if ((t = queue_peek_next_track()) == NULL) {
+		XPTHREAD_MUTEX_LOCK(&player_source_mtx);
+		switch (player_source) {
+		case PLAYER_SOURCE_BROWSER:
+			t = browser_peek_next_track();
+			break;
+		case PLAYER_SOURCE_LIBRARY:
+			t = library_peek_next_track();
+			break;
+		case PLAYER_SOURCE_PLAYLIST:
+			t = playlist_peek_next_track();
+			break;
+		}
+		XPTHREAD_MUTEX_UNLOCK(&player_source_mtx);
+	}
+
+	return t;
+}
+
 static int
 player_play_sample_buffer(struct sample_buffer *sb)
 {
-	size_t	i;
-	int	ret;
+	struct sample_buffer	 area, *in, *out;
+	struct timespec		 now;
+	size_t			 size;
+	long			 msecs;
+	unsigned int		 delay;
+	int			 eof, ret;
+	void			*data;
+
+	data = NULL;
+	if (player_op->begin_write != NULL) {
+		XPTHREAD_MUTEX_LOCK(&player_op_mtx);
+		ret = player_op->begin_write(&data, &size);
+		XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
+		if (ret == -1)
+			goto error;
+	}
 
-	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
-	ret = player_track->ip->read(player_track, sb);
-	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+	in = sb;
+	out = player_converting ? &player_convert_sb : sb;
 
-	if (ret == 0)
-		/* EOF reached. */
-		return -1;
+	/*
+	 * If the output plug-in has given us direct access to its buffer, then
+	 * the last stage writes into it: the conversion if the samples are
+	 * converted and the ring buffer read otherwise.
+	 */
+	if (data != NULL) {
+		area = *out;
+		area.data = data;
+		area.data1 = data;
+		area.data2 = data;
+		area.data4 = data;
+		area.size_s = size / area.nbytes;
+		if (area.size_s > sb->size_s)
+			area.size_s = sb->size_s;
+		area.size_b = area.size_s * area.nbytes;
+		if (!player_converting)
+			in = &area;
+		out = &area;
+	}
 
-	if (ret < 0)
-		/* Error encountered. */
-		goto error;
+	/*
+	 * The start of the next track may be reached before or while we wait
+	 * for samples. Nothing can be read past it until we switch tracks.
+	 */
+	eof = 0;
+	while ((in->len_b = player_ring_read(in->data,
+	    out->size_s * in->nbytes)) == 0 && player_ring_at_boundary())
+		if (player_switch_track() == -1) {
+			eof = 1;
+			break;
+		}
+	in->len_s = in->len_b / in->nbytes;
+
+	if (in->len_s == 0) {
+		if (eof || atomic_load(&player_decode_status) ==
+		    PLAYER_DECODE_EOF) {
+			/* EOF reached. */
+			clock_gettime(CLOCK_MONOTONIC, &player_eof_time);
+			player_eof_pending = 1;
+			return -1;
+		} else
+			/* Error encountered. */
+			goto error;
+	}
 
-	if (sb->swap) {
-		if (sb->nbytes == 2)
-			for (i = 0; i < sb->len_s; i++)
-				sb->data2[i] = swap16(sb->data2[i]);
+	player_apply_dsp(in);
+
+	if (player_converting) {
+		out->len_s = in->len_s;
+		out->len_b = out->len_s * out->nbytes;
+		sample_convert(out->data, player_convert_encoding, in->data,
+		    player_encoding, in->len_s,
+		    player_track->format.byte_order);
+	}
+
+	if (out->swap) {
+		if (out->nbytes == 2)
+			sample_swap16(out->data2, out->len_s);
 		else
-			for (i = 0; i < sb->len_s; i++)
-				sb->data4[i] = swap32(sb->data4[i]);
+			sample_swap32(out->data4, out->len_s);
 	}
 
 	XPTHREAD_MUTEX_LOCK(&player_op_mtx);
-	ret = player_op->write(sb);
+	if (data != NULL)
+		ret = player_op->commit_write(out->len_b);
+	else
+		ret = player_op->write(out);
+	if (ret == -1 || player_op->get_delay == NULL ||
+	    player_op->get_delay(&delay) == -1)
+		delay = 0;
 	XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
 
 	if (ret == -1)
 		goto error;
 
+	atomic_fetch_add(&player_position_frames,
+	    in->len_s / player_track->format.nchannels);
+	atomic_store(&player_position_delay, delay);
+	player_publish_status();
+
+	if (player_eof_pending) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		msecs = (now.tv_sec - player_eof_time.tv_sec) * 1000 +
+		    (now.tv_nsec - player_eof_time.tv_nsec) / 1000000;
+		LOG_INFO("track change took %ld ms", msecs);
+		player_eof_pending = 0;
+	}
+
 	return 0;
 
 error:
-	if (!option_get_boolean("continue-after-error")) {
+	if (!option_handle_get_boolean(player_opt_continue_after_error)) {
 		XPTHREAD_MUTEX_LOCK(&player_state_mtx);
 		player_command = PLAYER_COMMAND_STOP;
 		XPTHREAD_MUTEX_UNLOCK(&player_state_mtx);
@@ -435,7 +1524,8 @@ player_play_track(struct track *t)
 static void *
 player_playback_handler(UNUSED void *p)
 {
-	struct sample_buffer sb;
+	struct sample_buffer	sb;
+	int			paused;
 
 	/*
 	 * Block all signals in this thread so that they can be handled in the
@@ -452,6 +1542,10 @@ player_playback_handler(UNUSED void *p)
 		}
 
 		if (player_command == PLAYER_COMMAND_STOP) {
+			XPTHREAD_MUTEX_LOCK(&player_op_mtx);
+			player_stop_op();
+			XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
+
 			XPTHREAD_COND_WAIT(&player_command_cond,
 			    &player_state_mtx);
 			if (player_command == PLAYER_COMMAND_QUIT)
@@ -464,7 +1558,7 @@ player_playback_handler(UNUSED void *p)
 			continue;
 		}
 
-		player_state = PLAYER_STATE_PLAYING;
+		player_set_state(PLAYER_STATE_PLAYING);
 		XPTHREAD_MUTEX_UNLOCK(&player_state_mtx);
 
 		for (;;) {
@@ -474,27 +1568,55 @@ player_playback_handler(UNUSED void *p)
 			}
 
 			XPTHREAD_MUTEX_LOCK(&player_state_mtx);
+			if (player_prev_track != NULL &&
+			    atomic_load(&player_position_frames) >=
+			    player_prev_frames +
+			    atomic_load(&player_position_delay))
+				player_finish_switch();
+
 			if (player_command == PLAYER_COMMAND_PAUSE) {
-				player_state = PLAYER_STATE_PAUSED;
-				player_print_status();
+				XPTHREAD_MUTEX_LOCK(&player_op_mtx);
+				paused = player_pause_op(1) == 0;
+				XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
+				player_set_state(PLAYER_STATE_PAUSED);
 
 				XPTHREAD_COND_WAIT(&player_command_cond,
 				    &player_state_mtx);
 
-				if (player_command == PLAYER_COMMAND_PLAY)
-					player_state = PLAYER_STATE_PLAYING;
+				if (player_command == PLAYER_COMMAND_PLAY) {
+					if (paused) {
+						XPTHREAD_MUTEX_LOCK(
+						    &player_op_mtx);
+						player_pause_op(0);
+						XPTHREAD_MUTEX_UNLOCK(
+						    &player_op_mtx);
+					}
+					player_set_state(PLAYER_STATE_PLAYING);
+				}
 			}
 
-			if (player_command == PLAYER_COMMAND_STOP)
+			/*
+			 * The user has stopped playback or selected another
+			 * track. Dropping also resumes a paused output
+			 * plug-in.
+			 */
+			if (player_command == PLAYER_COMMAND_STOP) {
+				XPTHREAD_MUTEX_LOCK(&player_op_mtx);
+				player_drop_op();
+				XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
 				break;
+			}
+
+			if (player_seek_pending) {
+				player_decode_seek(player_seek_pos);
+				player_seek_pending = 0;
+			}
 
-			player_print_status();
 			XPTHREAD_MUTEX_UNLOCK(&player_state_mtx);
 		}
 
 		player_end_playback(&sb);
-		player_state = PLAYER_STATE_STOPPED;
-		player_print_status();
+		player_set_state(PLAYER_STATE_STOPPED);
 
 		if (player_command == PLAYER_COMMAND_STOP)
 			XPTHREAD_COND_BROADCAST(&player_command_cond);
@@ -513,17 +1635,17 @@ player_print(void)
 	XPTHREAD_MUTEX_UNLOCK(&player_state_mtx);
 }
 
-/*
- * The player_state_mtx mutex must be locked before calling this function.
- */
 static void
 player_print_status(void)
 {
 	struct format		*format;
 	struct format_variable	 vars[PLAYER_FMT_NVARS];
-	unsigned int		 pos;
+	enum player_state	 state;
 	int			 vol;
 
+	vars[PLAYER_FMT_BUFFER].lname = "buffer";
+	vars[PLAYER_FMT_BUFFER].sname = 'b';
+	vars[PLAYER_FMT_BUFFER].type = FORMAT_VARIABLE_NUMBER;
 	vars[PLAYER_FMT_CONTINUE].lname = "continue";
 	vars[PLAYER_FMT_CONTINUE].sname = 'c';
 	vars[PLAYER_FMT_CONTINUE].type = FORMAT_VARIABLE_STRING;
@@ -549,8 +1671,10 @@ player_print_status(void)
 	vars[PLAYER_FMT_VOLUME].sname = 'v';
 	vars[PLAYER_FMT_VOLUME].type = FORMAT_VARIABLE_NUMBER;
 
+	state = atomic_load(&player_status_state);
+
 	/* Set the state variable. */
-	switch (player_state) {
+	switch (state) {
 	case PLAYER_STATE_PAUSED:
 		vars[PLAYER_FMT_STATE].value.string = "Paused";
 		break;
@@ -562,14 +1686,18 @@ player_print_status(void)
 		break;
 	}
 
-	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
-
-	/* Set the position variable. */
-	if (player_state == PLAYER_STATE_STOPPED || player_track->ip == NULL ||
-	    player_track->ip->get_position(player_track, &pos) == -1)
+	/* Set the position and buffer variables. */
+	if (state == PLAYER_STATE_STOPPED) {
 		vars[PLAYER_FMT_POSITION].value.time = 0;
-	else
-		vars[PLAYER_FMT_POSITION].value.time = pos;
+		vars[PLAYER_FMT_BUFFER].value.number = 0;
+	} else {
+		vars[PLAYER_FMT_POSITION].value.time =
+		    atomic_load(&player_status_position);
+		vars[PLAYER_FMT_BUFFER].value.number =
+		    atomic_load(&player_status_buffer);
+	}
+
+	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
 
 	/* Set the duration variable. */
 	if (player_track == NULL)
@@ -577,6 +1705,7 @@ player_print_status(void)
 	else {
 		track_lock_metadata();
 		vars[PLAYER_FMT_DURATION].value.time =
+		    player_prev_track != NULL ? player_prev_track->duration :
 		    player_track->duration;
 		track_unlock_metadata();
 	}
@@ -585,27 +1714,26 @@ player_print_status(void)
 
 	/* Set the volume variable. */
 	XPTHREAD_MUTEX_LOCK(&player_op_mtx);
-	if (player_open_op() == -1 || !player_op->get_volume_support() ||
-	    (vol = player_op->get_volume()) == -1)
+	if (player_open_op() == -1 || (vol = player_get_volume()) == -1)
 		vars[PLAYER_FMT_VOLUME].value.number = 0;
 	else
 		vars[PLAYER_FMT_VOLUME].value.number = vol;
 	XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
 
 	/* Set the continue variable. */
-	if (option_get_boolean("continue"))
+	if (option_handle_get_boolean(player_opt_continue))
 		vars[PLAYER_FMT_CONTINUE].value.string = "continue";
 	else
 		vars[PLAYER_FMT_CONTINUE].value.string = "";
 
 	/* Set the repeat-all variable. */
-	if (option_get_boolean("repeat-all"))
+	if (option_handle_get_boolean(player_opt_repeat_all))
 		vars[PLAYER_FMT_REPEAT_ALL].value.string = "repeat-all";
 	else
 		vars[PLAYER_FMT_REPEAT_ALL].value.string = "";
 
 	/* Set the repeat-track variable. */
-	if (option_get_boolean("repeat-track"))
+	if (option_handle_get_boolean(player_opt_repeat_track))
 		vars[PLAYER_FMT_REPEAT_TRACK].value.string = "repeat-track";
 	else
 		vars[PLAYER_FMT_REPEAT_TRACK].value.string = "";
@@ -644,11 +1772,34 @@ player_print_track(void)
 	track_lock_metadata();
 	fmt = option_get_format("player-track-format");
 	altfmt = option_get_format("player-track-format-alt");
-	screen_player_track_printf(fmt, altfmt, player_track);
+	screen_player_track_printf(fmt, altfmt, player_prev_track != NULL ?
+	    player_prev_track : player_track);
 	track_unlock_metadata();
 	option_unlock();
 }
 
+/*
+ * Publish the playback position and the fill level of the ring buffer.
+ *
+ * This function must be called from the playback thread or with the
+ * player_state_mtx mutex locked.
+ */
+static void
+player_publish_status(void)
+{
+	unsigned int pos;
+
+	if (player_get_position(&pos) == -1)
+		pos = 0;
+	atomic_store(&player_status_position, pos);
+
+	if (player_ring_limit == 0)
+		atomic_store(&player_status_buffer, 0);
+	else
+		atomic_store(&player_status_buffer,
+		    player_ring_get_fill() * 100 / player_ring_limit);
+}
+
 static void
 player_quit(void)
 {
@@ -668,40 +1819,214 @@ player_reopen_op(void)
 	if (player_op_opened) {
 		LOG_INFO("reopening %s", player_op->name);
 		player_op->close();
+		player_op_started = 0;
 		if (player_op->open() != 0)
 			player_op_opened = 0;
 	}
 	XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
 }
 
+/*
+ * Return whether the playback thread has reached the start of the next track
+ * in the ring buffer.
+ */
+static int
+player_ring_at_boundary(void)
+{
+	return atomic_load(&player_ring_boundary_pending) &&
+	    atomic_load(&player_ring_boundary) ==
+	    atomic_load(&player_ring_tail);
+}
+
+static size_t
+player_ring_get_fill(void)
+{
+	return atomic_load(&player_ring_head) - atomic_load(&player_ring_tail);
+}
+
+/*
+ * Return whether player_ring_read() can return without waiting. Nothing can
+ * be read past the start of the next track, so the samples up to it are
+ * enough even if they are fewer than len bytes.
+ */
+static int
+player_ring_readable(size_t len)
+{
+	size_t fill;
+
+	if (atomic_load(&player_decode_status) != PLAYER_DECODE_RUNNING ||
+	    atomic_load(&player_decode_quit))
+		return 1;
+
+	fill = player_ring_get_fill();
+	if (atomic_load(&player_ring_boundary_pending) &&
+	    atomic_load(&player_ring_boundary) - atomic_load(&player_ring_tail)
+	    <= fill)
+		return 1;
+	return fill >= len;
+}
+
+/*
+ * Read up to len bytes from the ring buffer. Block until len bytes or the
+ * samples up to the start of the next track are available, or the decode
+ * thread has finished. Return the number of bytes
+ * read. Nothing is read past the start of the next track, so 0 is returned
+ * also if that has been reached.
+ */
+static size_t
+player_ring_read(void *buf, size_t len)
+{
+	size_t boundary, fill, n, off, tail;
+
+	if (!player_ring_readable(len)) {
+		if (player_ring_primed) {
+			player_ring_underruns++;
+			LOG_DEBUG("buffer underrun");
+		}
+
+		XPTHREAD_MUTEX_LOCK(&player_ring_mtx);
+		atomic_store(&player_ring_reader_waiting, 1);
+		while (!player_ring_readable(len))
+			XPTHREAD_COND_WAIT(&player_ring_cond,
+			    &player_ring_mtx);
+		atomic_store(&player_ring_reader_waiting, 0);
+		XPTHREAD_MUTEX_UNLOCK(&player_ring_mtx);
+	}
+
+	tail = atomic_load(&player_ring_tail);
+	fill = atomic_load(&player_ring_head) - tail;
+	if (len > fill)
+		len = fill;
+
+	/* Do not read past the start of the next track. */
+	if (atomic_load(&player_ring_boundary_pending)) {
+		boundary = atomic_load(&player_ring_boundary);
+		if (len > boundary - tail)
+			len = boundary - tail;
+	}
+
+	off = tail & (player_ring_size - 1);
+	n = player_ring_size - off;
+	if (n > len)
+		n = len;
+
+	memcpy(buf, player_ring_data + off, n);
+	memcpy((char *)buf + n, player_ring_data, len - n);
+	atomic_store(&player_ring_tail, tail + len);
+
+	if (len > 0)
+		player_ring_primed = 1;
+
+	if (atomic_load(&player_ring_writer_waiting))
+		player_ring_wakeup();
+
+	return len;
+}
+
+static void
+player_ring_wakeup(void)
+{
+	XPTHREAD_MUTEX_LOCK(&player_ring_mtx);
+	XPTHREAD_COND_BROADCAST(&player_ring_cond);
+	XPTHREAD_MUTEX_UNLOCK(&player_ring_mtx);
+}
+
+static int
+player_ring_writable(void)
+{
+	if (atomic_load(&player_decode_quit))
+		return 1;
+	return player_ring_get_fill() < player_ring_limit;
+}
+
+/*
+ * Write len bytes to the ring buffer. Block while the ring buffer is full.
+ * Return -1 if the decode thread has been asked to quit.
+ */
+static int
+player_ring_write(const void *buf, size_t len)
+{
+	size_t head, n, off;
+
+	while (len > 0) {
+		if (!player_ring_writable()) {
+			XPTHREAD_MUTEX_LOCK(&player_ring_mtx);
+			atomic_store(&player_ring_writer_waiting, 1);
+			while (!player_ring_writable())
+				XPTHREAD_COND_WAIT(&player_ring_cond,
+				    &player_ring_mtx);
+			atomic_store(&player_ring_writer_waiting, 0);
+			XPTHREAD_MUTEX_UNLOCK(&player_ring_mtx);
+		}
+
+		if (atomic_load(&player_decode_quit))
+			return -1;
+
+		head = atomic_load(&player_ring_head);
+		off = head & (player_ring_size - 1);
+		n = player_ring_limit - player_ring_get_fill();
+		if (n > player_ring_size - off)
+			n = player_ring_size - off;
+		if (n > len)
+			n = len;
+
+		memcpy(player_ring_data + off, buf, n);
+		atomic_store(&player_ring_head, head + n);
+
+		buf = (const char *)buf + n;
+		len -= n;
+
+		if (atomic_load(&player_ring_reader_waiting))
+			player_ring_wakeup();
+	}
+
+	return 0;
+}
+
 void
 player_seek(int pos, int relative)
 {
 	unsigned int curpos;
 
 	XPTHREAD_MUTEX_LOCK(&player_state_mtx);
-	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
-
 	if (player_state == PLAYER_STATE_STOPPED)
 		goto out;
 
+	/*
+	 * A seek applies to the track being decoded. If the previous track is
+	 * still being heard, the current one is at its start.
+	 */
 	if (relative) {
-		if (player_track->ip->get_position(player_track, &curpos))
+		if (player_prev_track != NULL)
+			curpos = 0;
+		else if (player_get_position(&curpos))
 			goto out;
 		pos += curpos;
 	}
 
+	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
 	if (pos < 0)
 		pos = 0;
 	else if ((unsigned int)pos > player_track->duration)
 		pos = player_track->duration;
 
-	player_track->ip->seek(player_track, pos);
+	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+
+	/*
+	 * If playback is paused, the playback thread is waiting for a command
+	 * and does not read from the ring buffer, so we can seek directly.
+	 * Otherwise, let the playback thread do the seek.
+	 */
+	if (player_state == PLAYER_STATE_PAUSED)
+		player_decode_seek(pos);
+	else {
+		player_seek_pos = pos;
+		player_seek_pending = 1;
+	}
 
 out:
-	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
-	player_print_status();
 	XPTHREAD_MUTEX_UNLOCK(&player_state_mtx);
+	player_update_status();
 }
 
 static void
@@ -719,7 +2044,18 @@ player_set_source(enum player_source source)
 	XPTHREAD_MUTEX_LOCK(&player_source_mtx);
 	player_source = source;
 	XPTHREAD_MUTEX_UNLOCK(&player_source_mtx);
-	player_print_status();
+	player_update_status();
+}
+
+/*
+ * The player_state_mtx mutex must be locked before calling this function.
+ */
+static void
+player_set_state(enum player_state state)
+{
+	player_state = state;
+	atomic_store(&player_status_state, state);
+	player_update_status();
 }
 
 void
@@ -732,13 +2068,8 @@ player_set_volume(int volume, int relative)
 	if (player_open_op() == -1)
 		goto out;
 
-	if (!player_op->get_volume_support()) {
-		msg_errx("Output plug-in does not have volume support");
-		goto out;
-	}
-
 	if (relative) {
-		if ((ret = player_op->get_volume()) == -1)
+		if ((ret = player_get_volume()) == -1)
 			goto out;
 
 		volume += ret;
@@ -748,13 +2079,112 @@ player_set_volume(int volume, int relative)
 			volume = 100;
 	}
 
-	player_op->set_volume(volume);
+	if (player_use_software_volume()) {
+		atomic_store(&player_software_volume, volume);
+		atomic_store(&player_dsp_changed, 1);
+	} else {
+		player_op->set_volume(volume);
+		if (player_op->set_volume_handler != NULL)
+			atomic_store(&player_volume, volume);
+	}
 
 out:
 	XPTHREAD_MUTEX_UNLOCK(&player_op_mtx);
-	XPTHREAD_MUTEX_LOCK(&player_state_mtx);
-	player_print_status();
-	XPTHREAD_MUTEX_UNLOCK(&player_state_mtx);
+	player_update_status();
+}
+
+/*
+ * Start the output plug-in. If it is still running from the previous track
+ * and the sample format has not changed, then there is nothing to do. If only
+ * the sampling rate has changed, then try to change it without restarting the
+ * output plug-in.
+ *
+ * The player_op_mtx mutex must be locked before calling this function.
+ */
+static int
+player_start_op(struct sample_format *sf)
+{
+	if (player_op_started) {
+		if (sf->encoding == player_op_format.encoding &&
+		    sf->nbits == player_op_format.nbits &&
+		    sf->nchannels == player_op_format.nchannels) {
+			if (sf->rate == player_op_format.rate) {
+				sf->byte_order = player_op_format.byte_order;
+				return 0;
+			}
+
+			if (player_op->set_rate != NULL &&
+			    player_op->set_rate(sf->rate) == 0) {
+				LOG_DEBUG("changed rate to %u", sf->rate);
+				sf->byte_order = player_op_format.byte_order;
+				player_op_format = *sf;
+				return 0;
+			}
+		}
+
+		player_stop_op();
+		if (player_open_op() == -1)
+			return -1;
+	}
+
+	if (player_op->start(sf) == -1)
+		return -1;
+
+	player_op_format = *sf;
+	player_op_started = 1;
+	return 0;
+}
+
+static void *
+player_status_handler(UNUSED void *p)
+{
+	struct timespec	ts;
+	long		nsecs;
+	int		track;
+
+	player_set_signal_mask();
+
+	XPTHREAD_MUTEX_LOCK(&player_status_mtx);
+	for (;;) {
+		if (!player_status_pending && !player_status_quit) {
+			if (atomic_load(&player_status_state) !=
+			    PLAYER_STATE_PLAYING)
+				/* Nothing changes until we are woken up. */
+				XPTHREAD_COND_WAIT(&player_status_cond,
+				    &player_status_mtx);
+			else {
+				nsecs = 1000000000L / option_handle_get_number(
+				    player_opt_status_rate);
+				clock_gettime(CLOCK_REALTIME, &ts);
+				ts.tv_sec += (ts.tv_nsec + nsecs) / 1000000000L;
+				ts.tv_nsec = (ts.tv_nsec + nsecs) % 1000000000L;
+
+				errno = pthread_cond_timedwait(
+				    &player_status_cond, &player_status_mtx,
+				    &ts);
+				if (errno != 0 && errno != ETIMEDOUT)
+					LOG_FATAL("pthread_cond_timedwait");
+			}
+		}
+
+		if (player_status_quit)
+			break;
+
+		track = player_status_track;
+		player_status_pending = player_status_track = 0;
+		XPTHREAD_MUTEX_UNLOCK(&player_status_mtx);
+
+		if (track) {
+			XPTHREAD_MUTEX_LOCK(&player_state_mtx);
+			player_print_track();
+			XPTHREAD_MUTEX_UNLOCK(&player_state_mtx);
+		}
+		player_print_status();
+		XPTHREAD_MUTEX_LOCK(&player_status_mtx);
+	}
+	XPTHREAD_MUTEX_UNLOCK(&player_status_mtx);
+
+	return NULL;
 }
 
 void
@@ -769,3 +2199,107 @@ player_stop(void)
 	}
 	XPTHREAD_MUTEX_UNLOCK(&player_state_mtx);
 }
+
+/*
+ * The player_op_mtx mutex must be locked before calling this function.
+ */
+static void
+player_stop_op(void)
+{
+	if (player_op_started) {
+		if (player_op->stop() == -1)
+			player_close_op();
+		player_op_started = 0;
+	}
+}
+
+/*
+ * Make the next track in the ring buffer the current track and advance the
+ * queue or the player source to it. Return -1 if the user has changed what
+ * comes next since the decode thread opened the track. Its samples must then
+ * not be played; the current track is to end here instead.
+ */
+static int
+player_switch_track(void)
+{
+	struct track *t;
+
+	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+	t = player_decode_track;
+	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+	if (player_peek_next_track() != t) {
+		LOG_DEBUG("%s: no longer the next track", t->path);
+		return -1;
+	}
+	player_get_next_track();
+
+	XPTHREAD_MUTEX_LOCK(&player_state_mtx);
+
+	/* The previous track may have been shorter than the output buffer. */
+	if (player_prev_track != NULL)
+		player_finish_switch();
+
+	/*
+	 * Keep showing the current track until the output plug-in has played
+	 * the samples of it that are still buffered.
+	 */
+	XPTHREAD_MUTEX_LOCK(&player_track_mtx);
+	player_prev_track = player_track;
+	player_prev_frames = atomic_load(&player_position_frames);
+	if (player_track != player_decode_track) {
+		player_track->ip->close(player_track);
+		player_track = player_decode_track;
+	}
+	XPTHREAD_MUTEX_UNLOCK(&player_track_mtx);
+
+	atomic_store(&player_ring_boundary_pending, 0);
+	atomic_store(&player_dsp_changed, 1);
+	XPTHREAD_MUTEX_UNLOCK(&player_state_mtx);
+
+	if (atomic_load(&player_ring_writer_waiting))
+		player_ring_wakeup();
+
+	clock_gettime(CLOCK_MONOTONIC, &player_eof_time);
+	player_eof_pending = 1;
+	return 0;
+}
+
+/*
+ * Wake up the status thread so that it prints the player status.
+ */
+static void
+player_update_status(void)
+{
+	XPTHREAD_MUTEX_LOCK(&player_status_mtx);
+	player_status_pending = 1;
+	XPTHREAD_COND_BROADCAST(&player_status_cond);
+	XPTHREAD_MUTEX_UNLOCK(&player_status_mtx);
+}
+
+/*
+ * Wake up the status thread so that it prints the current track as well as
+ * the player status. This function can be called from any thread.
+ */
+void
+player_update_track(void)
+{
+	XPTHREAD_MUTEX_LOCK(&player_status_mtx);
+	player_status_pending = 1;
+	player_status_track = 1;
+	XPTHREAD_COND_BROADCAST(&player_status_cond);
+	XPTHREAD_MUTEX_UNLOCK(&player_status_mtx);
+}
+
+/*
+ * Return whether the software volume level is used instead of the volume
+ * level of the output plug-in.
+ *
+ * The player_op_mtx mutex must be locked before calling this function.
+ */
+static int
+player_use_software_volume(void)
+{
+	if (option_handle_get_boolean(player_opt_software_volume))
+		return 1;
+	return player_op_opened && !player_op->get_volume_support();
+}
@@ -23,6 +23,10 @@
 
 #include "siren.h"
 
+/* Number of tracks after which the playlist is printed while loading. */
+#define PLAYLIST_LOAD_BATCH	64
+
+static struct track	*playlist_find_next_track(int);
 static int		 playlist_search_entry(const void *, const char *);
 
 static pthread_mutex_t	 playlist_menu_mtx = PTHREAD_MUTEX_INITIALIZER;
@@ -31,6 +35,7 @@ static struct format	*playlist_format;
 static struct menu	*playlist_menu;
 static unsigned int	 playlist_duration;
 static char		*playlist_file;
+static struct option_entry *playlist_repeat_all;
 
 void
 playlist_activate_entry(void)
@@ -72,18 +77,12 @@ playlist_end(void)
 	free(playlist_file);
 }
 
-static void
-playlist_get_entry_text(const void *e, char *buf, size_t bufsize)
-{
-	const struct track *t;
-
-	t = e;
-	format_track_snprintf(buf, bufsize, playlist_format,
-	    playlist_altformat, t);
-}
-
-struct track *
-playlist_get_next_track(void)
+/*
+ * Return the track after the active one. If activate is set, the track is also
+ * made the active one.
+ */
+static struct track *
+playlist_find_next_track(int activate)
 {
 	struct menu_entry	*e;
 	struct track		*t;
@@ -93,22 +92,40 @@ playlist_get_next_track(void)
 		t = NULL;
 	else {
 		if ((e = menu_get_next_entry(e)) == NULL &&
-		    option_get_boolean("repeat-all"))
+		    option_handle_get_boolean(playlist_repeat_all))
 			e = menu_get_first_entry(playlist_menu);
 
 		if (e == NULL)
 			t = NULL;
 		else {
-			menu_activate_entry(playlist_menu, e);
+			if (activate)
+				menu_activate_entry(playlist_menu, e);
 			t = menu_get_entry_data(e);
 		}
 	}
 	XPTHREAD_MUTEX_UNLOCK(&playlist_menu_mtx);
 
-	playlist_print();
+	if (activate)
+		view_set_dirty(VIEW_ID_PLAYLIST);
 	return t;
 }
 
+static void
+playlist_get_entry_text(const void *e, char *buf, size_t bufsize)
+{
+	const struct track *t;
+
+	t = e;
+	format_track_snprintf(buf, bufsize, playlist_format,
+	    playlist_altformat, t);
+}
+
+struct track *
+playlist_get_next_track(void)
+{
+	return playlist_find_next_track(1);
+}
+
 struct track *
 playlist_get_prev_track(void)
 {
@@ -120,7 +137,7 @@ playlist_get_prev_track(void)
 		t = NULL;
 	else {
 		if ((e = menu_get_prev_entry(e)) == NULL &&
-		    option_get_boolean("repeat-all"))
+		    option_handle_get_boolean(playlist_repeat_all))
 			e = menu_get_last_entry(playlist_menu);
 
 		if (e == NULL)
@@ -132,7 +149,7 @@ playlist_get_prev_track(void)
 	}
 	XPTHREAD_MUTEX_UNLOCK(&playlist_menu_mtx);
 
-	playlist_print();
+	view_set_dirty(VIEW_ID_PLAYLIST);
 	return t;
 }
 
@@ -141,6 +158,8 @@ playlist_init(void)
 {
 	playlist_menu = menu_init(NULL, playlist_get_entry_text,
 	    playlist_search_entry);
+	playlist_repeat_all = option_get_handle("repeat-all",
+	    OPTION_TYPE_BOOLEAN);
 }
 
 void
@@ -148,7 +167,7 @@ playlist_load(const char *file)
 {
 	struct track		*t;
 	FILE			*fp;
-	size_t			 size;
+	size_t			 n, size;
 	ssize_t			 len;
 	char			*dir, *line, *path, *tmp;
 
@@ -167,9 +186,18 @@ playlist_load(const char *file)
 	playlist_file = path_normalise(file);
 	dir = path_get_dirname(playlist_file);
 
+	XPTHREAD_MUTEX_UNLOCK(&playlist_menu_mtx);
+
+	/*
+	 * Reading the metadata of new tracks can take a while, so do not keep
+	 * the menu locked meanwhile and have it redrawn now and then.
+	 */
+	view_set_dirty(VIEW_ID_PLAYLIST);
+
+	n = 0;
 	line = NULL;
 	size = 0;
-	while ((len = getline(&line, &size, fp)) != -1) {
+	while (!job_is_cancelled() && (len = getline(&line, &size, fp)) != -1) {
 		/* Strip both \n and \r\n EOLs. */
 		if (len > 0 && line[len - 1] == '\n') {
 			if (len > 1 && line[len - 2] == '\r')
@@ -190,8 +218,13 @@ playlist_load(const char *file)
 		}
 
 		if ((t = track_require(path)) != NULL) {
+			XPTHREAD_MUTEX_LOCK(&playlist_menu_mtx);
 			menu_insert_tail(playlist_menu, t);
 			playlist_duration += t->duration;
+			XPTHREAD_MUTEX_UNLOCK(&playlist_menu_mtx);
+
+			if (++n % PLAYLIST_LOAD_BATCH == 0)
+				view_set_dirty(VIEW_ID_PLAYLIST);
 		}
 
 		free(path);
@@ -204,12 +237,9 @@ playlist_load(const char *file)
 
 	free(line);
 	free(dir);
-
-	XPTHREAD_MUTEX_UNLOCK(&playlist_menu_mtx);
-
 	fclose(fp);
 
-	playlist_print();
+	view_set_dirty(VIEW_ID_PLAYLIST);
 }
 
 void
@@ -219,12 +249,23 @@ playlist_reactivate_entry(void)
 	struct track		*t;
 
 	XPTHREAD_MUTEX_LOCK(&playlist_menu_mtx);
-	if ((e = menu_get_active_entry(playlist_menu)) != NULL) {
+	if ((e = menu_get_active_entry(playlist_menu)) != NULL)
 		t = menu_get_entry_data(e);
+	else
+		t = NULL;
+	XPTHREAD_MUTEX_UNLOCK(&playlist_menu_mtx);
+
+	/* The player may need the menu to stop playback. */
+	if (t != NULL) {
 		player_set_source(PLAYER_SOURCE_PLAYLIST);
 		player_play_track(t);
 	}
-	XPTHREAD_MUTEX_UNLOCK(&playlist_menu_mtx);
+}
+
+struct track *
+playlist_peek_next_track(void)
+{
+	return playlist_find_next_track(0);
 }
 
 void
@@ -244,7 +285,9 @@ playlist_print(void)
 	option_lock();
 	playlist_format = option_get_format("playlist-format");
 	playlist_altformat = option_get_format("playlist-format-alt");
+	track_lock_metadata();
 	menu_print(playlist_menu);
+	track_unlock_metadata();
 	option_unlock();
 	XPTHREAD_MUTEX_UNLOCK(&playlist_menu_mtx);
 }
@@ -353,4 +396,5 @@ playlist_update(void)
 		playlist_duration += t->duration;
 	}
 	XPTHREAD_MUTEX_UNLOCK(&playlist_menu_mtx);
+	view_set_dirty(VIEW_ID_PLAYLIST);
 }
@@ -167,6 +167,18 @@ plugin_find_op(const char *name)
 	return op;
 }
 
+/*
+ * Call the specified function for each input plug-in.
+ */
+void
+plugin_foreach_ip(void (*func)(const struct ip *, void *), void *arg)
+{
+	struct plugin_ip_entry *ipe;
+
+	SLIST_FOREACH(ipe, &plugin_ip_list, entries)
+		func(ipe->ip, arg);
+}
+
 void
 plugin_init(void)
 {
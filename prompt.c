@@ -31,6 +31,7 @@ enum prompt_mode {
 	PROMPT_MODE_LINE
 };
 
+static void		 prompt_char_handle_key(int);
 static void		 prompt_line_handle_key(int);
 static void		 prompt_mode_begin(enum prompt_mode, const char *,
 			    struct history *, void (*)(char *, void *), void *)
@@ -87,6 +88,28 @@ prompt_adjust_scroll_offset(void)
 	}
 }
 
+/*
+ * Answer the current prompt as if the specified answer had been typed and
+ * confirmed. This is used in batch mode, where there is no terminal to read
+ * keys from.
+ */
+void
+prompt_answer(const char *answer)
+{
+	if (prompt_mode == PROMPT_MODE_CHAR)
+		prompt_char_handle_key(answer[0] == 'n' || answer[0] == 'N' ?
+		    'n' : 'y');
+	else {
+		free(prompt_line);
+		if (prompt_history != NULL && answer[0] != '\0') {
+			prompt_line = xstrdup(answer);
+			history_add(prompt_history, prompt_line);
+		} else
+			prompt_line = NULL;
+		prompt_mode_end();
+	}
+}
+
 void
 prompt_end(void)
 {
@@ -18,7 +18,6 @@
 
 #include <pthread.h>
 #include <stdlib.h>
-#include <string.h>
 
 #include "siren.h"
 
@@ -51,31 +50,7 @@ queue_activate_entry(void)
 void
 queue_add_dir(const char *path)
 {
-	struct dir		*d;
-	struct dir_entry	*de;
-	struct track		*t;
-
-	if ((d = dir_open(path)) == NULL) {
-		msg_err("%s", path);
-		return;
-	}
-
-	while ((de = dir_get_entry(d)) != NULL)
-		switch (de->type) {
-		case FILE_TYPE_DIRECTORY:
-			if (strcmp(de->name, ".") && strcmp(de->name, ".."))
-				queue_add_dir(de->path);
-			break;
-		case FILE_TYPE_REGULAR:
-			if ((t = track_get(de->path, NULL)) != NULL)
-				queue_add_track(t);
-			break;
-		default:
-			msg_errx("%s: Unsupported file type", de->path);
-			break;
-		}
-
-	dir_close(d);
+	track_add_dir(path, queue_add_tracks);
 }
 
 void
@@ -85,7 +60,21 @@ queue_add_track(struct track *t)
 	menu_insert_tail(queue_menu, t);
 	queue_duration += t->duration;
 	XPTHREAD_MUTEX_UNLOCK(&queue_menu_mtx);
-	queue_print();
+	view_set_dirty(VIEW_ID_QUEUE);
+}
+
+void
+queue_add_tracks(struct track **tracks, size_t ntracks)
+{
+	size_t i;
+
+	XPTHREAD_MUTEX_LOCK(&queue_menu_mtx);
+	for (i = 0; i < ntracks; i++) {
+		menu_insert_tail(queue_menu, tracks[i]);
+		queue_duration += tracks[i]->duration;
+	}
+	XPTHREAD_MUTEX_UNLOCK(&queue_menu_mtx);
+	view_set_dirty(VIEW_ID_QUEUE);
 }
 
 void
@@ -158,7 +147,7 @@ queue_get_next_track(void)
 	XPTHREAD_MUTEX_UNLOCK(&queue_menu_mtx);
 
 	if (t != NULL)
-		queue_print();
+		view_set_dirty(VIEW_ID_QUEUE);
 
 	return t;
 }
@@ -193,6 +182,21 @@ queue_move_entry_up(void)
 	queue_print();
 }
 
+struct track *
+queue_peek_next_track(void)
+{
+	struct menu_entry	*me;
+	struct track		*t;
+
+	XPTHREAD_MUTEX_LOCK(&queue_menu_mtx);
+	if ((me = menu_get_first_entry(queue_menu)) == NULL)
+		t = NULL;
+	else
+		t = menu_get_entry_data(me);
+	XPTHREAD_MUTEX_UNLOCK(&queue_menu_mtx);
+	return t;
+}
+
 void
 queue_print(void)
 {
@@ -209,7 +213,9 @@ queue_print(void)
 	option_lock();
 	queue_format = option_get_format("queue-format");
 	queue_altformat = option_get_format("queue-format-alt");
+	track_lock_metadata();
 	menu_print(queue_menu);
+	track_unlock_metadata();
 	option_unlock();
 	XPTHREAD_MUTEX_UNLOCK(&queue_menu_mtx);
 }
@@ -309,4 +315,5 @@ queue_update(void)
 		queue_duration += t->duration;
 	}
 	XPTHREAD_MUTEX_UNLOCK(&queue_menu_mtx);
+	view_set_dirty(VIEW_ID_QUEUE);
 }
@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2016 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Polyphase sample-rate converter. The conversion ratio is reduced to a
+ * fraction up/down. Conceptually, the input is upsampled by a factor up,
+ * low-pass filtered and downsampled by a factor down. Only the filter phases
+ * that are actually needed are computed: each output sample is the dot
+ * product of one of the up phases of a Kaiser-windowed sinc filter and ntaps
+ * consecutive input samples.
+ *
+ * Samples are converted to float and stored per channel, so that the dot
+ * products can be computed by the vectorised sample_dot() kernel. The
+ * resampler is used by the decode thread of the player only.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "siren.h"
+
+/* The maximum number of filter phases. */
+#define RESAMPLE_MAX_PHASES	1024
+
+struct resample_quality {
+	const char	*name;
+	unsigned int	 ntaps;
+	double		 rolloff;
+	double		 beta;
+};
+
+static unsigned int	 resample_gcd(unsigned int, unsigned int);
+static double		 resample_i0(double);
+static size_t		 resample_run(void);
+static void		 resample_write_frame(size_t, unsigned int);
+
+static const struct resample_quality resample_qualities[] = {
+	{ "low",	16,	0.90,	6.0 },
+	{ "medium",	32,	0.94,	8.5 },
+	{ "high",	64,	0.96,	10.0 }
+};
+
+static unsigned int	 resample_up;
+static unsigned int	 resample_down;
+static unsigned int	 resample_ntaps;
+static unsigned int	 resample_nchannels;
+static unsigned int	 resample_nbytes;
+static float		 resample_max;
+static float		*resample_filter;
+
+/*
+ * The input samples of each channel. The first resample_pos samples have been
+ * consumed. The next output sample is computed at phase resample_phase from
+ * the resample_ntaps samples starting at resample_pos.
+ */
+static float		**resample_in;
+static size_t		  resample_inlen;
+static size_t		  resample_insize;
+static size_t		  resample_pos;
+static unsigned int	  resample_phase;
+
+static void		*resample_out;
+static size_t		 resample_outsize;
+
+void
+resample_close(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < resample_nchannels; i++)
+		free(resample_in[i]);
+	free(resample_in);
+	free(resample_filter);
+	free(resample_out);
+	resample_in = NULL;
+	resample_filter = NULL;
+	resample_out = NULL;
+	resample_nchannels = 0;
+}
+
+/*
+ * Return whether the resampler has been enabled by the user.
+ */
+int
+resample_enabled(void)
+{
+	char	*name;
+	int	 enabled;
+
+	name = option_get_string("resample-quality");
+	enabled = strcmp(name, "off") != 0;
+	free(name);
+	return enabled;
+}
+
+/*
+ * Process the remaining input samples as if the input were followed by
+ * silence. The output is returned as in resample_process().
+ */
+size_t
+resample_flush(void **out)
+{
+	size_t		n, nframes;
+	unsigned int	i;
+
+	n = resample_ntaps / 2;
+	if (resample_inlen + n > resample_insize) {
+		resample_insize = resample_inlen + n;
+		for (i = 0; i < resample_nchannels; i++)
+			resample_in[i] = xreallocarray(resample_in[i],
+			    resample_insize, sizeof **resample_in);
+	}
+
+	for (i = 0; i < resample_nchannels; i++)
+		memset(resample_in[i] + resample_inlen, 0,
+		    n * sizeof **resample_in);
+	resample_inlen += n;
+
+	nframes = resample_run();
+	*out = resample_out;
+	return nframes * resample_nchannels * resample_nbytes;
+}
+
+static unsigned int
+resample_gcd(unsigned int a, unsigned int b)
+{
+	unsigned int t;
+
+	while (b != 0) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/*
+ * Compute the zeroth-order modified Bessel function of the first kind, which
+ * is used by the Kaiser window.
+ */
+static double
+resample_i0(double x)
+{
+	double		sum, term;
+	unsigned int	k;
+
+	sum = term = 1.0;
+	for (k = 1; term > sum * 1e-12; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+/*
+ * Prepare to convert samples in the specified format to the specified rate.
+ */
+int
+resample_open(const struct sample_format *sf, unsigned int outrate)
+{
+	const struct resample_quality	*q;
+	double				 cutoff, sum, t, x;
+	unsigned int			 gcd, i, j, p;
+	char				*name;
+
+	name = option_get_string("resample-quality");
+	q = NULL;
+	for (i = 0; i < nitems(resample_qualities); i++)
+		if (!strcmp(name, resample_qualities[i].name))
+			q = &resample_qualities[i];
+
+	if (q == NULL) {
+		LOG_ERRX("%s: invalid resample quality", name);
+		msg_errx("Cannot resample from %u to %u Hz: resampling is "
+		    "disabled", sf->rate, outrate);
+		free(name);
+		return -1;
+	}
+	free(name);
+
+	gcd = resample_gcd(sf->rate, outrate);
+	if (outrate / gcd > RESAMPLE_MAX_PHASES) {
+		LOG_ERRX("%u/%u: too many phases", outrate / gcd,
+		    sf->rate / gcd);
+		msg_errx("Cannot resample from %u to %u Hz", sf->rate,
+		    outrate);
+		return -1;
+	}
+
+	resample_close();
+
+	resample_up = outrate / gcd;
+	resample_down = sf->rate / gcd;
+	resample_ntaps = q->ntaps;
+	resample_nchannels = sf->nchannels;
+
+	if (sf->nbits <= 8)
+		resample_nbytes = 1;
+	else if (sf->nbits <= 16)
+		resample_nbytes = 2;
+	else
+		resample_nbytes = 4;
+
+	/* Samples with more than 24 bits are clipped as in the DSP stage. */
+	if (sf->nbits > 24)
+		resample_max = INT32_MAX - 127;
+	else
+		resample_max = ((int32_t)1 << (sf->nbits - 1)) - 1;
+
+	/*
+	 * The cut-off frequency, relative to the input sample rate, is just
+	 * below the Nyquist frequency of the lower of both rates.
+	 */
+	cutoff = 0.5 * q->rolloff;
+	if (resample_up < resample_down)
+		cutoff = cutoff * resample_up / resample_down;
+
+	resample_filter = xreallocarray(NULL, resample_up * resample_ntaps,
+	    sizeof *resample_filter);
+
+	for (p = 0; p < resample_up; p++) {
+		sum = 0.0;
+		for (j = 0; j < resample_ntaps; j++) {
+			/* The distance from the output to the input sample. */
+			t = (double)p / resample_up + resample_ntaps / 2 - 1 -
+			    j;
+			x = 2.0 * cutoff * t;
+			x = (x == 0.0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+			x *= 2.0 * cutoff;
+
+			/* Apply the Kaiser window. */
+			t /= resample_ntaps / 2.0;
+			if (t < -1.0 || t > 1.0)
+				t = 1.0;
+			x *= resample_i0(q->beta * sqrt(1.0 - t * t)) /
+			    resample_i0(q->beta);
+
+			resample_filter[p * resample_ntaps + j] = x;
+			sum += x;
+		}
+
+		/* Normalise the gain of each phase. */
+		for (j = 0; j < resample_ntaps; j++)
+			resample_filter[p * resample_ntaps + j] /= sum;
+	}
+
+	resample_insize = 0;
+	resample_in = xreallocarray(NULL, resample_nchannels,
+	    sizeof *resample_in);
+	for (i = 0; i < resample_nchannels; i++)
+		resample_in[i] = NULL;
+
+	resample_out = NULL;
+	resample_outsize = 0;
+	resample_reset();
+
+	LOG_INFO("%u Hz to %u Hz, up=%u, down=%u, quality=%s", sf->rate,
+	    outrate, resample_up, resample_down, q->name);
+	return 0;
+}
+
+/*
+ * Resample the samples in the sample buffer. A pointer to the output is
+ * stored in *out and its size in bytes is returned. The output remains valid
+ * until the next call to a resample function.
+ */
+size_t
+resample_process(const struct sample_buffer *sb, void **out)
+{
+	float		*in;
+	size_t		 i, nframes;
+	unsigned int	 j;
+
+	nframes = sb->len_s / resample_nchannels;
+
+	if (resample_inlen + nframes > resample_insize) {
+		resample_insize = resample_inlen + nframes;
+		for (j = 0; j < resample_nchannels; j++)
+			resample_in[j] = xreallocarray(resample_in[j],
+			    resample_insize, sizeof **resample_in);
+	}
+
+	/* Deinterleave the samples and convert them to float. */
+	for (j = 0; j < resample_nchannels; j++) {
+		in = resample_in[j] + resample_inlen;
+		if (resample_nbytes == 1)
+			for (i = 0; i < nframes; i++)
+				in[i] = sb->data1[i * resample_nchannels + j];
+		else if (resample_nbytes == 2)
+			for (i = 0; i < nframes; i++)
+				in[i] = sb->data2[i * resample_nchannels + j];
+		else
+			for (i = 0; i < nframes; i++)
+				in[i] = sb->data4[i * resample_nchannels + j];
+	}
+	resample_inlen += nframes;
+
+	nframes = resample_run();
+	*out = resample_out;
+	return nframes * resample_nchannels * resample_nbytes;
+}
+
+/*
+ * Discard all buffered samples. This function is called after seeking.
+ */
+void
+resample_reset(void)
+{
+	unsigned int	i;
+	size_t		n;
+
+	/*
+	 * Start with ntaps / 2 - 1 samples of silence, so that the first
+	 * output sample is centred on the first input sample.
+	 */
+	n = resample_ntaps / 2 - 1;
+	if (n > resample_insize) {
+		resample_insize = n;
+		for (i = 0; i < resample_nchannels; i++)
+			resample_in[i] = xreallocarray(resample_in[i],
+			    resample_insize, sizeof **resample_in);
+	}
+
+	for (i = 0; i < resample_nchannels; i++)
+		memset(resample_in[i], 0, n * sizeof **resample_in);
+	resample_inlen = n;
+	resample_pos = 0;
+	resample_phase = 0;
+}
+
+/*
+ * Compute as many output frames as possible from the buffered input and
+ * return their number.
+ */
+static size_t
+resample_run(void)
+{
+	size_t		i, maxframes, nframes, size;
+	unsigned int	j;
+
+	if (resample_inlen < resample_pos + resample_ntaps)
+		return 0;
+
+	/* Make sure the output buffer is large enough. */
+	maxframes = (resample_inlen - resample_pos - resample_ntaps + 1) *
+	    resample_up / resample_down + 1;
+	size = maxframes * resample_nchannels * resample_nbytes;
+	if (size > resample_outsize) {
+		resample_outsize = size;
+		resample_out = xrealloc(resample_out, resample_outsize);
+	}
+
+	nframes = 0;
+	while (resample_pos + resample_ntaps <= resample_inlen) {
+		resample_write_frame(nframes++, resample_phase);
+
+		resample_phase += resample_down;
+		resample_pos += resample_phase / resample_up;
+		resample_phase %= resample_up;
+	}
+
+	/* Discard the consumed input. */
+	i = resample_pos < resample_inlen ? resample_pos : resample_inlen;
+	for (j = 0; j < resample_nchannels; j++)
+		memmove(resample_in[j], resample_in[j] + i,
+		    (resample_inlen - i) * sizeof **resample_in);
+	resample_inlen -= i;
+	resample_pos -= i;
+
+	return nframes;
+}
+
+static void
+resample_write_frame(size_t frame, unsigned int phase)
+{
+	const float	*filter;
+	float		 x;
+	size_t		 idx;
+	unsigned int	 i;
+
+	filter = resample_filter + phase * resample_ntaps;
+	idx = frame * resample_nchannels;
+
+	for (i = 0; i < resample_nchannels; i++, idx++) {
+		x = sample_dot(filter, resample_in[i] + resample_pos,
+		    resample_ntaps);
+
+		x = x < resample_max ? x : resample_max;
+		x = x > -resample_max - 1.0f ? x : -resample_max - 1.0f;
+		x = rintf(x);
+
+		if (resample_nbytes == 1)
+			((int8_t *)resample_out)[idx] = x;
+		else if (resample_nbytes == 2)
+			((int16_t *)resample_out)[idx] = x;
+		else
+			((int32_t *)resample_out)[idx] = x;
+	}
+}
@@ -0,0 +1,1484 @@
+/*
+ * Copyright (c) 2016 Tim van der Molen <tim@kariliq.nl>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Sample conversion kernels. Each kernel has a scalar version. Some kernels
+ * also have SSE2, AVX2 or NEON versions. The fastest version the CPU supports
+ * is selected at run time by sample_init(). All versions of a kernel produce
+ * exactly the same output. The check-sample program ("make check") verifies
+ * this for every version the CPU supports.
+ *
+ * The dot product kernel computes eight partial sums and adds them in a fixed
+ * order, so that its vector versions give the same result as the scalar one.
+ * This also requires that the compiler does not fuse multiplications and
+ * additions, which is why configure adds -ffp-contract=off.
+ *
+ * The functions whose names end in "p" convert planar (non-interleaved)
+ * samples. They take an array of nchannels pointers to the channel data and
+ * write nframes interleaved frames, starting at frame offset in the channel
+ * data.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#elif defined(HAVE_ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "siren.h"
+
+#ifdef HAVE_X86_SIMD
+#define SAMPLE_TARGET(t) __attribute__((target(t)))
+#endif
+
+struct sample_kernels {
+	const char	*name;
+	float		 (*dot)(const float *, const float *, size_t);
+	void		 (*fixp_to_s16)(int16_t *, const int32_t * const *,
+			    unsigned int, size_t, size_t, unsigned int);
+	void		 (*flt_to_s16)(int16_t *, const float *, size_t);
+	void		 (*fltp_to_s16)(int16_t *, const float * const *,
+			    unsigned int, size_t, size_t);
+	void		 (*s32_to_s16)(int16_t *, const int32_t *, size_t);
+	void		 (*s32p_to_s16)(int16_t *, const int32_t * const *,
+			    unsigned int, size_t, size_t);
+	void		 (*s32p_to_s32)(int32_t *, const int32_t * const *,
+			    unsigned int, size_t, size_t);
+	void		 (*scale_s16)(int16_t *, size_t, float);
+	void		 (*scale_s32)(int32_t *, size_t, float, int32_t);
+	void		 (*swap16)(int16_t *, size_t);
+	void		 (*swap32)(int32_t *, size_t);
+};
+
+static float	sample_dot_scalar(const float *, const float *, size_t);
+static int16_t	sample_float_to_int16(float);
+static int32_t	sample_scale(int32_t, float, float, float);
+static void	sample_fixp_to_s16_scalar(int16_t *, const int32_t * const *,
+		    unsigned int, size_t, size_t, unsigned int);
+static void	sample_flt_to_s16_scalar(int16_t *, const float *, size_t);
+static void	sample_fltp_to_s16_scalar(int16_t *, const float * const *,
+		    unsigned int, size_t, size_t);
+static void	sample_s32_to_s16_scalar(int16_t *, const int32_t *, size_t);
+static void	sample_s32p_to_s16_scalar(int16_t *, const int32_t * const *,
+		    unsigned int, size_t, size_t);
+static void	sample_s32p_to_s32_scalar(int32_t *, const int32_t * const *,
+		    unsigned int, size_t, size_t);
+static void	sample_scale_s16_scalar(int16_t *, size_t, float);
+static void	sample_scale_s32_scalar(int32_t *, size_t, float, int32_t);
+static void	sample_swap16_scalar(int16_t *, size_t);
+static void	sample_swap32_scalar(int32_t *, size_t);
+static int	sample_check_kernels(const struct sample_kernels *);
+
+/*
+ * Scalar kernels.
+ */
+
+static float
+sample_dot_scalar(const float *a, const float *b, size_t n)
+{
+	float	s[8], sum;
+	size_t	i, j;
+
+	for (j = 0; j < 8; j++)
+		s[j] = 0.0f;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		for (j = 0; j < 8; j++)
+			s[j] += a[i + j] * b[i + j];
+
+	sum = ((s[0] + s[4]) + (s[2] + s[6])) + ((s[1] + s[5]) + (s[3] + s[7]));
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+
+	return sum;
+}
+
+/*
+ * Scale a float sample, clip it to the 16-bit range and truncate it. The
+ * comparisons are written so that they behave like the minps and maxps
+ * instructions, which is why NaN becomes INT16_MAX.
+ */
+static inline int16_t
+sample_float_to_int16(float f)
+{
+	f *= 32768.0f;
+	f = f < 32767.0f ? f : 32767.0f;
+	f = f > -32768.0f ? f : -32768.0f;
+	return (int32_t)f;
+}
+
+/*
+ * Multiply a sample by the gain, clip it to [min, max] and truncate it. The
+ * comparisons are written in the same way as in sample_float_to_int16().
+ */
+static inline int32_t
+sample_scale(int32_t x, float gain, float max, float min)
+{
+	float f;
+
+	f = (float)x * gain;
+	f = f < max ? f : max;
+	f = f > min ? f : min;
+	return (int32_t)f;
+}
+
+static void
+sample_fixp_to_s16_scalar(int16_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes,
+    unsigned int fracbits)
+{
+	size_t		i;
+	unsigned int	j;
+	int32_t		max, min, round, x;
+
+	max = ((int32_t)1 << fracbits) - 1;
+	min = -((int32_t)1 << fracbits);
+	round = (int32_t)1 << (fracbits - 16);
+
+	for (i = offset; i < offset + nframes; i++)
+		for (j = 0; j < nchannels; j++) {
+			/* Round to the 15th most significant fraction bit. */
+			x = (int32_t)((uint32_t)src[j][i] + (uint32_t)round);
+
+			/* Clip samples outside [-1.0, 1.0). */
+			if (x > max)
+				x = max;
+			else if (x < min)
+				x = min;
+
+			/* Keep the sign bit and 15 fraction bits. */
+			*dst++ = x >> (fracbits - 15);
+		}
+}
+
+static void
+sample_flt_to_s16_scalar(int16_t *dst, const float *src, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = sample_float_to_int16(src[i]);
+}
+
+static void
+sample_fltp_to_s16_scalar(int16_t *dst, const float * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	size_t		i;
+	unsigned int	j;
+
+	for (i = offset; i < offset + nframes; i++)
+		for (j = 0; j < nchannels; j++)
+			*dst++ = sample_float_to_int16(src[j][i]);
+}
+
+static void
+sample_s32_to_s16_scalar(int16_t *dst, const int32_t *src, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = src[i];
+}
+
+static void
+sample_s32p_to_s16_scalar(int16_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	size_t		i;
+	unsigned int	j;
+
+	for (i = offset; i < offset + nframes; i++)
+		for (j = 0; j < nchannels; j++)
+			*dst++ = src[j][i];
+}
+
+static void
+sample_s32p_to_s32_scalar(int32_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	size_t		i;
+	unsigned int	j;
+
+	for (i = offset; i < offset + nframes; i++)
+		for (j = 0; j < nchannels; j++)
+			*dst++ = src[j][i];
+}
+
+static void
+sample_scale_s16_scalar(int16_t *p, size_t n, float gain)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		p[i] = sample_scale(p[i], gain, 32767.0f, -32768.0f);
+}
+
+static void
+sample_scale_s32_scalar(int32_t *p, size_t n, float gain, int32_t max)
+{
+	size_t	i;
+	float	fmax, fmin;
+
+	fmax = (float)max;
+	fmin = -fmax - 1.0f;
+	for (i = 0; i < n; i++)
+		p[i] = sample_scale(p[i], gain, fmax, fmin);
+}
+
+static void
+sample_swap16_scalar(int16_t *p, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		p[i] = swap16(p[i]);
+}
+
+static void
+sample_swap32_scalar(int32_t *p, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		p[i] = swap32(p[i]);
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * SSE2 kernels.
+ */
+
+SAMPLE_TARGET("sse2") static inline __m128i
+sample_blend_sse2(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+SAMPLE_TARGET("sse2") static inline __m128i
+sample_clip_fixed_sse2(__m128i x, __m128i round, __m128i max, __m128i min,
+    __m128i shift)
+{
+	x = _mm_add_epi32(x, round);
+	x = sample_blend_sse2(_mm_cmpgt_epi32(x, max), max, x);
+	x = sample_blend_sse2(_mm_cmplt_epi32(x, min), min, x);
+	return _mm_sra_epi32(x, shift);
+}
+
+SAMPLE_TARGET("sse2") static float
+sample_dot_sse2(const float *a, const float *b, size_t n)
+{
+	__m128	s0, s1, t;
+	float	sum;
+	size_t	i;
+
+	s0 = _mm_setzero_ps();
+	s1 = _mm_setzero_ps();
+	for (i = 0; i + 8 <= n; i += 8) {
+		s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i),
+		    _mm_loadu_ps(b + i)));
+		s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+		    _mm_loadu_ps(b + i + 4)));
+	}
+
+	t = _mm_add_ps(s0, s1);
+	t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+	t = _mm_add_ss(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1)));
+	sum = _mm_cvtss_f32(t);
+
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+
+	return sum;
+}
+
+SAMPLE_TARGET("sse2") static inline __m128i
+sample_float_to_int32_sse2(__m128 f)
+{
+	f = _mm_mul_ps(f, _mm_set1_ps(32768.0f));
+	f = _mm_min_ps(f, _mm_set1_ps(32767.0f));
+	f = _mm_max_ps(f, _mm_set1_ps(-32768.0f));
+	return _mm_cvttps_epi32(f);
+}
+
+SAMPLE_TARGET("sse2") static inline __m128i
+sample_scale_sse2(__m128i x, __m128 gain, __m128 max, __m128 min)
+{
+	__m128 f;
+
+	f = _mm_mul_ps(_mm_cvtepi32_ps(x), gain);
+	f = _mm_min_ps(f, max);
+	f = _mm_max_ps(f, min);
+	return _mm_cvttps_epi32(f);
+}
+
+SAMPLE_TARGET("sse2") static void
+sample_fixp_to_s16_sse2(int16_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes,
+    unsigned int fracbits)
+{
+	__m128i	l, max, min, r, round, shift;
+	size_t	i;
+
+	if (nchannels != 2) {
+		sample_fixp_to_s16_scalar(dst, src, nchannels, offset, nframes,
+		    fracbits);
+		return;
+	}
+
+	max = _mm_set1_epi32(((int32_t)1 << fracbits) - 1);
+	min = _mm_set1_epi32(-((int32_t)1 << fracbits));
+	round = _mm_set1_epi32((int32_t)1 << (fracbits - 16));
+	shift = _mm_cvtsi32_si128(fracbits - 15);
+
+	for (i = 0; i + 4 <= nframes; i += 4) {
+		l = _mm_loadu_si128((const __m128i *)(src[0] + offset + i));
+		r = _mm_loadu_si128((const __m128i *)(src[1] + offset + i));
+		l = sample_clip_fixed_sse2(l, round, max, min, shift);
+		r = sample_clip_fixed_sse2(r, round, max, min, shift);
+		_mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_packs_epi32(
+		    _mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r)));
+	}
+
+	sample_fixp_to_s16_scalar(dst + 2 * i, src, 2, offset + i, nframes - i,
+	    fracbits);
+}
+
+SAMPLE_TARGET("sse2") static void
+sample_flt_to_s16_sse2(int16_t *dst, const float *src, size_t n)
+{
+	__m128i	a, b;
+	size_t	i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = sample_float_to_int32_sse2(_mm_loadu_ps(src + i));
+		b = sample_float_to_int32_sse2(_mm_loadu_ps(src + i + 4));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+	}
+
+	sample_flt_to_s16_scalar(dst + i, src + i, n - i);
+}
+
+SAMPLE_TARGET("sse2") static void
+sample_fltp_to_s16_sse2(int16_t *dst, const float * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	__m128i	l, r;
+	size_t	i;
+
+	if (nchannels == 1) {
+		sample_flt_to_s16_sse2(dst, src[0] + offset, nframes);
+		return;
+	}
+	if (nchannels != 2) {
+		sample_fltp_to_s16_scalar(dst, src, nchannels, offset, nframes);
+		return;
+	}
+
+	for (i = 0; i + 4 <= nframes; i += 4) {
+		l = sample_float_to_int32_sse2(
+		    _mm_loadu_ps(src[0] + offset + i));
+		r = sample_float_to_int32_sse2(
+		    _mm_loadu_ps(src[1] + offset + i));
+		_mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_packs_epi32(
+		    _mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r)));
+	}
+
+	sample_fltp_to_s16_scalar(dst + 2 * i, src, 2, offset + i,
+	    nframes - i);
+}
+
+/*
+ * The packs instruction saturates, while the scalar version truncates. Both
+ * give the same result because the samples are required to fit in 16 bits.
+ */
+SAMPLE_TARGET("sse2") static void
+sample_s32_to_s16_sse2(int16_t *dst, const int32_t *src, size_t n)
+{
+	__m128i	a, b;
+	size_t	i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = _mm_loadu_si128((const __m128i *)(src + i));
+		b = _mm_loadu_si128((const __m128i *)(src + i + 4));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+	}
+
+	sample_s32_to_s16_scalar(dst + i, src + i, n - i);
+}
+
+SAMPLE_TARGET("sse2") static void
+sample_s32p_to_s16_sse2(int16_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	__m128i	l, r;
+	size_t	i;
+
+	if (nchannels == 1) {
+		sample_s32_to_s16_sse2(dst, src[0] + offset, nframes);
+		return;
+	}
+	if (nchannels != 2) {
+		sample_s32p_to_s16_scalar(dst, src, nchannels, offset, nframes);
+		return;
+	}
+
+	for (i = 0; i + 4 <= nframes; i += 4) {
+		l = _mm_loadu_si128((const __m128i *)(src[0] + offset + i));
+		r = _mm_loadu_si128((const __m128i *)(src[1] + offset + i));
+		_mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_packs_epi32(
+		    _mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r)));
+	}
+
+	sample_s32p_to_s16_scalar(dst + 2 * i, src, 2, offset + i,
+	    nframes - i);
+}
+
+SAMPLE_TARGET("sse2") static void
+sample_s32p_to_s32_sse2(int32_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	__m128i	l, r;
+	size_t	i;
+
+	if (nchannels != 2) {
+		sample_s32p_to_s32_scalar(dst, src, nchannels, offset, nframes);
+		return;
+	}
+
+	for (i = 0; i + 4 <= nframes; i += 4) {
+		l = _mm_loadu_si128((const __m128i *)(src[0] + offset + i));
+		r = _mm_loadu_si128((const __m128i *)(src[1] + offset + i));
+		_mm_storeu_si128((__m128i *)(dst + 2 * i),
+		    _mm_unpacklo_epi32(l, r));
+		_mm_storeu_si128((__m128i *)(dst + 2 * i + 4),
+		    _mm_unpackhi_epi32(l, r));
+	}
+
+	sample_s32p_to_s32_scalar(dst + 2 * i, src, 2, offset + i,
+	    nframes - i);
+}
+
+SAMPLE_TARGET("sse2") static void
+sample_scale_s16_sse2(int16_t *p, size_t n, float gain)
+{
+	__m128	g, max, min;
+	__m128i	a, b, v;
+	size_t	i;
+
+	g = _mm_set1_ps(gain);
+	max = _mm_set1_ps(32767.0f);
+	min = _mm_set1_ps(-32768.0f);
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm_loadu_si128((__m128i *)(p + i));
+		/* Sign-extend the samples to 32 bits. */
+		a = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		b = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		a = sample_scale_sse2(a, g, max, min);
+		b = sample_scale_sse2(b, g, max, min);
+		_mm_storeu_si128((__m128i *)(p + i), _mm_packs_epi32(a, b));
+	}
+
+	sample_scale_s16_scalar(p + i, n - i, gain);
+}
+
+SAMPLE_TARGET("sse2") static void
+sample_scale_s32_sse2(int32_t *p, size_t n, float gain, int32_t max)
+{
+	__m128	fmax, fmin, g;
+	__m128i	v;
+	size_t	i;
+
+	g = _mm_set1_ps(gain);
+	fmax = _mm_set1_ps((float)max);
+	fmin = _mm_set1_ps(-(float)max - 1.0f);
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_loadu_si128((__m128i *)(p + i));
+		v = sample_scale_sse2(v, g, fmax, fmin);
+		_mm_storeu_si128((__m128i *)(p + i), v);
+	}
+
+	sample_scale_s32_scalar(p + i, n - i, gain, max);
+}
+
+SAMPLE_TARGET("sse2") static void
+sample_swap16_sse2(int16_t *p, size_t n)
+{
+	__m128i	v;
+	size_t	i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm_loadu_si128((__m128i *)(p + i));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i *)(p + i), v);
+	}
+
+	sample_swap16_scalar(p + i, n - i);
+}
+
+SAMPLE_TARGET("sse2") static void
+sample_swap32_sse2(int32_t *p, size_t n)
+{
+	__m128i	v;
+	size_t	i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		v = _mm_loadu_si128((__m128i *)(p + i));
+		/* Swap the bytes in each 16-bit word and then the words. */
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		_mm_storeu_si128((__m128i *)(p + i), v);
+	}
+
+	sample_swap32_scalar(p + i, n - i);
+}
+
+/*
+ * AVX2 kernels.
+ */
+
+SAMPLE_TARGET("avx2") static float
+sample_dot_avx2(const float *a, const float *b, size_t n)
+{
+	__m256	s;
+	__m128	t;
+	float	sum;
+	size_t	i;
+
+	s = _mm256_setzero_ps();
+	for (i = 0; i + 8 <= n; i += 8)
+		s = _mm256_add_ps(s, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+		    _mm256_loadu_ps(b + i)));
+
+	t = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+	t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+	t = _mm_add_ss(t, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1)));
+	sum = _mm_cvtss_f32(t);
+
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+
+	return sum;
+}
+
+SAMPLE_TARGET("avx2") static inline __m256i
+sample_float_to_int32_avx2(__m256 f)
+{
+	f = _mm256_mul_ps(f, _mm256_set1_ps(32768.0f));
+	f = _mm256_min_ps(f, _mm256_set1_ps(32767.0f));
+	f = _mm256_max_ps(f, _mm256_set1_ps(-32768.0f));
+	return _mm256_cvttps_epi32(f);
+}
+
+SAMPLE_TARGET("avx2") static inline __m256i
+sample_scale_avx2(__m256i x, __m256 gain, __m256 max, __m256 min)
+{
+	__m256 f;
+
+	f = _mm256_mul_ps(_mm256_cvtepi32_ps(x), gain);
+	f = _mm256_min_ps(f, max);
+	f = _mm256_max_ps(f, min);
+	return _mm256_cvttps_epi32(f);
+}
+
+SAMPLE_TARGET("avx2") static void
+sample_flt_to_s16_avx2(int16_t *dst, const float *src, size_t n)
+{
+	__m256i	a, b, v;
+	size_t	i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		a = sample_float_to_int32_avx2(_mm256_loadu_ps(src + i));
+		b = sample_float_to_int32_avx2(_mm256_loadu_ps(src + i + 8));
+		/* The packs instruction works on each 128-bit lane. */
+		v = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b),
+		    _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *)(dst + i), v);
+	}
+
+	sample_flt_to_s16_sse2(dst + i, src + i, n - i);
+}
+
+SAMPLE_TARGET("avx2") static void
+sample_fltp_to_s16_avx2(int16_t *dst, const float * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	__m256i	l, r, v;
+	size_t	i;
+
+	if (nchannels == 1) {
+		sample_flt_to_s16_avx2(dst, src[0] + offset, nframes);
+		return;
+	}
+	if (nchannels != 2) {
+		sample_fltp_to_s16_scalar(dst, src, nchannels, offset, nframes);
+		return;
+	}
+
+	for (i = 0; i + 8 <= nframes; i += 8) {
+		l = sample_float_to_int32_avx2(
+		    _mm256_loadu_ps(src[0] + offset + i));
+		r = sample_float_to_int32_avx2(
+		    _mm256_loadu_ps(src[1] + offset + i));
+		/*
+		 * Unpack and pack work on each 128-bit lane, so frames 0-3
+		 * end up in the low lane and frames 4-7 in the high lane.
+		 */
+		v = _mm256_packs_epi32(_mm256_unpacklo_epi32(l, r),
+		    _mm256_unpackhi_epi32(l, r));
+		_mm256_storeu_si256((__m256i *)(dst + 2 * i), v);
+	}
+
+	sample_fltp_to_s16_sse2(dst + 2 * i, src, 2, offset + i, nframes - i);
+}
+
+SAMPLE_TARGET("avx2") static void
+sample_scale_s16_avx2(int16_t *p, size_t n, float gain)
+{
+	__m256	g, max, min;
+	__m256i	a, b, v;
+	size_t	i;
+
+	g = _mm256_set1_ps(gain);
+	max = _mm256_set1_ps(32767.0f);
+	min = _mm256_set1_ps(-32768.0f);
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = _mm256_loadu_si256((__m256i *)(p + i));
+		a = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+		b = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+		a = sample_scale_avx2(a, g, max, min);
+		b = sample_scale_avx2(b, g, max, min);
+		/* The packs instruction works on each 128-bit lane. */
+		v = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b),
+		    _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *)(p + i), v);
+	}
+
+	sample_scale_s16_sse2(p + i, n - i, gain);
+}
+
+SAMPLE_TARGET("avx2") static void
+sample_scale_s32_avx2(int32_t *p, size_t n, float gain, int32_t max)
+{
+	__m256	fmax, fmin, g;
+	__m256i	v;
+	size_t	i;
+
+	g = _mm256_set1_ps(gain);
+	fmax = _mm256_set1_ps((float)max);
+	fmin = _mm256_set1_ps(-(float)max - 1.0f);
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_loadu_si256((__m256i *)(p + i));
+		v = sample_scale_avx2(v, g, fmax, fmin);
+		_mm256_storeu_si256((__m256i *)(p + i), v);
+	}
+
+	sample_scale_s32_sse2(p + i, n - i, gain, max);
+}
+
+SAMPLE_TARGET("avx2") static void
+sample_swap16_avx2(int16_t *p, size_t n)
+{
+	__m256i	v;
+	size_t	i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = _mm256_loadu_si256((__m256i *)(p + i));
+		v = _mm256_or_si256(_mm256_slli_epi16(v, 8),
+		    _mm256_srli_epi16(v, 8));
+		_mm256_storeu_si256((__m256i *)(p + i), v);
+	}
+
+	sample_swap16_sse2(p + i, n - i);
+}
+
+SAMPLE_TARGET("avx2") static void
+sample_swap32_avx2(int32_t *p, size_t n)
+{
+	__m256i	mask, v;
+	size_t	i;
+
+	mask = _mm256_setr_epi8(
+	    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+	    3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = _mm256_loadu_si256((__m256i *)(p + i));
+		v = _mm256_shuffle_epi8(v, mask);
+		_mm256_storeu_si256((__m256i *)(p + i), v);
+	}
+
+	sample_swap32_sse2(p + i, n - i);
+}
+#endif
+
+#ifdef HAVE_ARM_NEON
+/*
+ * NEON kernels.
+ */
+
+static float
+sample_dot_neon(const float *a, const float *b, size_t n)
+{
+	float32x4_t	s0, s1, t;
+	float32x2_t	u;
+	float		sum;
+	size_t		i;
+
+	s0 = vdupq_n_f32(0.0f);
+	s1 = vdupq_n_f32(0.0f);
+	for (i = 0; i + 8 <= n; i += 8) {
+		s0 = vaddq_f32(s0, vmulq_f32(vld1q_f32(a + i),
+		    vld1q_f32(b + i)));
+		s1 = vaddq_f32(s1, vmulq_f32(vld1q_f32(a + i + 4),
+		    vld1q_f32(b + i + 4)));
+	}
+
+	t = vaddq_f32(s0, s1);
+	u = vadd_f32(vget_low_f32(t), vget_high_f32(t));
+	sum = vget_lane_f32(u, 0) + vget_lane_f32(u, 1);
+
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+
+	return sum;
+}
+
+static inline int32x4_t
+sample_float_to_int32_neon(float32x4_t f)
+{
+	float32x4_t max, min;
+
+	max = vdupq_n_f32(32767.0f);
+	min = vdupq_n_f32(-32768.0f);
+
+	/* Use compare and select to get the same NaN handling as the others. */
+	f = vmulq_n_f32(f, 32768.0f);
+	f = vbslq_f32(vcltq_f32(f, max), f, max);
+	f = vbslq_f32(vcgtq_f32(f, min), f, min);
+	return vcvtq_s32_f32(f);
+}
+
+static inline int32x4_t
+sample_scale_neon(int32x4_t x, float gain, float32x4_t max, float32x4_t min)
+{
+	float32x4_t f;
+
+	f = vmulq_n_f32(vcvtq_f32_s32(x), gain);
+	f = vbslq_f32(vcltq_f32(f, max), f, max);
+	f = vbslq_f32(vcgtq_f32(f, min), f, min);
+	return vcvtq_s32_f32(f);
+}
+
+static void
+sample_fixp_to_s16_neon(int16_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes,
+    unsigned int fracbits)
+{
+	int16x4x2_t	v;
+	int32x4_t	l, max, min, r, round, shift;
+	size_t		i;
+
+	if (nchannels != 2) {
+		sample_fixp_to_s16_scalar(dst, src, nchannels, offset, nframes,
+		    fracbits);
+		return;
+	}
+
+	max = vdupq_n_s32(((int32_t)1 << fracbits) - 1);
+	min = vdupq_n_s32(-((int32_t)1 << fracbits));
+	round = vdupq_n_s32((int32_t)1 << (fracbits - 16));
+	shift = vdupq_n_s32(-(int32_t)(fracbits - 15));
+
+	for (i = 0; i + 4 <= nframes; i += 4) {
+		l = vaddq_s32(vld1q_s32(src[0] + offset + i), round);
+		r = vaddq_s32(vld1q_s32(src[1] + offset + i), round);
+		l = vshlq_s32(vmaxq_s32(vminq_s32(l, max), min), shift);
+		r = vshlq_s32(vmaxq_s32(vminq_s32(r, max), min), shift);
+		v.val[0] = vmovn_s32(l);
+		v.val[1] = vmovn_s32(r);
+		vst2_s16(dst + 2 * i, v);
+	}
+
+	sample_fixp_to_s16_scalar(dst + 2 * i, src, 2, offset + i, nframes - i,
+	    fracbits);
+}
+
+static void
+sample_flt_to_s16_neon(int16_t *dst, const float *src, size_t n)
+{
+	int32x4_t	a, b;
+	size_t		i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		a = sample_float_to_int32_neon(vld1q_f32(src + i));
+		b = sample_float_to_int32_neon(vld1q_f32(src + i + 4));
+		vst1q_s16(dst + i, vcombine_s16(vmovn_s32(a), vmovn_s32(b)));
+	}
+
+	sample_flt_to_s16_scalar(dst + i, src + i, n - i);
+}
+
+static void
+sample_fltp_to_s16_neon(int16_t *dst, const float * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	int16x4x2_t	v;
+	size_t		i;
+
+	if (nchannels == 1) {
+		sample_flt_to_s16_neon(dst, src[0] + offset, nframes);
+		return;
+	}
+	if (nchannels != 2) {
+		sample_fltp_to_s16_scalar(dst, src, nchannels, offset, nframes);
+		return;
+	}
+
+	for (i = 0; i + 4 <= nframes; i += 4) {
+		v.val[0] = vmovn_s32(sample_float_to_int32_neon(
+		    vld1q_f32(src[0] + offset + i)));
+		v.val[1] = vmovn_s32(sample_float_to_int32_neon(
+		    vld1q_f32(src[1] + offset + i)));
+		vst2_s16(dst + 2 * i, v);
+	}
+
+	sample_fltp_to_s16_scalar(dst + 2 * i, src, 2, offset + i,
+	    nframes - i);
+}
+
+static void
+sample_s32_to_s16_neon(int16_t *dst, const int32_t *src, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		vst1q_s16(dst + i, vcombine_s16(vmovn_s32(vld1q_s32(src + i)),
+		    vmovn_s32(vld1q_s32(src + i + 4))));
+
+	sample_s32_to_s16_scalar(dst + i, src + i, n - i);
+}
+
+static void
+sample_s32p_to_s16_neon(int16_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	int16x4x2_t	v;
+	size_t		i;
+
+	if (nchannels == 1) {
+		sample_s32_to_s16_neon(dst, src[0] + offset, nframes);
+		return;
+	}
+	if (nchannels != 2) {
+		sample_s32p_to_s16_scalar(dst, src, nchannels, offset, nframes);
+		return;
+	}
+
+	for (i = 0; i + 4 <= nframes; i += 4) {
+		v.val[0] = vmovn_s32(vld1q_s32(src[0] + offset + i));
+		v.val[1] = vmovn_s32(vld1q_s32(src[1] + offset + i));
+		vst2_s16(dst + 2 * i, v);
+	}
+
+	sample_s32p_to_s16_scalar(dst + 2 * i, src, 2, offset + i,
+	    nframes - i);
+}
+
+static void
+sample_s32p_to_s32_neon(int32_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	int32x4x2_t	v;
+	size_t		i;
+
+	if (nchannels != 2) {
+		sample_s32p_to_s32_scalar(dst, src, nchannels, offset, nframes);
+		return;
+	}
+
+	for (i = 0; i + 4 <= nframes; i += 4) {
+		v.val[0] = vld1q_s32(src[0] + offset + i);
+		v.val[1] = vld1q_s32(src[1] + offset + i);
+		vst2q_s32(dst + 2 * i, v);
+	}
+
+	sample_s32p_to_s32_scalar(dst + 2 * i, src, 2, offset + i,
+	    nframes - i);
+}
+
+static void
+sample_scale_s16_neon(int16_t *p, size_t n, float gain)
+{
+	float32x4_t	max, min;
+	int32x4_t	a, b;
+	int16x8_t	v;
+	size_t		i;
+
+	max = vdupq_n_f32(32767.0f);
+	min = vdupq_n_f32(-32768.0f);
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		v = vld1q_s16(p + i);
+		a = sample_scale_neon(vmovl_s16(vget_low_s16(v)), gain, max,
+		    min);
+		b = sample_scale_neon(vmovl_s16(vget_high_s16(v)), gain, max,
+		    min);
+		vst1q_s16(p + i, vcombine_s16(vmovn_s32(a), vmovn_s32(b)));
+	}
+
+	sample_scale_s16_scalar(p + i, n - i, gain);
+}
+
+static void
+sample_scale_s32_neon(int32_t *p, size_t n, float gain, int32_t max)
+{
+	float32x4_t	fmax, fmin;
+	size_t		i;
+
+	fmax = vdupq_n_f32((float)max);
+	fmin = vdupq_n_f32(-(float)max - 1.0f);
+
+	for (i = 0; i + 4 <= n; i += 4)
+		vst1q_s32(p + i, sample_scale_neon(vld1q_s32(p + i), gain,
+		    fmax, fmin));
+
+	sample_scale_s32_scalar(p + i, n - i, gain, max);
+}
+
+static void
+sample_swap16_neon(int16_t *p, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= n; i += 8)
+		vst1q_s16(p + i, vreinterpretq_s16_u8(
+		    vrev16q_u8(vreinterpretq_u8_s16(vld1q_s16(p + i)))));
+
+	sample_swap16_scalar(p + i, n - i);
+}
+
+static void
+sample_swap32_neon(int32_t *p, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+		vst1q_s32(p + i, vreinterpretq_s32_u8(
+		    vrev32q_u8(vreinterpretq_u8_s32(vld1q_s32(p + i)))));
+
+	sample_swap32_scalar(p + i, n - i);
+}
+#endif
+
+/*
+ * Kernel sets. The AVX2 set uses the SSE2 versions of the kernels that have no
+ * AVX2 version.
+ */
+
+static const struct sample_kernels sample_kernels_scalar = {
+	"scalar",
+	sample_dot_scalar,
+	sample_fixp_to_s16_scalar,
+	sample_flt_to_s16_scalar,
+	sample_fltp_to_s16_scalar,
+	sample_s32_to_s16_scalar,
+	sample_s32p_to_s16_scalar,
+	sample_s32p_to_s32_scalar,
+	sample_scale_s16_scalar,
+	sample_scale_s32_scalar,
+	sample_swap16_scalar,
+	sample_swap32_scalar
+};
+
+#ifdef HAVE_X86_SIMD
+static const struct sample_kernels sample_kernels_sse2 = {
+	"sse2",
+	sample_dot_sse2,
+	sample_fixp_to_s16_sse2,
+	sample_flt_to_s16_sse2,
+	sample_fltp_to_s16_sse2,
+	sample_s32_to_s16_sse2,
+	sample_s32p_to_s16_sse2,
+	sample_s32p_to_s32_sse2,
+	sample_scale_s16_sse2,
+	sample_scale_s32_sse2,
+	sample_swap16_sse2,
+	sample_swap32_sse2
+};
+
+static const struct sample_kernels sample_kernels_avx2 = {
+	"avx2",
+	sample_dot_avx2,
+	sample_fixp_to_s16_sse2,
+	sample_flt_to_s16_avx2,
+	sample_fltp_to_s16_avx2,
+	sample_s32_to_s16_sse2,
+	sample_s32p_to_s16_sse2,
+	sample_s32p_to_s32_sse2,
+	sample_scale_s16_avx2,
+	sample_scale_s32_avx2,
+	sample_swap16_avx2,
+	sample_swap32_avx2
+};
+#elif defined(HAVE_ARM_NEON)
+static const struct sample_kernels sample_kernels_neon = {
+	"neon",
+	sample_dot_neon,
+	sample_fixp_to_s16_neon,
+	sample_flt_to_s16_neon,
+	sample_fltp_to_s16_neon,
+	sample_s32_to_s16_neon,
+	sample_s32p_to_s16_neon,
+	sample_s32p_to_s32_neon,
+	sample_scale_s16_neon,
+	sample_scale_s32_neon,
+	sample_swap16_neon,
+	sample_swap32_neon
+};
+#endif
+
+static const struct sample_kernels *sample_kernels = &sample_kernels_scalar;
+
+/*
+ * Compare the kernels of the specified set with the scalar ones. Every length
+ * up to SAMPLE_CHECK_NFRAMES frames is tried, so that the scalar tail of the
+ * vector kernels is exercised at every alignment. The input includes values
+ * outside the clipping range.
+ */
+#define SAMPLE_CHECK_NFRAMES	67
+
+static int
+sample_check_kernels(const struct sample_kernels *k)
+{
+	static int32_t	 fix[2][SAMPLE_CHECK_NFRAMES + 1];
+	static int32_t	 s32[2][SAMPLE_CHECK_NFRAMES + 1];
+	static int16_t	 s16[2 * SAMPLE_CHECK_NFRAMES];
+	static float	 flt[2][SAMPLE_CHECK_NFRAMES + 1];
+	static int32_t	 out32[2][2 * SAMPLE_CHECK_NFRAMES];
+	static int16_t	 out16[2][2 * SAMPLE_CHECK_NFRAMES];
+	const int32_t	*fixp[2] = { fix[0], fix[1] };
+	const int32_t	*s32p[2] = { s32[0], s32[1] };
+	const float	*fltp[2] = { flt[0], flt[1] };
+	const char	*kernel;
+	float		 dot[2];
+	size_t		 i, n;
+	uint32_t	 r;
+	unsigned int	 j;
+
+	r = 1;
+	for (j = 0; j < 2; j++)
+		for (i = 0; i < SAMPLE_CHECK_NFRAMES + 1; i++) {
+			r = r * 1103515245 + 12345;
+			fix[j][i] = (int32_t)(r >> 1) - 0x40000000;
+			s32[j][i] = (int16_t)(r >> 16);
+			flt[j][i] = (float)(r >> 8) / 0xffffff * 3.0f - 1.5f;
+		}
+	for (i = 0; i < 2 * SAMPLE_CHECK_NFRAMES; i++)
+		s16[i] = s32[i % 2][i / 2];
+	flt[0][1] = 1.0f;
+	flt[0][2] = -1.0f;
+
+#define SAMPLE_CHECK(name, out, call_scalar, call)			\
+	do {								\
+		memset(out, 0x55, sizeof out);				\
+		call_scalar;						\
+		call;							\
+		if (memcmp(out[0], out[1], sizeof out[0])) {		\
+			kernel = name;					\
+			goto fail;					\
+		}							\
+	} while (0)
+
+	for (n = 0; n <= SAMPLE_CHECK_NFRAMES; n++) {
+		dot[0] = sample_dot_scalar(flt[0], flt[1], n);
+		dot[1] = k->dot(flt[0], flt[1], n);
+		if (memcmp(&dot[0], &dot[1], sizeof dot[0])) {
+			kernel = "dot";
+			goto fail;
+		}
+
+		SAMPLE_CHECK("fixp_to_s16", out16,
+		    sample_fixp_to_s16_scalar(out16[0], fixp, 2, 1, n, 28),
+		    k->fixp_to_s16(out16[1], fixp, 2, 1, n, 28));
+		SAMPLE_CHECK("flt_to_s16", out16,
+		    sample_flt_to_s16_scalar(out16[0], flt[0], n),
+		    k->flt_to_s16(out16[1], flt[0], n));
+		SAMPLE_CHECK("fltp_to_s16", out16,
+		    sample_fltp_to_s16_scalar(out16[0], fltp, 2, 1, n),
+		    k->fltp_to_s16(out16[1], fltp, 2, 1, n));
+		SAMPLE_CHECK("s32_to_s16", out16,
+		    sample_s32_to_s16_scalar(out16[0], s32[0], n),
+		    k->s32_to_s16(out16[1], s32[0], n));
+		SAMPLE_CHECK("s32p_to_s16", out16,
+		    sample_s32p_to_s16_scalar(out16[0], s32p, 2, 1, n),
+		    k->s32p_to_s16(out16[1], s32p, 2, 1, n));
+		SAMPLE_CHECK("s32p_to_s32", out32,
+		    sample_s32p_to_s32_scalar(out32[0], s32p, 2, 1, n),
+		    k->s32p_to_s32(out32[1], s32p, 2, 1, n));
+
+		/* The remaining kernels work in place. */
+		SAMPLE_CHECK("scale_s16", out16,
+		    (memcpy(out16[0], s16, 2 * n * sizeof *s16),
+		    sample_scale_s16_scalar(out16[0], 2 * n, 1.5f)),
+		    (memcpy(out16[1], s16, 2 * n * sizeof *s16),
+		    k->scale_s16(out16[1], 2 * n, 1.5f)));
+		SAMPLE_CHECK("scale_s32", out32,
+		    (memcpy(out32[0], fix[0], n * sizeof **fix),
+		    sample_scale_s32_scalar(out32[0], n, 0.7f, 0x7fffff)),
+		    (memcpy(out32[1], fix[0], n * sizeof **fix),
+		    k->scale_s32(out32[1], n, 0.7f, 0x7fffff)));
+		SAMPLE_CHECK("swap16", out16,
+		    (memcpy(out16[0], s16, 2 * n * sizeof *s16),
+		    sample_swap16_scalar(out16[0], 2 * n)),
+		    (memcpy(out16[1], s16, 2 * n * sizeof *s16),
+		    k->swap16(out16[1], 2 * n)));
+		SAMPLE_CHECK("swap32", out32,
+		    (memcpy(out32[0], fix[0], n * sizeof **fix),
+		    sample_swap32_scalar(out32[0], n)),
+		    (memcpy(out32[1], fix[0], n * sizeof **fix),
+		    k->swap32(out32[1], n)));
+	}
+
+#undef SAMPLE_CHECK
+
+	msg_info("%s kernels match the scalar kernels", k->name);
+	return 0;
+
+fail:
+	LOG_ERRX("%s kernel %s differs from scalar kernel for %zu frames",
+	    k->name, kernel, n);
+	msg_errx("%s kernel %s differs from scalar kernel for %zu frames",
+	    k->name, kernel, n);
+	return -1;
+}
+
+/*
+ * Public functions.
+ */
+
+/*
+ * Compare every kernel set the CPU supports with the scalar one. Return -1 if
+ * any kernel differs, or 0 otherwise.
+ */
+int
+sample_check(void)
+{
+	int ret;
+
+	ret = 0;
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse2") &&
+	    sample_check_kernels(&sample_kernels_sse2) == -1)
+		ret = -1;
+	if (__builtin_cpu_supports("avx2") &&
+	    sample_check_kernels(&sample_kernels_avx2) == -1)
+		ret = -1;
+#elif defined(HAVE_ARM_NEON)
+	if (sample_check_kernels(&sample_kernels_neon) == -1)
+		ret = -1;
+#endif
+	return ret;
+}
+
+/*
+ * Convert n native-endian samples from one encoding to another. The samples
+ * are widened to 32 bits first, so that narrowing discards the least
+ * significant bits. SAMPLE_ENCODING_S24_3 samples are stored in the specified
+ * byte order; all other samples are stored in native byte order. The source
+ * encoding cannot be SAMPLE_ENCODING_S24_3 or SAMPLE_ENCODING_FLOAT. There is
+ * only a scalar version of this kernel.
+ */
+void
+sample_convert(void *dst, enum sample_encoding dstenc, const void *src,
+    enum sample_encoding srcenc, size_t n, enum byte_order byte_order)
+{
+	const int8_t	*src1 = src;
+	const int16_t	*src2 = src;
+	const int32_t	*src4 = src;
+	int8_t		*dst1 = dst;
+	int16_t		*dst2 = dst;
+	int32_t		*dst4 = dst;
+	uint8_t		*dst3 = dst;
+	float		*dstf = dst;
+	size_t		 i;
+	int32_t		 x;
+
+	for (i = 0; i < n; i++) {
+		switch (srcenc) {
+		case SAMPLE_ENCODING_S8:
+			x = (int32_t)((uint32_t)src1[i] << 24);
+			break;
+		case SAMPLE_ENCODING_S16:
+			x = (int32_t)((uint32_t)src2[i] << 16);
+			break;
+		case SAMPLE_ENCODING_S24:
+			x = (int32_t)((uint32_t)src4[i] << 8);
+			break;
+		default:
+			x = src4[i];
+			break;
+		}
+
+		switch (dstenc) {
+		case SAMPLE_ENCODING_S8:
+			dst1[i] = x >> 24;
+			break;
+		case SAMPLE_ENCODING_S16:
+			dst2[i] = x >> 16;
+			break;
+		case SAMPLE_ENCODING_S24:
+			dst4[i] = x >> 8;
+			break;
+		case SAMPLE_ENCODING_S24_3:
+			x >>= 8;
+			if (byte_order == BYTE_ORDER_BIG) {
+				*dst3++ = x >> 16;
+				*dst3++ = x >> 8;
+				*dst3++ = x;
+			} else {
+				*dst3++ = x;
+				*dst3++ = x >> 8;
+				*dst3++ = x >> 16;
+			}
+			break;
+		case SAMPLE_ENCODING_S32:
+			dst4[i] = x;
+			break;
+		case SAMPLE_ENCODING_FLOAT:
+			dstf[i] = x / 2147483648.0f;
+			break;
+		}
+	}
+}
+
+/*
+ * Convert planar double samples to 16-bit samples in the same way as
+ * sample_fltp_to_s16(). There is only a scalar version of this kernel.
+ */
+void
+sample_dblp_to_s16(int16_t *dst, const double * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	size_t		i;
+	unsigned int	j;
+
+	for (i = offset; i < offset + nframes; i++)
+		for (j = 0; j < nchannels; j++)
+			*dst++ = sample_float_to_int16(src[j][i]);
+}
+
+/*
+ * Return the dot product of two float vectors of length n.
+ */
+float
+sample_dot(const float *a, const float *b, size_t n)
+{
+	return sample_kernels->dot(a, b, n);
+}
+
+/*
+ * Return the number of bytes in which a sample of the specified encoding is
+ * stored.
+ */
+unsigned int
+sample_encoding_size(enum sample_encoding encoding)
+{
+	switch (encoding) {
+	case SAMPLE_ENCODING_S8:
+		return 1;
+	case SAMPLE_ENCODING_S16:
+		return 2;
+	case SAMPLE_ENCODING_S24_3:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+/*
+ * Convert planar fixed-point samples with fracbits fraction bits to 16-bit
+ * samples. Samples outside [-1.0, 1.0) are clipped.
+ */
+void
+sample_fixp_to_s16(int16_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes,
+    unsigned int fracbits)
+{
+	sample_kernels->fixp_to_s16(dst, src, nchannels, offset, nframes,
+	    fracbits);
+}
+
+/*
+ * Convert float samples to 16-bit samples. Samples outside [-1.0, 1.0) are
+ * clipped.
+ */
+void
+sample_flt_to_s16(int16_t *dst, const float *src, size_t n)
+{
+	sample_kernels->flt_to_s16(dst, src, n);
+}
+
+void
+sample_fltp_to_s16(int16_t *dst, const float * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	sample_kernels->fltp_to_s16(dst, src, nchannels, offset, nframes);
+}
+
+void
+sample_init(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		sample_kernels = &sample_kernels_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		sample_kernels = &sample_kernels_sse2;
+#elif defined(HAVE_ARM_NEON)
+	sample_kernels = &sample_kernels_neon;
+#endif
+
+	LOG_INFO("using %s sample kernels", sample_kernels->name);
+}
+
+void
+sample_s16p_to_s16(int16_t *dst, const int16_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	size_t		i;
+	unsigned int	j;
+
+	for (i = offset; i < offset + nframes; i++)
+		for (j = 0; j < nchannels; j++)
+			*dst++ = src[j][i];
+}
+
+/*
+ * Convert 32-bit samples to 8-bit samples. The samples must fit in 8 bits.
+ */
+void
+sample_s32_to_s8(int8_t *dst, const int32_t *src, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = src[i];
+}
+
+/*
+ * Convert 32-bit samples to 16-bit samples. The samples must fit in 16 bits.
+ */
+void
+sample_s32_to_s16(int16_t *dst, const int32_t *src, size_t n)
+{
+	sample_kernels->s32_to_s16(dst, src, n);
+}
+
+/*
+ * Interleave planar 32-bit samples into 8-bit samples. The samples must fit in
+ * 8 bits.
+ */
+void
+sample_s32p_to_s8(int8_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	size_t		i;
+	unsigned int	j;
+
+	for (i = offset; i < offset + nframes; i++)
+		for (j = 0; j < nchannels; j++)
+			*dst++ = src[j][i];
+}
+
+/*
+ * Interleave planar 32-bit samples into 16-bit samples. The samples must fit
+ * in 16 bits.
+ */
+void
+sample_s32p_to_s16(int16_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	sample_kernels->s32p_to_s16(dst, src, nchannels, offset, nframes);
+}
+
+void
+sample_s32p_to_s32(int32_t *dst, const int32_t * const *src,
+    unsigned int nchannels, size_t offset, size_t nframes)
+{
+	sample_kernels->s32p_to_s32(dst, src, nchannels, offset, nframes);
+}
+
+/*
+ * Multiply 8-bit samples by the gain. Samples that do not fit in 8 bits after
+ * scaling are clipped. There is only a scalar version of this kernel.
+ */
+void
+sample_scale_s8(int8_t *p, size_t n, float gain)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		p[i] = sample_scale(p[i], gain, 127.0f, -128.0f);
+}
+
+/*
+ * Multiply 16-bit samples by the gain. Samples that do not fit in 16 bits
+ * after scaling are clipped.
+ */
+void
+sample_scale_s16(int16_t *p, size_t n, float gain)
+{
+	sample_kernels->scale_s16(p, n, gain);
+}
+
+/*
+ * Multiply 32-bit samples by the gain and clip them to [-max - 1, max]. The
+ * maximum must be representable as a float. The samples are converted to
+ * float, so only the 24 most significant bits of 32-bit samples are kept.
+ */
+void
+sample_scale_s32(int32_t *p, size_t n, float gain, int32_t max)
+{
+	sample_kernels->scale_s32(p, n, gain, max);
+}
+
+void
+sample_swap16(int16_t *p, size_t n)
+{
+	sample_kernels->swap16(p, n);
+}
+
+void
+sample_swap32(int32_t *p, size_t n)
+{
+	sample_kernels->swap32(p, n);
+}
+
@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -55,6 +56,7 @@ static void			 screen_resize(void);
 
 static pthread_mutex_t		 screen_curses_mtx = PTHREAD_MUTEX_INITIALIZER;
 static int			 screen_have_colours;
+static int			 screen_headless;
 static int			 screen_have_default_colours;
 static int			 screen_player_row;
 static int			 screen_status_col;
@@ -205,6 +207,9 @@ screen_configure_cursor(void)
 {
 	int show;
 
+	if (screen_headless)
+		return;
+
 	show = option_get_boolean("show-cursor");
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	curs_set(show);
@@ -248,7 +253,8 @@ screen_configure_rows(void)
 void
 screen_end(void)
 {
-	endwin();
+	if (!screen_headless)
+		endwin();
 	free(screen_row);
 }
 
@@ -308,9 +314,19 @@ screen_get_ncols(void)
 	return COLS;
 }
 
+/*
+ * In headless mode, the screen is not initialised, nothing is drawn and
+ * messages are printed to stdout instead.
+ */
 void
-screen_init(void)
+screen_init(int headless)
 {
+	screen_headless = headless;
+	if (screen_headless) {
+		LOG_INFO("running headless");
+		return;
+	}
+
 	if (initscr() == NULL)
 		LOG_FATALX("cannot initialise screen");
 
@@ -366,6 +382,14 @@ screen_msg_vprintf(int obj, const char *fmt, va_list ap)
 	int col, row;
 
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
+	if (screen_headless) {
+		vprintf(fmt, ap);
+		putchar('\n');
+		fflush(stdout);
+		XPTHREAD_MUTEX_UNLOCK(&screen_curses_mtx);
+		return;
+	}
+
 	getyx(stdscr, row, col);
 	if (move(screen_status_row, 0) == OK) {
 		bkgdset(screen_objects[obj].attr);
@@ -382,6 +406,9 @@ screen_player_status_printf(const struct format *fmt,
 {
 	int col, row;
 
+	if (screen_headless)
+		return;
+
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	format_snprintf(screen_row, screen_rowsize, fmt, fmtvar, nfmtvars);
 	getyx(stdscr, row, col);
@@ -400,6 +427,9 @@ screen_player_track_printf(const struct format *fmt,
 {
 	int col, row;
 
+	if (screen_headless)
+		return;
+
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	if (track == NULL)
 		screen_row[0] = '\0';
@@ -420,6 +450,9 @@ screen_player_track_printf(const struct format *fmt,
 void
 screen_print(void)
 {
+	if (screen_headless)
+		return;
+
 	view_print();
 	player_print();
 	if (input_get_mode() == INPUT_MODE_PROMPT)
@@ -454,6 +487,9 @@ screen_print_row(const char *s)
 void
 screen_prompt_begin(void)
 {
+	if (screen_headless)
+		return;
+
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	curs_set(1);
 	screen_status_col = 0;
@@ -465,6 +501,9 @@ screen_prompt_end(void)
 {
 	int show;
 
+	if (screen_headless)
+		return;
+
 	show = option_get_boolean("show-cursor");
 	screen_status_clear();
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
@@ -480,6 +519,9 @@ screen_prompt_printf(size_t cursorpos, const char *fmt, ...)
 {
 	va_list ap;
 
+	if (screen_headless)
+		return;
+
 	va_start(ap, fmt);
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	if ((int)cursorpos >= COLS && COLS > 0)
@@ -500,6 +542,9 @@ screen_prompt_printf(size_t cursorpos, const char *fmt, ...)
 void
 screen_refresh(void)
 {
+	if (screen_headless)
+		return;
+
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	clear();
 	XPTHREAD_MUTEX_UNLOCK(&screen_curses_mtx);
@@ -543,6 +588,9 @@ screen_status_clear(void)
 {
 	int col, row;
 
+	if (screen_headless)
+		return;
+
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	getyx(stdscr, row, col);
 	if (move(screen_status_row, 0) == OK) {
@@ -563,6 +611,9 @@ screen_view_get_nrows(void)
 void
 screen_view_print(const char *s)
 {
+	if (screen_headless)
+		return;
+
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	screen_view_print_row(screen_objects[SCREEN_OBJ_VIEW].attr, s);
 	XPTHREAD_MUTEX_UNLOCK(&screen_curses_mtx);
@@ -571,6 +622,9 @@ screen_view_print(const char *s)
 void
 screen_view_print_active(const char *s)
 {
+	if (screen_headless)
+		return;
+
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	screen_view_print_row(screen_objects[SCREEN_OBJ_ACTIVE].attr, s);
 	XPTHREAD_MUTEX_UNLOCK(&screen_curses_mtx);
@@ -581,6 +635,9 @@ screen_view_print_begin(void)
 {
 	int i;
 
+	if (screen_headless)
+		return;
+
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	/* Clear the view area. */
 	bkgdset(screen_objects[SCREEN_OBJ_VIEW].attr);
@@ -595,6 +652,9 @@ screen_view_print_begin(void)
 void
 screen_view_print_end(void)
 {
+	if (screen_headless)
+		return;
+
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	if (input_get_mode() == INPUT_MODE_PROMPT)
 		move(screen_status_row, screen_status_col);
@@ -618,6 +678,9 @@ screen_view_print_row(chtype attr, const char *s)
 void
 screen_view_print_selected(const char *s)
 {
+	if (screen_headless)
+		return;
+
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	screen_view_selected_row = screen_view_current_row;
 	screen_view_print_row(screen_objects[SCREEN_OBJ_SELECTOR].attr, s);
@@ -629,6 +692,9 @@ screen_view_title_printf(const char *fmt, ...)
 {
 	va_list ap;
 
+	if (screen_headless)
+		return;
+
 	va_start(ap, fmt);
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	if (move(SCREEN_TITLE_ROW, 0) == OK) {
@@ -646,6 +712,9 @@ screen_view_title_printf_right(const char *fmt, ...)
 	va_list	ap;
 	int	len;
 
+	if (screen_headless)
+		return;
+
 	va_start(ap, fmt);
 	XPTHREAD_MUTEX_LOCK(&screen_curses_mtx);
 	bkgdset(screen_objects[SCREEN_OBJ_TITLE].attr);
@@ -25,7 +25,8 @@
 NORETURN static void
 usage(void)
 {
-	fprintf(stderr, "usage: %s [-lv] [-c directory]\n", getprogname());
+	fprintf(stderr, "usage: %s [-blv] [-c directory] [-x script]\n",
+	    getprogname());
 	exit(1);
 }
 
@@ -39,13 +40,17 @@ version(void)
 int
 main(int argc, char **argv)
 {
-	int	 c, lflag;
-	char	*confdir, *promises;
+	int	 bflag, c, lflag;
+	char	*confdir, *promises, *script;
 
 	confdir = NULL;
-	lflag = 0;
-	while ((c = getopt(argc, argv, "c:lv")) != -1)
+	script = NULL;
+	bflag = lflag = 0;
+	while ((c = getopt(argc, argv, "bc:lvx:")) != -1)
 		switch (c) {
+		case 'b':
+			bflag = 1;
+			break;
 		case 'c':
 			confdir = optarg;
 			break;
@@ -55,6 +60,10 @@ main(int argc, char **argv)
 		case 'v':
 			version();
 			break;
+		case 'x':
+			bflag = 1;
+			script = optarg;
+			break;
 		default:
 			usage();
 			break;
@@ -70,7 +79,8 @@ main(int argc, char **argv)
 	option_init();
 	bind_init();
 	conf_init(confdir);
-	screen_init();
+	screen_init(bflag);
+	sample_init();
 	plugin_init();
 	track_init();
 	library_init();
@@ -79,6 +89,7 @@ main(int argc, char **argv)
 	browser_init();
 	player_init();
 	prompt_init();
+	job_init();
 
 	promises = xstrdup("stdio rpath wpath cpath getpw tty");
 	plugin_append_promises(&promises);
@@ -93,8 +104,12 @@ main(int argc, char **argv)
 	conf_read_file();
 	library_read_file();
 	cache_update();
-	input_handle_key();
+	if (bflag)
+		input_handle_batch(script);
+	else
+		input_handle_key();
 
+	job_end();
 	prompt_end();
 	player_end();
 	browser_end();
@@ -36,12 +36,16 @@
 #define IP_PRIORITY_MAD		0
 #define IP_PRIORITY_OPUS	0
 #define IP_PRIORITY_SNDFILE	0
+#define IP_PRIORITY_SYNTH	0
 #define IP_PRIORITY_VORBIS	0
 #define IP_PRIORITY_WAVPACK	0
 #define IP_PRIORITY_MPG123	1
 #define IP_PRIORITY_FFMPEG	2
 #define IP_PRIORITY_AAC		3
 
+/* get_metadata() may be called from several threads at the same time. */
+#define IP_FLAG_THREAD_SAFE	0x1
+
 /* Priority of output plug-ins. */
 #define OP_PRIORITY_SNDIO	0
 #define OP_PRIORITY_PULSE	1
@@ -50,6 +54,8 @@
 #define OP_PRIORITY_OSS		4
 #define OP_PRIORITY_AO		5
 #define OP_PRIORITY_PORTAUDIO	6
+#define OP_PRIORITY_NULL	7
+#define OP_PRIORITY_FILE	8
 
 /* Size of the buffer to be passed to strerror_r(). The value is arbitrary. */
 #define STRERROR_BUFSIZE	256
@@ -168,6 +174,8 @@
 #define XPTHREAD_CREATE(thd, attr, func, arg) \
 	XPTHREAD_WRAPPER(create, thd, attr, func, arg)
 #define XPTHREAD_JOIN(thd, ret)		XPTHREAD_WRAPPER(join, thd, ret)
+#define XPTHREAD_MUTEX_DESTROY(mtx)	XPTHREAD_WRAPPER(mutex_destroy, mtx)
+#define XPTHREAD_MUTEX_INIT(mtx, attr)	XPTHREAD_WRAPPER(mutex_init, mtx, attr)
 #define XPTHREAD_MUTEX_LOCK(mtx)	XPTHREAD_WRAPPER(mutex_lock, mtx)
 #define XPTHREAD_MUTEX_UNLOCK(mtx)	XPTHREAD_WRAPPER(mutex_unlock, mtx)
 
@@ -236,6 +244,21 @@ enum player_source {
 	PLAYER_SOURCE_PLAYLIST
 };
 
+/*
+ * Sample encodings. The values are bit flags so that a set of encodings can be
+ * stored in a single integer. SAMPLE_ENCODING_S24 stores 24-bit samples in the
+ * least significant bytes of 4 bytes and SAMPLE_ENCODING_S24_3 stores them in
+ * 3 bytes.
+ */
+enum sample_encoding {
+	SAMPLE_ENCODING_S8	= 0x01,
+	SAMPLE_ENCODING_S16	= 0x02,
+	SAMPLE_ENCODING_S24	= 0x04,
+	SAMPLE_ENCODING_S24_3	= 0x08,
+	SAMPLE_ENCODING_S32	= 0x10,
+	SAMPLE_ENCODING_FLOAT	= 0x20
+};
+
 enum view_id {
 	VIEW_ID_BROWSER,
 	VIEW_ID_LIBRARY,
@@ -251,6 +274,8 @@ struct menu;
 
 struct menu_entry;
 
+struct option_entry;
+
 struct dir;
 
 struct dir_entry {
@@ -258,6 +283,8 @@ struct dir_entry {
 	char		*path;
 	size_t		 pathsize;
 	enum file_type	 type;
+	uint64_t	 dev;		/* Zero if type is FILE_TYPE_OTHER */
+	uint64_t	 ino;
 };
 
 struct format;
@@ -292,8 +319,21 @@ struct sample_buffer {
 	int		 swap;
 };
 
+/*
+ * The sample formats supported by an output plug-in. A maximum of 0 means
+ * that there is no limit.
+ */
+struct sample_caps {
+	unsigned int	 encodings;
+	unsigned int	 minchannels;
+	unsigned int	 maxchannels;
+	unsigned int	 minrate;
+	unsigned int	 maxrate;
+};
+
 struct sample_format {
 	enum byte_order	 byte_order;
+	enum sample_encoding encoding;
 	unsigned int	 nbits;
 	unsigned int	 nchannels;
 	unsigned int	 rate;
@@ -307,6 +347,8 @@ struct track {
 
 	char		*album;
 	char		*albumartist;
+	char		*albumgain;
+	char		*albumpeak;
 	char		*artist;
 	char		*comment;
 	char		*date;
@@ -315,10 +357,17 @@ struct track {
 	char		*filename;
 	char		*genre;
 	char		*title;
+	char		*trackgain;
 	char		*tracknumber;
+	char		*trackpeak;
 	char		*tracktotal;
 	unsigned int	 duration;
 
+	/* Status of the file when its metadata was read. Zero if unknown. */
+	uint64_t	 file_ino;
+	int64_t		 file_mtime;
+	uint64_t	 file_size;
+
 	struct sample_format format;
 };
 
@@ -327,6 +376,7 @@ struct ip {
 	const char	 *name;
 	const int	  priority;
 	const char	**extensions;
+	const int	  flags;
 	void		  (*close)(struct track *) NONNULL();
 	void		  (*get_metadata)(struct track *) NONNULL();
 	int		  (*get_position)(struct track *, unsigned int *)
@@ -343,13 +393,21 @@ struct op {
 	const char	*name;
 	const int	 priority;
 	const char	*promises;
+	int		 (*begin_write)(void **, size_t *) NONNULL();
 	void		 (*close)(void);
+	int		 (*commit_write)(size_t);
+	int		 (*drop)(void);
 	size_t		 (*get_buffer_size)(void);
+	int		 (*get_caps)(struct sample_caps *) NONNULL();
+	int		 (*get_delay)(unsigned int *) NONNULL();
 	int		 (*get_volume)(void);
 	int		 (*get_volume_support)(void);
 	int		 (*init)(void);
 	int		 (*open)(void);
+	int		 (*pause)(int);
+	int		 (*set_rate)(unsigned int);
 	void		 (*set_volume)(unsigned int);
+	void		 (*set_volume_handler)(void (*)(int));
 	int		 (*start)(struct sample_format *) NONNULL();
 	int		 (*stop)(void);
 	int		 (*write)(struct sample_buffer *) NONNULL();
@@ -378,6 +436,7 @@ const char	*browser_get_dir(void);
 struct track	*browser_get_next_track(void);
 struct track	*browser_get_prev_track(void);
 void		 browser_init(void);
+struct track	*browser_peek_next_track(void);
 void		 browser_print(void);
 void		 browser_reactivate_entry(void);
 void		 browser_refresh_dir(void);
@@ -391,7 +450,9 @@ void		 browser_select_last_entry(void);
 void		 browser_select_next_entry(void);
 void		 browser_select_prev_entry(void);
 
-void		 cache_close(void);
+int		 cache_close(void);
+void		 cache_end(void);
+int		 cache_is_mapped(const void *);
 int		 cache_open(enum cache_mode);
 int		 cache_read_entry(struct track *) NONNULL();
 void		 cache_update(void);
@@ -412,6 +473,8 @@ void		 conf_source_file(const char *) NONNULL();
 void		 dir_close(struct dir *) NONNULL();
 struct dir_entry *dir_get_entry(struct dir *) NONNULL();
 struct dir	*dir_open(const char *) NONNULL();
+int		 dir_walk(const char *, unsigned int, unsigned int,
+		    void (*)(const char *, void *), void *) NONNULL(1, 4);
 
 void		 format_free(struct format *);
 struct format	*format_parse(const char *) NONNULL();
@@ -430,13 +493,25 @@ void		 history_rewind(struct history *) NONNULL();
 
 void		 input_end(void);
 enum input_mode	 input_get_mode(void);
+void		 input_handle_batch(const char *);
 void		 input_handle_key(void);
 void		 input_init(void);
 void		 input_set_mode(enum input_mode);
+void		 input_wakeup(void);
+
+void		 job_add(const char *, void (*)(void *), void (*)(void *),
+		    void *) NONNULL(1, 2);
+int		 job_cancel(unsigned int);
+void		 job_end(void);
+void		 job_init(void);
+int		 job_is_cancelled(void);
+void		 job_print(void);
+void		 job_wait(void);
 
 void		 library_activate_entry(void);
 void		 library_add_dir(const char *) NONNULL();
 void		 library_add_track(struct track *) NONNULL();
+void		 library_add_tracks(struct track **, size_t) NONNULL();
 void		 library_copy_entry(enum view_id);
 void		 library_delete_all_entries(void);
 void		 library_delete_entry(void);
@@ -444,6 +519,7 @@ void		 library_end(void);
 struct track	*library_get_next_track(void);
 struct track	*library_get_prev_track(void);
 void		 library_init(void);
+struct track	*library_peek_next_track(void);
 void		 library_print(void);
 void		 library_reactivate_entry(void);
 void		 library_read_file(void);
@@ -519,6 +595,8 @@ void		 msg_err(const char *, ...) PRINTFLIKE1;
 void		 msg_errx(const char *, ...) PRINTFLIKE1;
 void		 msg_info(const char *, ...) PRINTFLIKE1;
 
+void		 option_add_boolean(const char *, int, void (*)(void))
+		    NONNULL(1);
 void		 option_add_number(const char *, int, int, int, void (*)(void))
 		    NONNULL(1);
 void		 option_add_string(const char *, const char *,
@@ -532,10 +610,14 @@ int		 option_get_attrib(const char *) NONNULL();
 int		 option_get_boolean(const char *) NONNULL();
 int		 option_get_colour(const char *) NONNULL();
 struct format	*option_get_format(const char *) NONNULL();
+struct option_entry *option_get_handle(const char *, enum option_type)
+		    NONNULL();
 int		 option_get_number(const char *) NONNULL();
 void		 option_get_number_range(const char *, int *, int *) NONNULL();
 char		*option_get_string(const char *) NONNULL();
 int		 option_get_type(const char *, enum option_type *) NONNULL();
+int		 option_handle_get_boolean(struct option_entry *) NONNULL();
+int		 option_handle_get_number(struct option_entry *) NONNULL();
 void		 option_init(void);
 void		 option_lock(void);
 void		 option_set_attrib(const char *, int) NONNULL();
@@ -557,10 +639,12 @@ char		*path_get_home_dir(const char *);
 char		*path_normalise(const char *) NONNULL();
 
 void		 player_change_op(void);
+void		 player_configure_dsp(void);
 void		 player_end(void);
 void		 player_forcibly_close_op(void);
 enum byte_order	 player_get_byte_order(void);
 void		 player_init(void);
+int		 player_is_playing(void);
 void		 player_pause(void);
 void		 player_play(void);
 void		 player_play_next(void);
@@ -572,6 +656,7 @@ void		 player_seek(int, int);
 void		 player_set_source(enum player_source);
 void		 player_set_volume(int, int);
 void		 player_stop(void);
+void		 player_update_track(void);
 
 void		 playlist_activate_entry(void);
 void		 playlist_copy_entry(enum view_id);
@@ -580,6 +665,7 @@ struct track	*playlist_get_next_track(void);
 struct track	*playlist_get_prev_track(void);
 void		 playlist_init(void);
 void		 playlist_load(const char *) NONNULL();
+struct track	*playlist_peek_next_track(void);
 void		 playlist_print(void);
 void		 playlist_reactivate_entry(void);
 void		 playlist_scroll_down(enum menu_scroll);
@@ -598,7 +684,10 @@ void		 plugin_end(void);
 void		 plugin_init(void);
 const struct ip	*plugin_find_ip(const char *) NONNULL();
 const struct op	*plugin_find_op(const char *) NONNULL();
+void		 plugin_foreach_ip(void (*)(const struct ip *, void *), void *)
+		    NONNULL(1);
 
+void		 prompt_answer(const char *) NONNULL();
 void		 prompt_end(void);
 void		 prompt_get_answer(const char *, void (*)(char *, void *),
 		    void *) NONNULL(1, 2);
@@ -613,6 +702,7 @@ void		 prompt_print(void);
 void		 queue_activate_entry(void);
 void		 queue_add_dir(const char *) NONNULL();
 void		 queue_add_track(struct track *) NONNULL();
+void		 queue_add_tracks(struct track **, size_t) NONNULL();
 void		 queue_copy_entry(enum view_id);
 void		 queue_delete_all_entries(void);
 void		 queue_delete_entry(void);
@@ -621,6 +711,7 @@ struct track	*queue_get_next_track(void);
 void		 queue_init(void);
 void		 queue_move_entry_down(void);
 void		 queue_move_entry_up(void);
+struct track	*queue_peek_next_track(void);
 void		 queue_print(void);
 void		 queue_scroll_down(enum menu_scroll);
 void		 queue_scroll_up(enum menu_scroll);
@@ -632,13 +723,52 @@ void		 queue_select_next_entry(void);
 void		 queue_select_prev_entry(void);
 void		 queue_update(void);
 
+void		 resample_close(void);
+int		 resample_enabled(void);
+size_t		 resample_flush(void **) NONNULL();
+int		 resample_open(const struct sample_format *, unsigned int)
+		    NONNULL();
+size_t		 resample_process(const struct sample_buffer *, void **)
+		    NONNULL();
+void		 resample_reset(void);
+
+int		 sample_check(void);
+void		 sample_convert(void *, enum sample_encoding, const void *,
+		    enum sample_encoding, size_t, enum byte_order) NONNULL();
+void		 sample_dblp_to_s16(int16_t *, const double * const *,
+		    unsigned int, size_t, size_t) NONNULL();
+float		 sample_dot(const float *, const float *, size_t) NONNULL();
+unsigned int	 sample_encoding_size(enum sample_encoding);
+void		 sample_fixp_to_s16(int16_t *, const int32_t * const *,
+		    unsigned int, size_t, size_t, unsigned int) NONNULL();
+void		 sample_flt_to_s16(int16_t *, const float *, size_t) NONNULL();
+void		 sample_fltp_to_s16(int16_t *, const float * const *,
+		    unsigned int, size_t, size_t) NONNULL();
+void		 sample_init(void);
+void		 sample_s16p_to_s16(int16_t *, const int16_t * const *,
+		    unsigned int, size_t, size_t) NONNULL();
+void		 sample_s32_to_s8(int8_t *, const int32_t *, size_t) NONNULL();
+void		 sample_s32_to_s16(int16_t *, const int32_t *, size_t)
+		    NONNULL();
+void		 sample_s32p_to_s8(int8_t *, const int32_t * const *,
+		    unsigned int, size_t, size_t) NONNULL();
+void		 sample_s32p_to_s16(int16_t *, const int32_t * const *,
+		    unsigned int, size_t, size_t) NONNULL();
+void		 sample_s32p_to_s32(int32_t *, const int32_t * const *,
+		    unsigned int, size_t, size_t) NONNULL();
+void		 sample_scale_s8(int8_t *, size_t, float) NONNULL();
+void		 sample_scale_s16(int16_t *, size_t, float) NONNULL();
+void		 sample_scale_s32(int32_t *, size_t, float, int32_t) NONNULL();
+void		 sample_swap16(int16_t *, size_t) NONNULL();
+void		 sample_swap32(int32_t *, size_t) NONNULL();
+
 void		 screen_configure_cursor(void);
 void		 screen_configure_objects(void);
 void		 screen_end(void);
 int		 screen_get_key(void);
 int		 screen_get_ncolours(void);
 unsigned int	 screen_get_ncols(void);
-void		 screen_init(void);
+void		 screen_init(int);
 void		 screen_msg_error_printf(const char *, ...) NONNULL()
 		    PRINTFLIKE1;
 void		 screen_msg_error_vprintf(const char *, va_list) NONNULL()
@@ -665,6 +795,8 @@ void		 screen_view_print_selected(const char *) NONNULL();
 void		 screen_view_title_printf(const char *, ...) PRINTFLIKE1;
 void		 screen_view_title_printf_right(const char *, ...) PRINTFLIKE1;
 
+void		 track_add_dir(const char *,
+		    void (*)(struct track **, size_t)) NONNULL();
 int		 track_cmp(const struct track *, const struct track *)
 		    NONNULL();
 void		 track_copy_vorbis_comment(struct track *, const char *);
@@ -676,7 +808,7 @@ struct track	*track_require(char *);
 int		 track_search(const struct track *, const char *);
 void		 track_split_tag(const char *, char **, char **);
 void		 track_unlock_metadata(void);
-void		 track_update_metadata(int);
+void		 track_update_metadata(int, int);
 int		 track_write_cache(void);
 
 void		 view_activate_entry(void);
@@ -690,6 +822,7 @@ void		 view_handle_key(int);
 void		 view_move_entry_down(void);
 void		 view_move_entry_up(void);
 void		 view_print(void);
+void		 view_print_dirty(void);
 void		 view_reactivate_entry(void);
 void		 view_scroll_down(enum menu_scroll);
 void		 view_scroll_up(enum menu_scroll);
@@ -701,6 +834,7 @@ void		 view_select_last_entry(void);
 void		 view_select_next_entry(void);
 void		 view_select_prev_entry(void);
 void		 view_select_view(enum view_id);
+void		 view_set_dirty(enum view_id);
 
 int		 xasprintf(char **, const char *, ...) NONNULL() PRINTFLIKE2;
 void		*xmalloc(size_t);
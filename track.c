@@ -16,7 +16,10 @@
 
 #include "config.h"
 
+#include <sys/stat.h>
+
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,40 +28,242 @@
 
 #include "siren.h"
 
+/* stat() mostly waits for the file system, so use more threads than CPUs. */
+#define TRACK_STAT_NTHREADS	16
+
+/* Number of tracks whose metadata is merged into the tree at once. */
+#define TRACK_READ_BATCH	64
+
 struct track_entry {
 	struct track		track;
 	int			delete;
 	RB_ENTRY(track_entry)	entries;
 };
 
+struct track_update {
+	struct track_entry	*te;		/* NULL if new */
+	struct track_entry	*nte;		/* Metadata read by a thread */
+	struct track		**result;	/* Set to the new track */
+	int			 missing;
+	int			 changed;
+	uint64_t		 file_ino;
+	int64_t			 file_mtime;
+	uint64_t		 file_size;
+};
+
+/*
+ * A set of tracks that is processed by a pool of threads. The threads take the
+ * next track from the updates array and, when reading metadata, append its
+ * index to the done array.
+ */
+struct track_pool {
+	struct track_update	*updates;
+	size_t			 nupdates;
+	atomic_size_t		 next;
+	atomic_int		 cancelled;
+	pthread_mutex_t		 mtx;
+	pthread_cond_t		 cond;
+	size_t			*done;
+	size_t			 ndone;
+	void			 (*merged)(void *);	/* Called per batch */
+	void			*arg;
+};
+
+struct track_add_dir_data {
+	struct track		**tracks;
+	size_t			 ntracks;
+	size_t			 nadded;
+	void			 (*add)(struct track **, size_t);
+};
+
+struct track_dir_files {
+	char			**paths;
+	size_t			 npaths;
+	size_t			 size;
+};
+
 RB_HEAD(track_tree, track_entry);
 
+static struct track_entry *track_add_entry(struct track_entry *);
+static void		 track_add_dir_file(const char *, void *);
+static void		 track_add_dir_tracks(void *);
 static int		 track_cmp_entry(struct track_entry *,
 			    struct track_entry *);
 static int		 track_cmp_number(const char *, const char *);
+static int		 track_cmp_path(const void *, const void *);
 static int		 track_cmp_string(const char *, const char *);
+static struct track_entry *track_find_entry(char *, const struct ip *);
 static void		 track_free_entry(struct track_entry *);
 static void		 track_free_metadata(struct track_entry *);
+static void		 track_free_string(char *);
+static size_t		 track_get_nthreads(size_t);
 static void		 track_init_metadata(struct track_entry *);
+static void		 track_merge_update(struct track_update *);
+static struct track_entry *track_new_entry(char *, const struct ip *);
 static void		 track_read_cache(void);
+static void		 track_read_entry(struct track_entry *);
+static void		*track_read_handler(void *);
+static void		 track_read_metadata(struct track_pool *);
+static void		*track_stat_handler(void *);
 
+/* Protects the tree as well as the metadata of the tracks in it. */
 static pthread_mutex_t	 track_metadata_mtx = PTHREAD_MUTEX_INITIALIZER;
 static struct track_tree track_tree = RB_INITIALIZER(track_tree);
 static size_t		 track_nentries;
 static int		 track_tree_modified;
 
+/* Stands in for a track whose metadata has not been read yet. */
+static struct track	 track_pending;
+
+/* Serialises input plug-ins that are not thread-safe. */
+static pthread_mutex_t	 track_ip_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 RB_GENERATE_STATIC(track_tree, track_entry, entries, track_cmp_entry)
 
-static int
+/*
+ * Add the regular files in the specified directory and its subdirectories.
+ * The directories are walked by a pool of threads and the metadata of new
+ * tracks is read by another. The files are sorted by path, so that the result
+ * does not depend on the order in which they were found. As the tracks become
+ * available, add() is called for batches of them, in that order.
+ */
+void
+track_add_dir(const char *path, void (*add)(struct track **, size_t))
+{
+	struct track_add_dir_data data;
+	struct track_dir_files	 files;
+	struct track_entry	*te;
+	struct track_pool	 pool;
+	struct track_update	*u;
+	const struct ip		*ip;
+	size_t			 i, npaths;
+	char			**paths;
+
+	files.paths = NULL;
+	files.npaths = files.size = 0;
+	dir_walk(path, option_get_number("directory-max-depth"),
+	    option_get_number("directory-threads"), track_add_dir_file, &files);
+	paths = files.paths;
+	npaths = files.npaths;
+	if (npaths == 0 || job_is_cancelled())
+		goto out;
+
+	qsort(paths, npaths, sizeof *paths, track_cmp_path);
+
+	data.tracks = xreallocarray(NULL, npaths, sizeof *data.tracks);
+	data.ntracks = npaths;
+	data.nadded = 0;
+	data.add = add;
+
+	pool.updates = xreallocarray(NULL, npaths, sizeof *pool.updates);
+	pool.nupdates = 0;
+	pool.merged = track_add_dir_tracks;
+	pool.arg = &data;
+
+	for (i = 0; i < npaths; i++) {
+		data.tracks[i] = NULL;
+
+		track_lock_metadata();
+		te = track_find_entry(paths[i], NULL);
+		track_unlock_metadata();
+
+		if (te != NULL) {
+			if (te->track.ip != NULL)
+				data.tracks[i] = &te->track;
+			else
+				msg_errx("%s: Unsupported file format",
+				    paths[i]);
+			continue;
+		}
+
+		if ((ip = plugin_find_ip(paths[i])) == NULL) {
+			msg_errx("%s: Unsupported file format", paths[i]);
+			continue;
+		}
+
+		data.tracks[i] = &track_pending;
+		u = &pool.updates[pool.nupdates++];
+		u->te = NULL;
+		u->nte = track_new_entry(paths[i], ip);
+		u->result = &data.tracks[i];
+		u->changed = 1;
+	}
+
+	if (pool.nupdates > 0)
+		track_read_metadata(&pool);
+	track_add_dir_tracks(&data);
+
+	free(pool.updates);
+	free(data.tracks);
+out:
+	for (i = 0; i < npaths; i++)
+		free(paths[i]);
+	free(paths);
+}
+
+/*
+ * Called by dir_walk() for each regular file found.
+ */
+static void
+track_add_dir_file(const char *path, void *p)
+{
+	struct track_dir_files *files;
+
+	files = p;
+	if (files->npaths == files->size) {
+		files->size = (files->size == 0) ? 64 : files->size * 2;
+		files->paths = xreallocarray(files->paths, files->size,
+		    sizeof *files->paths);
+	}
+	files->paths[files->npaths++] = xstrdup(path);
+}
+
+/*
+ * Call add() for the tracks whose metadata has been read, up to the first one
+ * whose metadata has not. Do nothing if the running job has been cancelled.
+ */
+static void
+track_add_dir_tracks(void *p)
+{
+	struct track_add_dir_data *data;
+	size_t			 i, n;
+
+	data = p;
+	if (job_is_cancelled())
+		return;
+
+	/* Move the tracks to add to the front of the ready range. */
+	n = data->nadded;
+	for (i = data->nadded; i < data->ntracks &&
+	    data->tracks[i] != &track_pending; i++)
+		if (data->tracks[i] != NULL)
+			data->tracks[n++] = data->tracks[i];
+
+	if (n > data->nadded)
+		data->add(data->tracks + data->nadded, n - data->nadded);
+	data->nadded = i;
+}
+
+/*
+ * Add the specified entry to the tree. If the tree already has an entry with
+ * the same path, the specified entry is freed and the existing one is returned
+ * instead. The caller must hold track_metadata_mtx once other threads are
+ * running.
+ */
+static struct track_entry *
 track_add_entry(struct track_entry *te)
 {
-	if (track_nentries == SIZE_MAX)
-		return -1;
+	struct track_entry *ete;
 
-	if (RB_INSERT(track_tree, &track_tree, te) != NULL) {
-		/* This should not happen. */
-		LOG_ERRX("%s: track already in tree", te->track.path);
-		return -1;
+	if (track_nentries == SIZE_MAX) {
+		track_free_entry(te);
+		return NULL;
+	}
+
+	if ((ete = RB_INSERT(track_tree, &track_tree, te)) != NULL) {
+		LOG_INFO("%s: track already in tree", te->track.path);
+		track_free_entry(te);
+		return ete;
 	}
 
 	te->track.filename = strrchr(te->track.path, '/');
@@ -68,7 +273,7 @@ track_add_entry(struct track_entry *te)
 		te->track.filename = te->track.path;
 
 	track_nentries++;
-	return 0;
+	return te;
 }
 
 static struct track *
@@ -76,23 +281,16 @@ track_add_new_entry(char *path, const struct ip *ip)
 {
 	struct track_entry *te;
 
-	te = xmalloc(sizeof *te);
-	te->delete = 0;
-	te->track.path = xstrdup(path);
-	te->track.ip = (ip != NULL) ? ip : plugin_find_ip(path);
-	te->track.ipdata = NULL;
-	track_init_metadata(te);
-
+	te = track_new_entry(path, (ip != NULL) ? ip : plugin_find_ip(path));
 	if (te->track.ip != NULL)
-		te->track.ip->get_metadata(&te->track);
+		track_read_entry(te);
 
-	if (track_add_entry(te) == -1) {
-		track_free_entry(te);
-		return NULL;
-	}
+	track_lock_metadata();
+	if ((te = track_add_entry(te)) != NULL)
+		track_tree_modified = 1;
+	track_unlock_metadata();
 
-	track_tree_modified = 1;
-	return &te->track;
+	return (te != NULL) ? &te->track : NULL;
 }
 
 void
@@ -137,6 +335,18 @@ track_copy_vorbis_comment(struct track *t, const char *com)
 	} else if (!strncasecmp(com, "genre=", 6)) {
 		free(t->genre);
 		t->genre = xstrdup(com + 6);
+	} else if (!strncasecmp(com, "replaygain_album_gain=", 22)) {
+		free(t->albumgain);
+		t->albumgain = xstrdup(com + 22);
+	} else if (!strncasecmp(com, "replaygain_album_peak=", 22)) {
+		free(t->albumpeak);
+		t->albumpeak = xstrdup(com + 22);
+	} else if (!strncasecmp(com, "replaygain_track_gain=", 22)) {
+		free(t->trackgain);
+		t->trackgain = xstrdup(com + 22);
+	} else if (!strncasecmp(com, "replaygain_track_peak=", 22)) {
+		free(t->trackpeak);
+		t->trackpeak = xstrdup(com + 22);
 	} else if (!strncasecmp(com, "title=", 6)) {
 		free(t->title);
 		t->title = xstrdup(com + 6);
@@ -162,6 +372,10 @@ track_copy_vorbis_comment(struct track *t, const char *com)
 	}
 }
 
+/*
+ * Compare two tracks by their metadata. The caller must hold
+ * track_metadata_mtx.
+ */
 int
 track_cmp(const struct track *t1, const struct track *t2)
 {
@@ -214,6 +428,16 @@ track_cmp_number(const char *s1, const char *s2)
 	return (i1 < i2) ? -1 : (i1 > i2);
 }
 
+static int
+track_cmp_path(const void *p1, const void *p2)
+{
+	const char * const *s1, * const *s2;
+
+	s1 = p1;
+	s2 = p2;
+	return strcmp(*s1, *s2);
+}
+
 static int
 track_cmp_string(const char *s1, const char *s2)
 {
@@ -236,6 +460,8 @@ track_end(void)
 		RB_REMOVE(track_tree, &track_tree, te);
 		track_free_entry(te);
 	}
+
+	cache_end();
 }
 
 static struct track_entry *
@@ -254,24 +480,39 @@ static void
 track_free_entry(struct track_entry *te)
 {
 	track_free_metadata(te);
-	free(te->track.path);
+	track_free_string(te->track.path);
 	free(te);
 }
 
 static void
 track_free_metadata(struct track_entry *te)
 {
-	free(te->track.album);
-	free(te->track.albumartist);
-	free(te->track.artist);
-	free(te->track.comment);
-	free(te->track.date);
-	free(te->track.discnumber);
-	free(te->track.disctotal);
-	free(te->track.genre);
-	free(te->track.title);
-	free(te->track.tracknumber);
-	free(te->track.tracktotal);
+	track_free_string(te->track.album);
+	track_free_string(te->track.albumartist);
+	track_free_string(te->track.albumgain);
+	track_free_string(te->track.albumpeak);
+	track_free_string(te->track.artist);
+	track_free_string(te->track.comment);
+	track_free_string(te->track.date);
+	track_free_string(te->track.discnumber);
+	track_free_string(te->track.disctotal);
+	track_free_string(te->track.genre);
+	track_free_string(te->track.title);
+	track_free_string(te->track.trackgain);
+	track_free_string(te->track.tracknumber);
+	track_free_string(te->track.trackpeak);
+	track_free_string(te->track.tracktotal);
+}
+
+/*
+ * Strings read from the metadata cache point into its mapping and must not be
+ * freed.
+ */
+static void
+track_free_string(char *s)
+{
+	if (!cache_is_mapped(s))
+		free(s);
 }
 
 struct track *
@@ -279,7 +520,9 @@ track_get(char *path, const struct ip *ip)
 {
 	struct track_entry *te;
 
+	track_lock_metadata();
 	te = track_find_entry(path, ip);
+	track_unlock_metadata();
 	if (te != NULL) {
 		if (te->track.ip != NULL)
 			return &te->track;
@@ -300,6 +543,21 @@ track_get(char *path, const struct ip *ip)
 	return track_add_new_entry(path, ip);
 }
 
+/*
+ * Return the number of threads to use to read the metadata of the specified
+ * number of tracks.
+ */
+static size_t
+track_get_nthreads(size_t ntracks)
+{
+	long nthreads;
+
+	nthreads = option_get_number("metadata-threads");
+	if (nthreads == 0 && (nthreads = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		nthreads = 1;
+	return (size_t)nthreads < ntracks ? (size_t)nthreads : ntracks;
+}
+
 void
 track_init(void)
 {
@@ -311,6 +569,8 @@ track_init_metadata(struct track_entry *te)
 {
 	te->track.album = NULL;
 	te->track.albumartist = NULL;
+	te->track.albumgain = NULL;
+	te->track.albumpeak = NULL;
 	te->track.artist = NULL;
 	te->track.comment = NULL;
 	te->track.date = NULL;
@@ -318,9 +578,14 @@ track_init_metadata(struct track_entry *te)
 	te->track.disctotal = NULL;
 	te->track.genre = NULL;
 	te->track.title = NULL;
+	te->track.trackgain = NULL;
 	te->track.tracknumber = NULL;
+	te->track.trackpeak = NULL;
 	te->track.tracktotal = NULL;
 	te->track.duration = 0;
+	te->track.file_ino = 0;
+	te->track.file_mtime = 0;
+	te->track.file_size = 0;
 }
 
 void
@@ -329,6 +594,75 @@ track_lock_metadata(void)
 	XPTHREAD_MUTEX_LOCK(&track_metadata_mtx);
 }
 
+/*
+ * Move the metadata read by a thread into the track tree. The caller must hold
+ * track_metadata_mtx.
+ */
+static void
+track_merge_update(struct track_update *u)
+{
+	struct track_entry	*te;
+	struct track		*dst, *src;
+
+	if (u->te == NULL) {
+		if (!u->changed) {
+			/* Cancelled. */
+			track_free_entry(u->nte);
+			*u->result = NULL;
+			return;
+		}
+		te = track_add_entry(u->nte);
+		*u->result = (te != NULL) ? &te->track : NULL;
+		track_tree_modified = 1;
+		return;
+	}
+
+	/* The path is shared with the entry in the tree. */
+	if (!u->changed) {
+		free(u->nte);
+		return;
+	}
+
+	dst = &u->te->track;
+	src = &u->nte->track;
+	track_free_metadata(u->te);
+	dst->album = src->album;
+	dst->albumartist = src->albumartist;
+	dst->albumgain = src->albumgain;
+	dst->albumpeak = src->albumpeak;
+	dst->artist = src->artist;
+	dst->comment = src->comment;
+	dst->date = src->date;
+	dst->discnumber = src->discnumber;
+	dst->disctotal = src->disctotal;
+	dst->genre = src->genre;
+	dst->title = src->title;
+	dst->trackgain = src->trackgain;
+	dst->tracknumber = src->tracknumber;
+	dst->trackpeak = src->trackpeak;
+	dst->tracktotal = src->tracktotal;
+	dst->duration = src->duration;
+	dst->file_ino = src->file_ino;
+	dst->file_mtime = src->file_mtime;
+	dst->file_size = src->file_size;
+	free(u->nte);
+	track_tree_modified = 1;
+}
+
+static struct track_entry *
+track_new_entry(char *path, const struct ip *ip)
+{
+	struct track_entry *te;
+
+	te = xmalloc(sizeof *te);
+	te->delete = 0;
+	te->track.path = xstrdup(path);
+	te->track.ip = ip;
+	te->track.ipdata = NULL;
+	track_init_metadata(te);
+	return te;
+}
+
 static void
 track_read_cache(void)
 {
@@ -344,40 +678,162 @@ track_read_cache(void)
 			track_free_entry(te);
 			break;
 		}
-		if (track_add_entry(te) == -1)
-			track_free_entry(te);
+		track_add_entry(te);
 	}
 
 	cache_close();
 }
 
+/*
+ * Read the metadata of the specified entry. The entry must not be in the tree
+ * yet, or track_metadata_mtx must be held.
+ */
+static void
+track_read_entry(struct track_entry *te)
+{
+	struct stat	st;
+	int		serialise;
+
+	if (stat(te->track.path, &st) == 0) {
+		te->track.file_ino = st.st_ino;
+		te->track.file_mtime = st.st_mtime;
+		te->track.file_size = st.st_size;
+	}
+
+	serialise = !(te->track.ip->flags & IP_FLAG_THREAD_SAFE);
+	if (serialise)
+		XPTHREAD_MUTEX_LOCK(&track_ip_mtx);
+	te->track.ip->get_metadata(&te->track);
+	if (serialise)
+		XPTHREAD_MUTEX_UNLOCK(&track_ip_mtx);
+}
+
+/*
+ * Read the metadata of the tracks in a pool. Several of these threads run at
+ * once.
+ */
+static void *
+track_read_handler(void *p)
+{
+	struct track_pool	*pool;
+	struct track_update	*u;
+	size_t			 i;
+
+	pool = p;
+	while ((i = atomic_fetch_add(&pool->next, 1)) < pool->nupdates) {
+		u = &pool->updates[i];
+		if (atomic_load(&pool->cancelled))
+			u->changed = 0;
+		else
+			track_read_entry(u->nte);
+
+		XPTHREAD_MUTEX_LOCK(&pool->mtx);
+		pool->done[pool->ndone++] = i;
+		XPTHREAD_COND_BROADCAST(&pool->cond);
+		XPTHREAD_MUTEX_UNLOCK(&pool->mtx);
+	}
+
+	return NULL;
+}
+
+/*
+ * Read the metadata of the tracks in a pool. The metadata is read into
+ * separate entries, so that the tree need not be locked meanwhile, and then
+ * merged into the tree in batches. If the running job is cancelled, the
+ * remaining tracks are skipped.
+ */
+static void
+track_read_metadata(struct track_pool *pool)
+{
+	pthread_t	*thd;
+	size_t		 i, nmerged, nread, nthreads;
+
+	nthreads = track_get_nthreads(pool->nupdates);
+	LOG_INFO("reading metadata of %zu tracks with %zu threads",
+	    pool->nupdates, nthreads);
+
+	pool->done = xreallocarray(NULL, pool->nupdates, sizeof *pool->done);
+	pool->ndone = 0;
+	atomic_store(&pool->next, 0);
+	atomic_store(&pool->cancelled, 0);
+	XPTHREAD_MUTEX_INIT(&pool->mtx, NULL);
+	XPTHREAD_COND_INIT(&pool->cond, NULL);
+
+	thd = xreallocarray(NULL, nthreads, sizeof *thd);
+	for (i = 0; i < nthreads; i++)
+		XPTHREAD_CREATE(&thd[i], NULL, track_read_handler, pool);
+
+	for (nmerged = 0; nmerged < pool->nupdates; nmerged = nread) {
+		XPTHREAD_MUTEX_LOCK(&pool->mtx);
+		while (pool->ndone - nmerged < TRACK_READ_BATCH &&
+		    pool->ndone < pool->nupdates)
+			XPTHREAD_COND_WAIT(&pool->cond, &pool->mtx);
+		nread = pool->ndone;
+		XPTHREAD_MUTEX_UNLOCK(&pool->mtx);
+
+		if (job_is_cancelled())
+			atomic_store(&pool->cancelled, 1);
+
+		track_lock_metadata();
+		for (i = nmerged; i < nread; i++)
+			track_merge_update(&pool->updates[pool->done[i]]);
+		track_unlock_metadata();
+
+		if (pool->merged != NULL)
+			pool->merged(pool->arg);
+
+		if (!atomic_load(&pool->cancelled))
+			msg_info("Reading metadata: %zu of %zu tracks (%zu%%)",
+			    nread, pool->nupdates,
+			    100 * nread / pool->nupdates);
+	}
+
+	for (i = 0; i < nthreads; i++)
+		XPTHREAD_JOIN(thd[i], NULL);
+	free(thd);
+
+	XPTHREAD_COND_DESTROY(&pool->cond);
+	XPTHREAD_MUTEX_DESTROY(&pool->mtx);
+	free(pool->done);
+	msg_clear();
+}
+
 struct track *
 track_require(char *path)
 {
 	struct track_entry *te;
 
+	track_lock_metadata();
 	te = track_find_entry(path, NULL);
+	track_unlock_metadata();
 	return (te != NULL) ? &te->track : track_add_new_entry(path, NULL);
 }
 
 int
 track_search(const struct track *t, const char *search)
 {
+	int ret;
+
+	ret = 0;
+	track_lock_metadata();
 	if (t->album != NULL && strcasestr(t->album, search))
-		return 0;
+		goto out;
 	if (t->artist != NULL && strcasestr(t->artist, search))
-		return 0;
+		goto out;
 	if (t->date != NULL && strcasestr(t->date, search))
-		return 0;
+		goto out;
 	if (t->genre != NULL && strcasestr(t->genre, search))
-		return 0;
+		goto out;
 	if (t->title != NULL && strcasestr(t->title, search))
-		return 0;
+		goto out;
 	if (t->tracknumber != NULL && strcasestr(t->tracknumber, search))
-		return 0;
+		goto out;
 	if (strcasestr(t->path, search))
-		return 0;
-	return -1;
+		goto out;
+	ret = -1;
+out:
+	track_unlock_metadata();
+	return ret;
 }
 
 void
@@ -392,62 +848,158 @@ track_split_tag(const char *tag, char **fld1, char **fld2)
 		*fld2 = xstrdup(tag + pos + 1);
 }
 
+/*
+ * Check whether the files of the tracks in a pool still exist and whether they
+ * have changed. Several of these threads run at once.
+ */
+static void *
+track_stat_handler(void *p)
+{
+	struct track_pool	*pool;
+	struct track_update	*u;
+	struct stat		 st;
+	size_t			 i;
+
+	pool = p;
+	while ((i = atomic_fetch_add(&pool->next, 1)) < pool->nupdates) {
+		u = &pool->updates[i];
+		if (stat(u->te->track.path, &st) == -1) {
+			u->missing = 1;
+			u->changed = 0;
+			continue;
+		}
+
+		u->missing = 0;
+		u->file_ino = st.st_ino;
+		u->file_mtime = st.st_mtime;
+		u->file_size = st.st_size;
+		u->changed = u->file_ino != u->te->track.file_ino ||
+		    u->file_mtime != u->te->track.file_mtime ||
+		    u->file_size != u->te->track.file_size;
+	}
+
+	return NULL;
+}
+
 void
 track_unlock_metadata(void)
 {
 	XPTHREAD_MUTEX_UNLOCK(&track_metadata_mtx);
 }
 
+/*
+ * Re-read the metadata of the tracks whose files have changed, as indicated by
+ * their inode number, modification time and size. If force is set, re-read the
+ * metadata of all tracks. If delete is set, delete tracks whose files no longer
+ * exist.
+ */
 void
-track_update_metadata(int delete)
+track_update_metadata(int delete, int force)
 {
 	struct track_entry	*te;
-	size_t			 i;
+	struct track_pool	 pool;
+	struct track_update	*u;
+	pthread_t		 thd[TRACK_STAT_NTHREADS];
+	size_t			 i, nchanged, nthreads;
 
-	i = 1;
-	RB_FOREACH(te, track_tree, &track_tree) {
-		msg_info("Updating track %zu of %zu (%zu%%)", i,
-		    track_nentries, 100 * i / track_nentries);
-		i++;
+	track_lock_metadata();
+	if (track_nentries == 0) {
+		track_unlock_metadata();
+		return;
+	}
+
+	pool.updates = xreallocarray(NULL, track_nentries,
+	    sizeof *pool.updates);
+	pool.nupdates = 0;
+	RB_FOREACH(te, track_tree, &track_tree)
+		pool.updates[pool.nupdates++].te = te;
+	track_unlock_metadata();
+
+	msg_info("Checking %zu tracks", pool.nupdates);
+
+	atomic_store(&pool.next, 0);
+	nthreads = pool.nupdates < TRACK_STAT_NTHREADS ? pool.nupdates :
+	    TRACK_STAT_NTHREADS;
+	for (i = 0; i < nthreads; i++)
+		XPTHREAD_CREATE(&thd[i], NULL, track_stat_handler, &pool);
+	for (i = 0; i < nthreads; i++)
+		XPTHREAD_JOIN(thd[i], NULL);
+
+	if (job_is_cancelled()) {
+		free(pool.updates);
+		msg_clear();
+		return;
+	}
 
-		if (access(te->track.path, F_OK) == -1) {
-			if (delete)
-				te->delete = 1;
+	nchanged = 0;
+	track_lock_metadata();
+	for (i = 0; i < pool.nupdates; i++) {
+		u = &pool.updates[i];
+		if (u->missing) {
+			if (delete) {
+				u->te->delete = 1;
+				track_tree_modified = 1;
+			}
 			continue;
 		}
 
-		if (te->track.ip == NULL) {
-			te->track.ip = plugin_find_ip(te->track.path);
-			if (te->track.ip == NULL) {
-				LOG_ERRX("%s: no ip found", te->track.path);
+		if (force)
+			u->changed = 1;
+		else if (!u->changed)
+			continue;
+
+		if (u->te->track.ip == NULL) {
+			u->te->track.ip = plugin_find_ip(u->te->track.path);
+			if (u->te->track.ip == NULL) {
+				LOG_ERRX("%s: no ip found", u->te->track.path);
+				u->changed = 0;
 				continue;
 			}
 		}
 
-		track_lock_metadata();
-		track_free_metadata(te);
-		track_init_metadata(te);
-		te->track.ip->get_metadata(&te->track);
-		track_unlock_metadata();
+		/* Share the path with the entry in the tree. */
+		u->nte = xmalloc(sizeof *u->nte);
+		u->nte->delete = 0;
+		u->nte->track.path = u->te->track.path;
+		u->nte->track.ip = u->te->track.ip;
+		u->nte->track.ipdata = NULL;
+		track_init_metadata(u->nte);
+		pool.updates[nchanged++] = *u;
 	}
+	track_unlock_metadata();
 
+	LOG_INFO("%zu of %zu tracks changed", nchanged, pool.nupdates);
+
+	pool.nupdates = nchanged;
+	pool.merged = NULL;
+	if (nchanged > 0)
+		track_read_metadata(&pool);
+
+	free(pool.updates);
 	msg_clear();
-	track_tree_modified = 1;
 }
 
 int
 track_write_cache(void)
 {
-	struct track_entry *te;
+	struct track_entry	*te;
+	int			 ret;
 
 	if (cache_open(CACHE_MODE_WRITE) == -1)
 		return -1;
 
+	track_lock_metadata();
 	RB_FOREACH(te, track_tree, &track_tree)
 		if (!te->delete)
 			cache_write_entry(&te->track);
-
-	cache_close();
 	track_tree_modified = 0;
-	return 0;
+	track_unlock_metadata();
+
+	if ((ret = cache_close()) == -1) {
+		track_lock_metadata();
+		track_tree_modified = 1;
+		track_unlock_metadata();
+	}
+
+	return ret;
 }
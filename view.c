@@ -16,6 +16,7 @@
 
 #include "config.h"
 
+#include <stdatomic.h>
 #include <stdlib.h>
 
 #include "siren.h"
@@ -131,6 +132,7 @@ static struct view_entry view_list[] = {
 
 static int		 view_sel;
 static char		*view_search = NULL;
+static atomic_uint	 view_dirty;
 
 void
 view_activate_entry(void)
@@ -237,6 +239,17 @@ view_print(void)
 	view_list[view_sel].print();
 }
 
+/*
+ * Redraw the current view if it has been marked as dirty. This function must
+ * be called from the main thread.
+ */
+void
+view_print_dirty(void)
+{
+	if (atomic_exchange(&view_dirty, 0) & (1U << view_list[view_sel].id))
+		view_print();
+}
+
 void
 view_scroll_down(enum menu_scroll scroll)
 {
@@ -322,6 +335,17 @@ view_select_view(enum view_id id)
 			}
 }
 
+/*
+ * Mark a view as dirty so that the main thread redraws it. This function can
+ * be called from any thread.
+ */
+void
+view_set_dirty(enum view_id id)
+{
+	atomic_fetch_or(&view_dirty, 1U << id);
+	input_wakeup();
+}
+
 void
 view_reactivate_entry(void)
 {